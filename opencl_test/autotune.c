@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "bench.h"
+#include "autotune.h"
+
+#define AUTOTUNE_LINE_LEN 1024
+
+static int tune_enabled = 0;
+static int tune_always = 0;
+static const char *tune_file = NULL;
+
+/* With tuning disabled autotune_kernel() only returns saved results.
+ * retune ignores saved results and sweeps again.
+ */
+void autotune_enable(int enable, int retune)
+{
+	tune_enabled = enable || retune;
+	tune_always = retune;
+}
+
+void autotune_set_file(const char *filename)
+{
+	tune_file = filename;
+}
+
+static const char *get_autotune_file(void)
+{
+	const char *filename;
+
+	if (tune_file != NULL)
+		return tune_file;
+
+	filename = getenv("OPENCL_TEST_AUTOTUNE_FILE");
+	if (filename != NULL)
+		return filename;
+
+	return AUTOTUNE_FILE;
+}
+
+/* Saved results are keyed by device name, driver version, kernel name and
+ * input size, one tab separated line each:
+ *   device driver kernel total_items global_size local_size items_per_item seconds
+ */
+static void get_autotune_key(cl_device_id device, const char *kernel_name, size_t total_items, char *key, size_t key_len)
+{
+	char *name = NULL;
+	char *driver = NULL;
+	int name_len = 0;
+	int driver_len = 0;
+
+	get_device_info(device, CL_DEVICE_NAME, &name, &name_len);
+	get_device_info(device, CL_DRIVER_VERSION, &driver, &driver_len);
+	snprintf(key, key_len, "%s\t%s\t%s\t%llu\t", name, driver, kernel_name, (unsigned long long) total_items);
+
+	free(name);
+	free(driver);
+}
+
+/* Only a configuration that covers exactly total_items and divides into
+ * whole work-groups is returned; anything else in the file is ignored.
+ */
+int autotune_load(cl_device_id device, const char *kernel_name, size_t total_items, struct tune_config *cfg)
+{
+	FILE *fp;
+	char key[AUTOTUNE_LINE_LEN];
+	char line[AUTOTUNE_LINE_LEN];
+	unsigned long long global_size, local_size;
+	unsigned int items_per_item;
+	size_t key_len;
+	int found = 0;
+
+	fp = fopen(get_autotune_file(), "r");
+	if (fp == NULL)
+		return 0;
+
+	get_autotune_key(device, kernel_name, total_items, key, sizeof(key));
+	key_len = strlen(key);
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (strncmp(line, key, key_len) != 0)
+			continue;
+
+		if (sscanf(line + key_len, "%llu\t%llu\t%u", &global_size, &local_size, &items_per_item) != 3)
+			continue;
+
+		if (local_size == 0 || global_size % local_size != 0 || global_size * items_per_item != total_items)
+			continue;
+
+		cfg->global_size = (size_t) global_size;
+		cfg->local_size = (size_t) local_size;
+		cfg->items_per_item = items_per_item;
+		found = 1;
+	}
+
+	fclose(fp);
+
+	return found;
+}
+
+/* Rewrite the file with this device/kernel/size entry replaced.
+ */
+void autotune_save(cl_device_id device, const char *kernel_name, size_t total_items, const struct tune_config *cfg, double seconds)
+{
+	FILE *fp;
+	char key[AUTOTUNE_LINE_LEN];
+	char line[AUTOTUNE_LINE_LEN];
+	char *contents = NULL;
+	size_t contents_len = 0;
+	size_t key_len, line_len;
+	const char *filename = get_autotune_file();
+
+	get_autotune_key(device, kernel_name, total_items, key, sizeof(key));
+	key_len = strlen(key);
+
+	fp = fopen(filename, "r");
+	if (fp != NULL)
+	{
+		while (fgets(line, sizeof(line), fp) != NULL)
+		{
+			if (strncmp(line, key, key_len) == 0)
+				continue;
+
+			line_len = strlen(line);
+			contents = (char *) realloc(contents, contents_len + line_len + 1);
+			if (contents == NULL)
+			{
+				fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+				exit(1);
+			}
+			memcpy(contents + contents_len, line, line_len + 1);
+			contents_len += line_len;
+		}
+		fclose(fp);
+	}
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Failed to open file: %s\n", filename);
+		free(contents);
+		return;
+	}
+
+	if (contents != NULL)
+		fputs(contents, fp);
+	fprintf(fp, "%s%llu\t%llu\t%u\t%.9f\n", key, (unsigned long long) cfg->global_size, (unsigned long long) cfg->local_size, cfg->items_per_item, seconds);
+	fclose(fp);
+
+	free(contents);
+}
+
+static double time_config(cl_command_queue queue, cl_kernel kernel, const struct tune_config *cfg, tune_launch_fn launch, void *arg)
+{
+	double t0, t, best = -1.0;
+	int i;
+
+	/* Warm up, and find out whether the configuration is usable at all. */
+	if (launch(queue, kernel, cfg, arg) != 0)
+		return -1.0;
+
+	for (i = 0; i < AUTOTUNE_REPS; i++)
+	{
+		t0 = bench_now();
+		if (launch(queue, kernel, cfg, arg) != 0)
+			return -1.0;
+		t = bench_now() - t0;
+
+		if (best < 0 || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+/* Find the fastest configuration for a kernel over total_items input items.
+ * Local sizes are the kernel's preferred work-group size multiple times
+ * powers of two up to the kernel and device limits, plus 1 for CPU style
+ * launches. Items per work-item are powers of two up to max_items_per_item
+ * that divide the input evenly, which sets the global size. A saved result
+ * for the same input size is returned directly unless retuning was asked
+ * for, even with tuning disabled.
+ *
+ * Returns 1 if best was filled in, 0 if there was no saved result and
+ * tuning is disabled (the caller should use its own default).
+ */
+int autotune_kernel(cl_command_queue queue, cl_device_id device, cl_kernel kernel, const char *kernel_name,
+	size_t total_items, cl_uint max_items_per_item, tune_launch_fn launch, void *arg, struct tune_config *best)
+{
+	struct tune_config cfg;
+	size_t max_local_size, kernel_local_size, multiple;
+	size_t local_size;
+	cl_uint items_per_item;
+	double t, best_time = -1.0;
+	cl_int err;
+
+	if (!tune_always && autotune_load(device, kernel_name, total_items, best))
+		return 1;
+
+	if (!tune_enabled)
+		return 0;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_local_size, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_local_size, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, NULL);
+	CL_CHECK_ERR(err);
+
+	if (kernel_local_size < max_local_size)
+		max_local_size = kernel_local_size;
+	if (multiple < 1)
+		multiple = 1;
+
+	printf("Autotuning %s (max work-group size %u, preferred multiple %u)\n", kernel_name, (unsigned int) max_local_size, (unsigned int) multiple);
+
+	for (items_per_item = 1; items_per_item <= max_items_per_item; items_per_item *= 2)
+	{
+		if (total_items % items_per_item != 0)
+			continue;
+
+		cfg.items_per_item = items_per_item;
+		cfg.global_size = total_items / items_per_item;
+
+		for (local_size = 1; local_size <= max_local_size; local_size = (local_size < multiple) ? multiple : local_size * 2)
+		{
+			if (local_size > cfg.global_size || cfg.global_size % local_size != 0)
+				continue;
+
+			cfg.local_size = local_size;
+			t = time_config(queue, kernel, &cfg, launch, arg);
+			if (t < 0)
+				continue;
+
+			if (best_time < 0 || t < best_time)
+			{
+				best_time = t;
+				*best = cfg;
+			}
+		}
+	}
+
+	if (best_time < 0)
+	{
+		fprintf(stderr, "Autotuning %s found no usable configuration\n", kernel_name);
+		return 0;
+	}
+
+	printf("Autotuned %s: global %u, local %u, %u items per work-item, %.3f ms\n", kernel_name,
+		(unsigned int) best->global_size, (unsigned int) best->local_size, best->items_per_item, best_time * 1e3);
+
+	autotune_save(device, kernel_name, total_items, best, best_time);
+
+	return 1;
+}
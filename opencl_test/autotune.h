@@ -0,0 +1,31 @@
+#ifndef TEST_AUTOTUNE_H
+#define TEST_AUTOTUNE_H
+
+#define AUTOTUNE_FILE "autotune.txt"
+#define AUTOTUNE_REPS 3
+
+/* A launch configuration. items_per_item is how many input items each
+ * work-item handles, so global_size * items_per_item covers the input.
+ */
+struct tune_config
+{
+	size_t global_size;
+	size_t local_size;
+	cl_uint items_per_item;
+};
+
+/* Launch kernel once with cfg and wait for it to finish. Return 0 on
+ * success or non-zero to skip a configuration the kernel cannot use.
+ */
+typedef int (*tune_launch_fn)(cl_command_queue queue, cl_kernel kernel, const struct tune_config *cfg, void *arg);
+
+void autotune_enable(int enable, int retune);
+void autotune_set_file(const char *filename);
+
+int autotune_load(cl_device_id device, const char *kernel_name, size_t total_items, struct tune_config *cfg);
+void autotune_save(cl_device_id device, const char *kernel_name, size_t total_items, const struct tune_config *cfg, double seconds);
+
+int autotune_kernel(cl_command_queue queue, cl_device_id device, cl_kernel kernel, const char *kernel_name,
+	size_t total_items, cl_uint max_items_per_item, tune_launch_fn launch, void *arg, struct tune_config *best);
+
+#endif
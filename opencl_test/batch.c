@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "buffer.h"
+#include "batch.h"
+
+/* Make room for need elements, doubling. */
+static void *batch_grow(void *p, size_t *capacity, size_t need, size_t elem)
+{
+	size_t n = *capacity > 0 ? *capacity : 64;
+
+	if (need <= *capacity && p != NULL)
+		return p;
+
+	while (n < need)
+		n *= 2;
+
+	p = realloc(p, n * elem);
+	if (p == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	*capacity = n;
+	return p;
+}
+
+/* Grow a device buffer to hold size bytes and copy them in. Never zero
+ * sized, an empty table still has to be bound.
+ */
+static void batch_upload(struct batch *b, struct host_buffer *buf, size_t *capacity, const void *src, size_t size, const char *name)
+{
+	void *p;
+
+	if (size > *capacity || buf->mem == NULL)
+	{
+		if (buf->mem != NULL)
+			buffer_release(buf);
+		*capacity = size > *capacity * 2 ? size : *capacity * 2;
+		if (*capacity == 0)
+			*capacity = sizeof(cl_uint);
+		buffer_create(buf, b->context, CL_MEM_READ_ONLY, *capacity, name);
+	}
+
+	if (size == 0)
+		return;
+
+	p = buffer_map(buf, b->queue, CL_MAP_WRITE);
+	memcpy(p, src, size);
+	buffer_unmap(buf, b->queue);
+}
+
+static size_t kernel_group_size(cl_kernel kernel, cl_device_id device)
+{
+	size_t size;
+	cl_int err;
+
+	err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size), &size, NULL);
+	CL_CHECK_ERR(err);
+	return size;
+}
+
+void batch_init(struct batch *b, cl_context context, cl_device_id device, cl_command_queue queue, cl_program program)
+{
+	cl_uint compute_units;
+	size_t max_size;
+	cl_int err;
+
+	memset(b, 0, sizeof(*b));
+	b->context = context;
+	b->queue = queue;
+
+	b->segments = clCreateKernel(program, "batch_segments", &err);
+	CL_CHECK_ERR(err);
+	b->persistent = clCreateKernel(program, "batch_persistent", &err);
+	CL_CHECK_ERR(err);
+
+	/* The segment reduction wants a power of two. */
+	max_size = kernel_group_size(b->segments, device);
+	if (kernel_group_size(b->persistent, device) < max_size)
+		max_size = kernel_group_size(b->persistent, device);
+	b->local_size = BATCH_LOCAL_SIZE;
+	while (b->local_size > max_size)
+		b->local_size /= 2;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+	CL_CHECK_ERR(err);
+	b->persistent_groups = (size_t) compute_units * BATCH_GROUPS_PER_CU;
+
+	b->head_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+}
+
+static struct batch_segment *batch_new_segment(struct batch *b, cl_uint kind, size_t first, size_t count)
+{
+	struct batch_segment *seg;
+
+	b->segs = (struct batch_segment *) batch_grow(b->segs, &b->seg_capacity, b->num_segs + 1, sizeof(struct batch_segment));
+	seg = &b->segs[b->num_segs++];
+	memset(seg, 0, sizeof(*seg));
+	seg->kind = kind;
+	seg->first = (cl_uint) first;
+	seg->count = (cl_uint) count;
+	seg->out = (cl_uint) b->num_out;
+	return seg;
+}
+
+/* Key i is keys[offsets[i]] up to keys[offsets[i + 1]], as in hash.h;
+ * offsets need not start at 0. The keys are copied.
+ */
+size_t batch_add_hash(struct batch *b, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed)
+{
+	struct batch_segment *seg;
+	size_t bytes = offsets[num_keys] - offsets[0];
+	size_t out = b->num_out;
+	size_t i;
+
+	b->keys = (char *) batch_grow(b->keys, &b->key_capacity, b->key_bytes + bytes, 1);
+	b->offsets = (cl_uint *) batch_grow(b->offsets, &b->offset_capacity, b->num_keys + num_keys + 1, sizeof(cl_uint));
+
+	memcpy(&b->keys[b->key_bytes], &keys[offsets[0]], bytes);
+	for (i = 0; i <= num_keys; i++)
+		b->offsets[b->num_keys + i] = (cl_uint) (b->key_bytes + offsets[i] - offsets[0]);
+
+	seg = batch_new_segment(b, BATCH_HASH, b->num_keys, num_keys);
+	seg->seed = seed;
+
+	b->num_keys += num_keys;
+	b->key_bytes += bytes;
+	b->num_out += num_keys;
+	return out;
+}
+
+/* The min of an empty request is (cl_uint) -1. */
+size_t batch_add_min(struct batch *b, const cl_uint *values, size_t n)
+{
+	size_t out = b->num_out;
+
+	b->values = (cl_uint *) batch_grow(b->values, &b->value_capacity, b->num_values + n, sizeof(cl_uint));
+	memcpy(&b->values[b->num_values], values, n * sizeof(cl_uint));
+
+	batch_new_segment(b, BATCH_MIN, b->num_values, n);
+
+	b->num_values += n;
+	b->num_out += 1;
+	return out;
+}
+
+/* Run everything queued in one launch and read the results back. Returns
+ * the number of requests run; the queue is empty afterwards.
+ */
+size_t batch_flush(struct batch *b, int mode)
+{
+	cl_kernel kernel = mode == BATCH_PERSISTENT ? b->persistent : b->segments;
+	cl_uint num_segs = (cl_uint) b->num_segs;
+	cl_uint zero = 0;
+	size_t num_groups, global_size, flushed;
+	void *p;
+	cl_event ev;
+	cl_int err;
+
+	if (b->num_segs == 0)
+		return 0;
+
+	batch_upload(b, &b->seg_buf, &b->dev_segs, b->segs, b->num_segs * sizeof(struct batch_segment), "batch segments");
+	batch_upload(b, &b->key_buf, &b->dev_key_bytes, b->keys, b->key_bytes, "batch keys");
+	batch_upload(b, &b->offset_buf, &b->dev_offsets, b->offsets, b->num_keys > 0 ? (b->num_keys + 1) * sizeof(cl_uint) : 0, "batch offsets");
+	batch_upload(b, &b->value_buf, &b->dev_values, b->values, b->num_values * sizeof(cl_uint), "batch values");
+
+	if (b->num_out * sizeof(cl_uint) > b->dev_out || b->out_buf.mem == NULL)
+	{
+		if (b->out_buf.mem != NULL)
+			buffer_release(&b->out_buf);
+		b->dev_out = b->num_out * sizeof(cl_uint) > b->dev_out * 2 ? b->num_out * sizeof(cl_uint) : b->dev_out * 2;
+		if (b->dev_out == 0)
+			b->dev_out = sizeof(cl_uint);
+		buffer_create(&b->out_buf, b->context, CL_MEM_READ_WRITE, b->dev_out, "batch out");
+	}
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &b->seg_buf.mem);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &num_segs);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &b->key_buf.mem);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &b->offset_buf.mem);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &b->value_buf.mem);
+	err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &b->out_buf.mem);
+	err |= clSetKernelArg(kernel, 6, b->local_size * sizeof(cl_uint), NULL);
+	CL_CHECK_ERR(err);
+
+	num_groups = b->num_segs;
+	if (mode == BATCH_PERSISTENT)
+	{
+		err = clSetKernelArg(kernel, 7, sizeof(cl_mem), &b->head_buf);
+		CL_CHECK_ERR(err);
+		err = clEnqueueFillBuffer(b->queue, b->head_buf, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		if (num_groups > b->persistent_groups)
+			num_groups = b->persistent_groups;
+	}
+
+	global_size = num_groups * b->local_size;
+	err = clEnqueueNDRangeKernel(b->queue, kernel, 1, NULL, &global_size, &b->local_size, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev, mode == BATCH_PERSISTENT ? "batch_persistent" : "batch_segments", PROF_KERNEL);
+
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+
+	b->results = (cl_uint *) batch_grow(b->results, &b->result_capacity, b->num_out, sizeof(cl_uint));
+	if (b->num_out > 0)
+	{
+		p = buffer_map(&b->out_buf, b->queue, CL_MAP_READ);
+		memcpy(b->results, p, b->num_out * sizeof(cl_uint));
+		buffer_unmap(&b->out_buf, b->queue);
+	}
+
+	flushed = b->num_segs;
+	b->num_segs = 0;
+	b->num_keys = 0;
+	b->key_bytes = 0;
+	b->num_values = 0;
+	b->num_out = 0;
+	b->launches++;
+	return flushed;
+}
+
+/* Results of the last flush, indexed by what the adds returned. */
+const cl_uint *batch_results(const struct batch *b)
+{
+	return b->results;
+}
+
+void batch_release(struct batch *b)
+{
+	cl_int err;
+
+	if (b->seg_buf.mem != NULL)
+		buffer_release(&b->seg_buf);
+	if (b->key_buf.mem != NULL)
+		buffer_release(&b->key_buf);
+	if (b->offset_buf.mem != NULL)
+		buffer_release(&b->offset_buf);
+	if (b->value_buf.mem != NULL)
+		buffer_release(&b->value_buf);
+	if (b->out_buf.mem != NULL)
+		buffer_release(&b->out_buf);
+
+	err = clReleaseMemObject(b->head_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(b->segments); CL_CHECK_ERR(err);
+	err = clReleaseKernel(b->persistent); CL_CHECK_ERR(err);
+
+	free(b->segs);
+	free(b->keys);
+	free(b->offsets);
+	free(b->values);
+	free(b->results);
+}
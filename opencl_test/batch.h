@@ -0,0 +1,77 @@
+#ifndef TEST_BATCH_H
+#define TEST_BATCH_H
+
+/* Request batching. Small requests are queued on the host and a flush runs
+ * them all in one launch, one segment per request, described by a table
+ * of batch_segment that must match the one in test.cl.
+ *
+ * BATCH_LAUNCH runs one work-group per segment. BATCH_PERSISTENT launches
+ * a fixed number of work-groups per compute unit that pull segment
+ * indices from a counter in global memory until the table is empty, so
+ * the launch size does not depend on the batch and long and short
+ * segments balance out.
+ *
+ * Each request gets a range of the output: one hash per key for
+ * batch_add_hash(), one value for batch_add_min(). The index returned by
+ * the add is where its results are in batch_results() after the flush.
+ */
+#define BATCH_HASH 0
+#define BATCH_MIN 1
+
+#define BATCH_LAUNCH 0
+#define BATCH_PERSISTENT 1
+
+#define BATCH_LOCAL_SIZE 64
+#define BATCH_GROUPS_PER_CU 4
+
+struct batch_segment
+{
+	cl_uint kind;
+	cl_uint first;
+	cl_uint count;
+	cl_uint out;
+	cl_uint seed;
+	cl_uint pad[3];
+};
+
+struct batch
+{
+	cl_context context;
+	cl_command_queue queue;
+	cl_kernel segments;
+	cl_kernel persistent;
+	size_t local_size;
+	size_t persistent_groups;
+
+	/* Queued on the host. */
+	struct batch_segment *segs;
+	char *keys;
+	cl_uint *offsets;
+	cl_uint *values;
+	size_t num_segs, seg_capacity;
+	size_t num_keys, key_bytes, key_capacity, offset_capacity;
+	size_t num_values, value_capacity;
+	size_t num_out;
+
+	/* On the device, grown to the largest batch seen. */
+	struct host_buffer seg_buf;
+	struct host_buffer key_buf;
+	struct host_buffer offset_buf;
+	struct host_buffer value_buf;
+	struct host_buffer out_buf;
+	cl_mem head_buf;
+	size_t dev_segs, dev_key_bytes, dev_offsets, dev_values, dev_out;
+
+	cl_uint *results;
+	size_t result_capacity;
+	int launches;
+};
+
+void batch_init(struct batch *b, cl_context context, cl_device_id device, cl_command_queue queue, cl_program program);
+size_t batch_add_hash(struct batch *b, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed);
+size_t batch_add_min(struct batch *b, const cl_uint *values, size_t n);
+size_t batch_flush(struct batch *b, int mode);
+const cl_uint *batch_results(const struct batch *b);
+void batch_release(struct batch *b);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "bench.h"
+
+/* Results are allocated one at a time and only the pointer table grows,
+ * so a result returned earlier stays valid as a baseline.
+ */
+static struct bench_result **results = NULL;
+static int num_results = 0;
+static int max_results = 0;
+static char current_label[64] = "";
+static int warmup_reps = BENCH_DEFAULT_WARMUP;
+static int timed_reps = BENCH_DEFAULT_REPS;
+static int num_failures = 0;
+
+/* Monotonic wall clock in seconds.
+ */
+double bench_now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER c;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&c);
+
+	return (double) c.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* Label attached to every following result, usually the device name.
+ */
+void bench_set_label(const char *label)
+{
+	strncpy(current_label, label, sizeof(current_label) - 1);
+	current_label[sizeof(current_label) - 1] = '\0';
+}
+
+void bench_set_reps(int warmup, int reps)
+{
+	warmup_reps = warmup < 0 ? 0 : warmup;
+	timed_reps = reps < 1 ? 1 : reps;
+}
+
+int bench_get_reps(void)
+{
+	return timed_reps;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Summarise samples (sorted in place) and add them to the result table.
+ * Never returns NULL.
+ */
+struct bench_result *bench_record(const char *name, double *samples, int reps, double bytes, double items)
+{
+	struct bench_result *r;
+	double sum;
+	int i;
+
+	if (num_results == max_results)
+	{
+		max_results = max_results ? max_results * 2 : BENCH_INITIAL_RESULTS;
+		results = (struct bench_result **) realloc(results, max_results * sizeof(struct bench_result *));
+		if (results == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+
+	r = (struct bench_result *) calloc(1, sizeof(struct bench_result));
+	if (r == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+	results[num_results++] = r;
+
+	strncpy(r->label, current_label, sizeof(r->label) - 1);
+	r->label[sizeof(r->label) - 1] = '\0';
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->name[sizeof(r->name) - 1] = '\0';
+	r->reps = reps;
+	r->bytes = bytes;
+	r->items = items;
+
+	if (reps < 1)
+		return r;
+
+	qsort(samples, reps, sizeof(double), compare_double);
+
+	sum = 0.0;
+	for (i = 0; i < reps; i++)
+		sum += samples[i];
+
+	r->min = samples[0];
+	r->median = (reps % 2) ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2.0;
+	r->p99 = samples[(reps * 99 + 99) / 100 - 1];
+	r->mean = sum / reps;
+
+	return r;
+}
+
+/* Run fn for the configured number of warmup and timed repetitions. fn must
+ * not return until its work is complete, e.g. by calling clFinish.
+ */
+struct bench_result *bench_run(const char *name, bench_fn fn, void *arg, double bytes, double items)
+{
+	struct bench_result *r;
+	double *samples;
+	double t0;
+	int i;
+
+	for (i = 0; i < warmup_reps; i++)
+		fn(arg);
+
+	samples = (double *) malloc(timed_reps * sizeof(double));
+	if (samples == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < timed_reps; i++)
+	{
+		t0 = bench_now();
+		fn(arg);
+		samples[i] = bench_now() - t0;
+	}
+
+	r = bench_record(name, samples, timed_reps, bytes, items);
+	free(samples);
+
+	bench_print(r);
+
+	return r;
+}
+
+void bench_print(const struct bench_result *r)
+{
+	printf("%s: %d reps, min %.3f ms, median %.3f ms, p99 %.3f ms", r->name, r->reps, r->min * 1e3, r->median * 1e3, r->p99 * 1e3);
+
+	if (r->bytes > 0 && r->median > 0)
+		printf(", %.2f GB/sec", r->bytes / r->median / 1e9);
+
+	if (r->items > 0 && r->median > 0)
+		printf(", %.2f M items/sec", r->items / r->median / 1e6);
+
+	printf("\n");
+}
+
+/* One line comparing a result with a baseline, e.g. a kernel with the best
+ * native CPU code for the same job.
+ */
+void bench_print_speedup(const struct bench_result *r, const struct bench_result *baseline)
+{
+	if (r == NULL || baseline == NULL || r->median <= 0)
+		return;
+
+	printf("%s: %.2fx vs %s\n", r->name, baseline->median / r->median, baseline->name);
+}
+
+void bench_print_summary(void)
+{
+	const struct bench_result *r;
+	int i;
+
+	if (num_results == 0)
+		return;
+
+	printf("\n%-32s %-36s %6s %10s %10s %10s %10s %12s\n", "device", "benchmark", "reps", "min ms", "median ms", "p99 ms", "GB/sec", "Mitems/sec");
+
+	for (i = 0; i < num_results; i++)
+	{
+		r = results[i];
+		printf("%-32.32s %-36.36s %6d %10.3f %10.3f %10.3f %10.2f %12.2f\n",
+			r->label, r->name, r->reps, r->min * 1e3, r->median * 1e3, r->p99 * 1e3,
+			r->median > 0 ? r->bytes / r->median / 1e9 : 0.0,
+			r->median > 0 ? r->items / r->median / 1e6 : 0.0);
+	}
+}
+
+/* Record a correctness check, returning ok so it can wrap the condition
+ * that decides between "result correct" and "result incorrect".
+ */
+int bench_check(int ok)
+{
+	if (!ok)
+		num_failures++;
+
+	return ok;
+}
+
+int bench_failures(void)
+{
+	return num_failures;
+}
+
+/* Append all results to a CSV file so runs can be compared over time. The
+ * header is only written when the file is new. "-" writes to stdout.
+ */
+int bench_write_csv(const char *filename)
+{
+	FILE *fp;
+	const struct bench_result *r;
+	time_t now;
+	long pos;
+	int i;
+
+	if (strcmp(filename, "-") == 0)
+	{
+		fp = stdout;
+		pos = 0;
+	}
+	else
+	{
+		fp = fopen(filename, "a");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "Failed to open file: %s\n", filename);
+			return -1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		pos = ftell(fp);
+	}
+
+	if (pos == 0)
+		fprintf(fp, "time,device,benchmark,reps,min_s,median_s,p99_s,mean_s,bytes,items,gb_per_sec,items_per_sec\n");
+
+	time(&now);
+	for (i = 0; i < num_results; i++)
+	{
+		r = results[i];
+		fprintf(fp, "%lld,\"%s\",\"%s\",%d,%.9f,%.9f,%.9f,%.9f,%.0f,%.0f,%.4f,%.1f\n",
+			(long long) now, r->label, r->name, r->reps, r->min, r->median, r->p99, r->mean, r->bytes, r->items,
+			r->median > 0 ? r->bytes / r->median / 1e9 : 0.0,
+			r->median > 0 ? r->items / r->median : 0.0);
+	}
+
+	if (fp != stdout)
+		fclose(fp);
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+#define BENCH_INITIAL_RESULTS 256
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_DEFAULT_REPS 20
+
+/* Timings are in seconds. bytes and items are per repetition and may be 0
+ * when a rate makes no sense for the benchmark.
+ */
+struct bench_result
+{
+	char label[64];
+	char name[64];
+	int reps;
+	double min;
+	double median;
+	double p99;
+	double mean;
+	double bytes;
+	double items;
+};
+
+typedef void (*bench_fn)(void *arg);
+
+double bench_now(void);
+
+void bench_set_label(const char *label);
+void bench_set_reps(int warmup, int reps);
+int bench_get_reps(void);
+
+struct bench_result *bench_run(const char *name, bench_fn fn, void *arg, double bytes, double items);
+struct bench_result *bench_record(const char *name, double *samples, int reps, double bytes, double items);
+
+void bench_print(const struct bench_result *result);
+void bench_print_speedup(const struct bench_result *result, const struct bench_result *baseline);
+void bench_print_summary(void);
+
+int bench_check(int ok);
+int bench_failures(void);
+int bench_write_csv(const char *filename);
+
+#endif
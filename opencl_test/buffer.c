@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "buffer.h"
+
+#define BUFFER_PAGE_SIZE 4096
+
+static int buffer_mode = BUFFER_COPY;
+
+void buffer_set_mode(int mode)
+{
+	buffer_mode = mode;
+}
+
+int buffer_get_mode(void)
+{
+	return buffer_mode;
+}
+
+const char *buffer_mode_name(int mode)
+{
+	return mode == BUFFER_ZERO_COPY ? "zero-copy" : "copy";
+}
+
+/* CL_DEVICE_MEM_BASE_ADDR_ALIGN is in bits. Round it up to a page, which
+ * is what CPU runtimes want before they will use host memory directly.
+ */
+size_t get_device_alignment(cl_device_id device)
+{
+	cl_uint align_bits;
+	size_t align;
+	cl_int err;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &align_bits, NULL);
+	CL_CHECK_ERR(err);
+
+	align = align_bits / 8;
+	if (align < BUFFER_PAGE_SIZE)
+		align = BUFFER_PAGE_SIZE;
+
+	return align;
+}
+
+/* Over-allocate and stash the original pointer just below the aligned
+ * block, so this works the same with every C runtime.
+ */
+void *aligned_malloc(size_t size, size_t align)
+{
+	void *raw;
+	uintptr_t p;
+
+	raw = malloc(size + align + sizeof(void *));
+	if (raw == NULL)
+		return NULL;
+
+	p = ((uintptr_t) raw + sizeof(void *) + align - 1) & ~((uintptr_t) align - 1);
+	((void **) p)[-1] = raw;
+
+	return (void *) p;
+}
+
+void aligned_free(void *p)
+{
+	if (p != NULL)
+		free(((void **) p)[-1]);
+}
+
+void buffer_create(struct host_buffer *b, cl_context context, cl_mem_flags flags, size_t size, const char *name)
+{
+	cl_device_id device;
+	size_t align;
+	cl_int err;
+
+	b->name = name;
+	b->size = size;
+	b->mode = buffer_mode;
+	b->map_flags = 0;
+	b->mapped = NULL;
+
+	if (b->mode == BUFFER_ZERO_COPY)
+	{
+		err = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, NULL);
+		CL_CHECK_ERR(err);
+		align = get_device_alignment(device);
+
+		/* Sizes are rounded to a cache line too, as the Intel SDK asks. */
+		b->host = aligned_malloc((size + 63) & ~(size_t) 63, align);
+		if (b->host == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+
+		b->mem = clCreateBuffer(context, flags | CL_MEM_USE_HOST_PTR, size, b->host, &err);
+		CL_CHECK_ERR(err);
+	}
+	else
+	{
+		b->host = malloc(size);
+		if (b->host == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+
+		b->mem = clCreateBuffer(context, flags, size, NULL, &err);
+		CL_CHECK_ERR(err);
+	}
+}
+
+/* Block until the buffer contents are available to the host. Mapping with
+ * only CL_MAP_WRITE skips the read back in copy mode.
+ */
+void *buffer_map(struct host_buffer *b, cl_command_queue queue, cl_map_flags map_flags)
+{
+	cl_event ev;
+	cl_int err;
+
+	b->map_flags = map_flags;
+
+	if (b->mode == BUFFER_ZERO_COPY)
+	{
+		b->mapped = clEnqueueMapBuffer(queue, b->mem, CL_TRUE, map_flags, 0, b->size, 0, NULL, &ev, &err);
+		CL_CHECK_ERR(err);
+		prof_event(ev, b->name, PROF_MAP);
+		err = clReleaseEvent(ev);
+		CL_CHECK_ERR(err);
+	}
+	else
+	{
+		if (map_flags & CL_MAP_READ)
+		{
+			err = clEnqueueReadBuffer(queue, b->mem, CL_TRUE, 0, b->size, b->host, 0, NULL, &ev);
+			CL_CHECK_ERR(err);
+			prof_event(ev, b->name, PROF_READ);
+			err = clReleaseEvent(ev);
+			CL_CHECK_ERR(err);
+		}
+		b->mapped = b->host;
+	}
+
+	return b->mapped;
+}
+
+/* Hand the buffer back to the device, uploading host writes in copy mode.
+ */
+void buffer_unmap(struct host_buffer *b, cl_command_queue queue)
+{
+	cl_event ev;
+	cl_int err;
+
+	if (b->mapped == NULL)
+		return;
+
+	if (b->mode == BUFFER_ZERO_COPY)
+	{
+		err = clEnqueueUnmapMemObject(queue, b->mem, b->mapped, 0, NULL, &ev);
+		CL_CHECK_ERR(err);
+		err = clWaitForEvents(1, &ev);
+		CL_CHECK_ERR(err);
+		prof_event(ev, b->name, PROF_MAP);
+		err = clReleaseEvent(ev);
+		CL_CHECK_ERR(err);
+	}
+	else if (b->map_flags & CL_MAP_WRITE)
+	{
+		err = clEnqueueWriteBuffer(queue, b->mem, CL_TRUE, 0, b->size, b->host, 0, NULL, &ev);
+		CL_CHECK_ERR(err);
+		prof_event(ev, b->name, PROF_WRITE);
+		err = clReleaseEvent(ev);
+		CL_CHECK_ERR(err);
+	}
+
+	b->mapped = NULL;
+}
+
+void buffer_release(struct host_buffer *b)
+{
+	cl_int err;
+
+	err = clReleaseMemObject(b->mem);
+	CL_CHECK_ERR(err);
+
+	if (b->mode == BUFFER_ZERO_COPY)
+		aligned_free(b->host);
+	else
+		free(b->host);
+
+	b->host = NULL;
+	b->mem = NULL;
+}
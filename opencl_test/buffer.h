@@ -0,0 +1,41 @@
+#ifndef TEST_BUFFER_H
+#define TEST_BUFFER_H
+
+/* How host data reaches a buffer.
+ *
+ * BUFFER_COPY keeps a separate malloc'd host copy. Mapping for read reads
+ * the buffer back into it and unmapping after a write uploads it.
+ *
+ * BUFFER_ZERO_COPY backs the buffer with host memory aligned to the
+ * device's CL_DEVICE_MEM_BASE_ADDR_ALIGN (and at least a page) via
+ * CL_MEM_USE_HOST_PTR, and maps it with clEnqueueMapBuffer. CPU runtimes
+ * can then hand out the same memory with no copy at all.
+ */
+#define BUFFER_COPY 0
+#define BUFFER_ZERO_COPY 1
+
+struct host_buffer
+{
+	const char *name;
+	cl_mem mem;
+	void *host;
+	size_t size;
+	int mode;
+	cl_map_flags map_flags;
+	void *mapped;
+};
+
+void buffer_set_mode(int mode);
+int buffer_get_mode(void);
+const char *buffer_mode_name(int mode);
+
+size_t get_device_alignment(cl_device_id device);
+void *aligned_malloc(size_t size, size_t align);
+void aligned_free(void *p);
+
+void buffer_create(struct host_buffer *b, cl_context context, cl_mem_flags flags, size_t size, const char *name);
+void *buffer_map(struct host_buffer *b, cl_command_queue queue, cl_map_flags map_flags);
+void buffer_unmap(struct host_buffer *b, cl_command_queue queue);
+void buffer_release(struct host_buffer *b);
+
+#endif
@@ -2,6 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <CL/cl.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MKDIR(dir) _mkdir(dir)
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#define MKDIR(dir) mkdir(dir, 0755)
+#endif
 
 #include "common.h"
 
@@ -68,11 +76,11 @@ char *get_error_string(cl_int err)
 char *get_platform_info(cl_platform_id platform, cl_platform_info platform_info, char **buffer, int *len)
 {
 	cl_int err;
-	int required_len = 256;
+	size_t required_len = 256;
 	
 	do
 	{
-		if (*len < required_len)
+		if ((size_t) *len < required_len)
 		{
 			*buffer = (char *) realloc(*buffer, required_len * sizeof(char));
 			if (buffer == NULL)
@@ -81,12 +89,12 @@ char *get_platform_info(cl_platform_id platform, cl_platform_info platform_info,
 				return NULL;
 			}
 
-			*len = required_len;
+			*len = (int) required_len;
 		}
 
 		err = clGetPlatformInfo(platform, platform_info, *len, *buffer, &required_len);
 		CL_CHECK_ERR(err);
-	} while (*len < required_len);
+	} while ((size_t) *len < required_len);
 
 	return *buffer;
 }
@@ -94,11 +102,11 @@ char *get_platform_info(cl_platform_id platform, cl_platform_info platform_info,
 char *get_device_info(cl_device_id device, cl_device_info device_info, char **buffer, int *len)
 {
 	cl_int err;
-	int required_len = 256;
+	size_t required_len = 256;
 
 	do
 	{
-		if (*len < required_len)
+		if ((size_t) *len < required_len)
 		{
 			*buffer = (char *)realloc(*buffer, required_len * sizeof(char));
 			if (buffer == NULL)
@@ -107,12 +115,12 @@ char *get_device_info(cl_device_id device, cl_device_info device_info, char **bu
 				return NULL;
 			}
 
-			*len = required_len;
+			*len = (int) required_len;
 		}
 
 		err = clGetDeviceInfo(device, device_info, *len, *buffer, &required_len);
 		CL_CHECK_ERR(err);
-	} while (*len < required_len);
+	} while ((size_t) *len < required_len);
 
 	return *buffer;
 }
@@ -348,14 +356,280 @@ cl_device_id get_device(cl_platform_id platform, cl_device_type device_type, con
 	return device;
 }
 
+/* Split a device into one sub-device per affinity domain, e.g.
+ * CL_DEVICE_AFFINITY_DOMAIN_NUMA for one sub-device per NUMA node. Returns
+ * the number of sub-devices, or 0 if the device cannot be partitioned that
+ * way (single node machines and most GPUs). Release the sub-devices with
+ * release_sub_devices().
+ */
+int get_sub_devices(cl_device_id device, cl_device_affinity_domain domain, cl_device_id **sub_devices)
+{
+	cl_int err;
+	cl_uint num;
+	cl_device_partition_property props[3];
+
+	*sub_devices = NULL;
+
+	props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+	props[1] = (cl_device_partition_property) domain;
+	props[2] = 0;
+
+	err = clCreateSubDevices(device, props, 0, NULL, &num);
+	if (err != CL_SUCCESS || num < 1)
+		return 0;
+
+	*sub_devices = (cl_device_id *) malloc(num * sizeof(cl_device_id));
+	if (*sub_devices == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	err = clCreateSubDevices(device, props, num, *sub_devices, NULL);
+	CL_CHECK_ERR(err);
+
+	return num;
+}
+
+void release_sub_devices(cl_device_id *sub_devices, int num)
+{
+	cl_int err;
+	int i;
+
+	for (i = 0; i < num; i++)
+	{
+		err = clReleaseDevice(sub_devices[i]);
+		CL_CHECK_ERR(err);
+	}
+
+	if (sub_devices != NULL)
+		free(sub_devices);
+}
+
+/* Program binary cache.
+ *
+ * Built binaries are kept on disk keyed by a hash of the program source, the
+ * build options, the device name and the driver version, so a later run on
+ * the same device can skip the compile. The directory defaults to
+ * PROGRAM_CACHE_DIR and can be overridden with the OPENCL_TEST_CACHE_DIR
+ * environment variable or set_program_cache_dir(). An empty directory name
+ * disables the cache.
+ */
+static const char *program_cache_dir = NULL;
+static int program_cache_hits = 0;
+static int program_cache_misses = 0;
+static int program_cache_rejects = 0;
+
+void set_program_cache_dir(const char *dir)
+{
+	program_cache_dir = dir;
+}
+
+void get_program_cache_stats(int *hits, int *misses, int *rejects)
+{
+	if (hits != NULL)
+		*hits = program_cache_hits;
+	if (misses != NULL)
+		*misses = program_cache_misses;
+	if (rejects != NULL)
+		*rejects = program_cache_rejects;
+}
+
+static const char *get_program_cache_dir(void)
+{
+	const char *dir;
+
+	if (program_cache_dir != NULL)
+		return program_cache_dir;
+
+	dir = getenv("OPENCL_TEST_CACHE_DIR");
+	if (dir != NULL)
+		return dir;
+
+	return PROGRAM_CACHE_DIR;
+}
+
+/* 64-bit FNV-1a, chained through h so several fields can be hashed in turn.
+ */
+static cl_ulong fnv1a_64(cl_ulong h, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	/* Separate fields so "ab"+"c" and "a"+"bc" hash differently. */
+	h ^= 0xff;
+	h *= 0x100000001b3ULL;
+
+	return h;
+}
+
+/* Returns 0 if the path does not fit; a truncated name could drop hash
+ * digits and match a binary built from other source or options.
+ */
+static int get_program_cache_path(cl_device_id device, const char *source, const char *options, char *path, size_t path_len)
+{
+	cl_ulong h = 0xcbf29ce484222325ULL;
+	char *info = NULL;
+	int len = 0;
+	int n;
+
+	h = fnv1a_64(h, source, strlen(source));
+	h = fnv1a_64(h, options, strlen(options));
+	get_device_info(device, CL_DEVICE_NAME, &info, &len);
+	h = fnv1a_64(h, info, strlen(info));
+	get_device_info(device, CL_DRIVER_VERSION, &info, &len);
+	h = fnv1a_64(h, info, strlen(info));
+	free(info);
+
+	n = snprintf(path, path_len, "%s/%016llx.bin", get_program_cache_dir(), (unsigned long long) h);
+
+	return n >= 0 && (size_t) n < path_len;
+}
+
+/* Try to create and build a program from a cached binary. Returns NULL on a
+ * miss, or when the runtime rejects the binary (e.g. after a driver update
+ * that kept the same version string).
+ */
+static cl_program load_cached_program(cl_context context, cl_device_id device, const char *path, const char *options)
+{
+	FILE *fp;
+	long size;
+	size_t binary_size;
+	unsigned char *binary;
+	cl_int err;
+	cl_int status;
+	cl_program program;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	if (size <= 0)
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	binary = (unsigned char *) malloc(size);
+	if (binary == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	if (fread(binary, 1, size, fp) != (size_t) size)
+	{
+		fclose(fp);
+		free(binary);
+		return NULL;
+	}
+	fclose(fp);
+
+	binary_size = (size_t) size;
+	program = clCreateProgramWithBinary(context, 1, &device, &binary_size, (const unsigned char **) &binary, &status, &err);
+	free(binary);
+
+	if (err != CL_SUCCESS || status != CL_SUCCESS)
+	{
+		if (program != NULL)
+			clReleaseProgram(program);
+		program_cache_rejects++;
+		return NULL;
+	}
+
+	/* Binaries still need a build call before kernels can be created. */
+	if (clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS)
+	{
+		clReleaseProgram(program);
+		program_cache_rejects++;
+		return NULL;
+	}
+
+	return program;
+}
+
+static void store_cached_program(cl_program program, const char *path)
+{
+	FILE *fp;
+	size_t size;
+	unsigned char *binary;
+	char tmp_path[1024 + sizeof(".tmp")];
+	cl_int err;
+
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+	if (err != CL_SUCCESS || size == 0)
+		return;
+
+	binary = (unsigned char *) malloc(size);
+	if (binary == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binary, NULL);
+	if (err != CL_SUCCESS)
+	{
+		free(binary);
+		return;
+	}
+
+	MKDIR(get_program_cache_dir());
+
+	/* Write to a temporary file and rename it into place so a concurrent
+	 * run never sees a partially written binary.
+	 */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL)
+	{
+		free(binary);
+		return;
+	}
+
+	if (fwrite(binary, 1, size, fp) != size)
+	{
+		fclose(fp);
+		remove(tmp_path);
+		free(binary);
+		return;
+	}
+	fclose(fp);
+	free(binary);
+
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (rename(tmp_path, path) != 0)
+		remove(tmp_path);
+}
+
 cl_program get_program_from_file(cl_context context, cl_device_id device, const char *filename)
+{
+	return get_program_from_file_with_options(context, device, filename, "");
+}
+
+cl_program get_program_from_file_with_options(cl_context context, cl_device_id device, const char *filename, const char *options)
 {
 	FILE *fp;
 	int size;
 	char *buffer;
 	cl_int err;
 	cl_program program;
-	char buf[100000];
+	char *log;
+	size_t log_size = 0;
+	char path[1024];
+	int use_cache;
 	
 	/* Read file into buffer. */
 	fp = fopen(filename, "r");
@@ -368,23 +642,56 @@ cl_program get_program_from_file(cl_context context, cl_device_id device, const
 	size = ftell(fp);
 	rewind(fp);
 	buffer = (char *) malloc((size+1) * sizeof(char));
-	buffer[size] = '\0';
-	fread(buffer, sizeof(char), size, fp);
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+	/* Text mode may read fewer bytes than ftell reported on Windows. */
+	buffer[fread(buffer, sizeof(char), size, fp)] = '\0';
 	fclose(fp);
 
+	/* Look for a previously built binary. */
+	use_cache = (get_program_cache_dir()[0] != '\0') &&
+		get_program_cache_path(device, buffer, options, path, sizeof(path));
+	if (use_cache)
+	{
+		program = load_cached_program(context, device, path, options);
+		if (program != NULL)
+		{
+			program_cache_hits++;
+			free(buffer);
+			return program;
+		}
+		program_cache_misses++;
+	}
+
 	/* Create program. */
-	program = clCreateProgramWithSource(context, 1, &buffer, NULL, &err);
+	program = clCreateProgramWithSource(context, 1, (const char **) &buffer, NULL, &err);
 	CL_CHECK_ERR(err);
 
 	/* Build program. */
-	if (clBuildProgram(program, 1, &device, "", NULL, NULL) != CL_SUCCESS)
+	if (clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS)
 	{
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 100000, buf, NULL);
-		fprintf(stderr, "CL Compilation failed:\n%s", buffer);
+		/* The log can be far longer than any fixed buffer. */
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		log = (char *) malloc(log_size + 1);
+		if (log == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+		log[0] = '\0';
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		log[log_size] = '\0';
+		fprintf(stderr, "CL Compilation failed:\n%s", log);
 		exit(1);
 	}
 	free(buffer);
 
+	if (use_cache)
+		store_cached_program(program, path);
+
 	err = clUnloadCompiler();
 	CL_CHECK_ERR(err);
 
@@ -22,6 +22,15 @@ int get_devices(cl_platform_id platform, cl_device_type device_type, cl_device_i
 
 cl_platform_id get_platform(const char *platform_string);
 cl_device_id get_device(cl_platform_id platform, cl_device_type device_type, const char *device_string);
+int get_sub_devices(cl_device_id device, cl_device_affinity_domain domain, cl_device_id **sub_devices);
+void release_sub_devices(cl_device_id *sub_devices, int num);
+
 cl_program get_program_from_file(cl_context context, cl_device_id device, const char *filename);
+cl_program get_program_from_file_with_options(cl_context context, cl_device_id device, const char *filename, const char *options);
+
+#define PROGRAM_CACHE_DIR "cl_cache"
+
+void set_program_cache_dir(const char *dir);
+void get_program_cache_stats(int *hits, int *misses, int *rejects);
 
 #endif
@@ -0,0 +1,702 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <CL/cl.h>
+
+#include "bench.h"
+#include "buffer.h"
+#include "hash.h"
+#include "threads.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CPU_TARGET(isa)
+#else
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+static int cpu_isa = -1;
+static int cpu_threads = 1;
+
+int cpu_detect(void)
+{
+#ifdef CPU_X86
+#ifdef _MSC_VER
+	int info[4];
+	int max_leaf;
+	int avx2 = 0, avx512 = 0;
+	unsigned long long xcr0 = 0;
+
+	__cpuid(info, 0);
+	max_leaf = info[0];
+
+	__cpuid(info, 1);
+	if (info[2] & (1 << 27)) // OSXSAVE
+		xcr0 = _xgetbv(0);
+
+	if (max_leaf >= 7)
+	{
+		/* AVX2 also needs FMA (leaf 1) for the GEMV kernel. */
+		avx2 = (info[2] & (1 << 12)) != 0;
+		__cpuidex(info, 7, 0);
+		avx2 = avx2 && (info[1] & (1 << 5));
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	/* The OS must save the YMM and ZMM state too. */
+	if (avx512 && (xcr0 & 0xe6) == 0xe6)
+		return CPU_AVX512;
+	if (avx2 && (xcr0 & 0x6) == 0x6)
+		return CPU_AVX2;
+
+	return CPU_SSE2;
+#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return CPU_SSE2;
+#endif
+#endif
+	return CPU_SCALAR;
+}
+
+/* Anything above what the CPU supports is clamped. */
+void cpu_set_isa(int isa)
+{
+	int best = cpu_detect();
+
+	cpu_isa = isa > best ? best : isa;
+}
+
+int cpu_get_isa(void)
+{
+	if (cpu_isa < 0)
+		cpu_isa = cpu_detect();
+
+	return cpu_isa;
+}
+
+const char *cpu_isa_name(int isa)
+{
+	switch (isa)
+	{
+		case CPU_SSE2: return "sse2";
+		case CPU_AVX2: return "avx2";
+		case CPU_AVX512: return "avx512";
+	}
+
+	return "scalar";
+}
+
+void cpu_set_threads(int num_threads)
+{
+	if (num_threads > PARALLEL_MAX_THREADS)
+		num_threads = PARALLEL_MAX_THREADS;
+	cpu_threads = num_threads < 1 ? 1 : num_threads;
+}
+
+int cpu_get_threads(void)
+{
+	return cpu_threads;
+}
+
+/* Unsigned minimum. */
+
+static cl_uint min_uint_scalar(const cl_uint *src, size_t n)
+{
+	cl_uint m = (cl_uint) -1;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		m = src[i] < m ? src[i] : m;
+
+	return m;
+}
+
+#ifdef CPU_X86
+/* SSE2 has no unsigned compare, so flip the sign bits and compare signed. */
+CPU_TARGET("sse2") static cl_uint min_uint_sse2(const cl_uint *src, size_t n)
+{
+	__m128i bias = _mm_set1_epi32((int) 0x80000000);
+	__m128i m = _mm_set1_epi32(0x7fffffff);
+	__m128i v, lt;
+	cl_uint lanes[4];
+	cl_uint r;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &src[i]), bias);
+		lt = _mm_cmplt_epi32(v, m);
+		m = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, m));
+	}
+
+	_mm_storeu_si128((__m128i *) lanes, _mm_xor_si128(m, bias));
+	r = min_uint_scalar(lanes, 4);
+
+	for (; i < n; i++)
+		r = src[i] < r ? src[i] : r;
+
+	return r;
+}
+
+CPU_TARGET("avx2") static cl_uint min_uint_avx2(const cl_uint *src, size_t n)
+{
+	__m256i m0 = _mm256_set1_epi32(-1);
+	__m256i m1 = m0;
+	cl_uint lanes[8];
+	cl_uint r;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+	{
+		m0 = _mm256_min_epu32(m0, _mm256_loadu_si256((const __m256i *) &src[i]));
+		m1 = _mm256_min_epu32(m1, _mm256_loadu_si256((const __m256i *) &src[i + 8]));
+	}
+
+	_mm256_storeu_si256((__m256i *) lanes, _mm256_min_epu32(m0, m1));
+	r = min_uint_scalar(lanes, 8);
+
+	for (; i < n; i++)
+		r = src[i] < r ? src[i] : r;
+
+	return r;
+}
+
+CPU_TARGET("avx512f") static cl_uint min_uint_avx512(const cl_uint *src, size_t n)
+{
+	__m512i m0 = _mm512_set1_epi32(-1);
+	__m512i m1 = m0;
+	cl_uint r;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32)
+	{
+		m0 = _mm512_min_epu32(m0, _mm512_loadu_si512(&src[i]));
+		m1 = _mm512_min_epu32(m1, _mm512_loadu_si512(&src[i + 16]));
+	}
+
+	r = (cl_uint) _mm512_reduce_min_epu32(_mm512_min_epu32(m0, m1));
+
+	for (; i < n; i++)
+		r = src[i] < r ? src[i] : r;
+
+	return r;
+}
+#endif
+
+static cl_uint min_uint_isa(const cl_uint *src, size_t n, int isa)
+{
+#ifdef CPU_X86
+	switch (isa)
+	{
+		case CPU_SSE2: return min_uint_sse2(src, n);
+		case CPU_AVX2: return min_uint_avx2(src, n);
+		case CPU_AVX512: return min_uint_avx512(src, n);
+	}
+#endif
+	return min_uint_scalar(src, n);
+}
+
+/* Integer sum, wrapping like the kernels do. */
+
+static int sum_int_scalar(const int *src, size_t n)
+{
+	unsigned int s = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		s += (unsigned int) src[i];
+
+	return (int) s;
+}
+
+#ifdef CPU_X86
+CPU_TARGET("sse2") static int sum_int_sse2(const int *src, size_t n)
+{
+	__m128i s0 = _mm_setzero_si128();
+	__m128i s1 = s0;
+	int lanes[4];
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		s0 = _mm_add_epi32(s0, _mm_loadu_si128((const __m128i *) &src[i]));
+		s1 = _mm_add_epi32(s1, _mm_loadu_si128((const __m128i *) &src[i + 4]));
+	}
+
+	_mm_storeu_si128((__m128i *) lanes, _mm_add_epi32(s0, s1));
+
+	return (int) ((unsigned int) sum_int_scalar(lanes, 4) + (unsigned int) sum_int_scalar(&src[i], n - i));
+}
+
+CPU_TARGET("avx2") static int sum_int_avx2(const int *src, size_t n)
+{
+	__m256i s0 = _mm256_setzero_si256();
+	__m256i s1 = s0;
+	int lanes[8];
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+	{
+		s0 = _mm256_add_epi32(s0, _mm256_loadu_si256((const __m256i *) &src[i]));
+		s1 = _mm256_add_epi32(s1, _mm256_loadu_si256((const __m256i *) &src[i + 8]));
+	}
+
+	_mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi32(s0, s1));
+
+	return (int) ((unsigned int) sum_int_scalar(lanes, 8) + (unsigned int) sum_int_scalar(&src[i], n - i));
+}
+
+CPU_TARGET("avx512f") static int sum_int_avx512(const int *src, size_t n)
+{
+	__m512i s0 = _mm512_setzero_si512();
+	__m512i s1 = s0;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32)
+	{
+		s0 = _mm512_add_epi32(s0, _mm512_loadu_si512(&src[i]));
+		s1 = _mm512_add_epi32(s1, _mm512_loadu_si512(&src[i + 16]));
+	}
+
+	return (int) ((unsigned int) _mm512_reduce_add_epi32(_mm512_add_epi32(s0, s1)) + (unsigned int) sum_int_scalar(&src[i], n - i));
+}
+#endif
+
+static int sum_int_isa(const int *src, size_t n, int isa)
+{
+#ifdef CPU_X86
+	switch (isa)
+	{
+		case CPU_SSE2: return sum_int_sse2(src, n);
+		case CPU_AVX2: return sum_int_avx2(src, n);
+		case CPU_AVX512: return sum_int_avx512(src, n);
+	}
+#endif
+	return sum_int_scalar(src, n);
+}
+
+/* Dot product of one GEMV row. */
+
+static float dot_scalar(const float *a, const float *x, size_t n)
+{
+	float s = 0.0f;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		s += a[i] * x[i];
+
+	return s;
+}
+
+#ifdef CPU_X86
+CPU_TARGET("sse2") static float dot_sse2(const float *a, const float *x, size_t n)
+{
+	__m128 s0 = _mm_setzero_ps();
+	__m128 s1 = s0;
+	float lanes[4];
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&x[i])));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(&a[i + 4]), _mm_loadu_ps(&x[i + 4])));
+	}
+
+	_mm_storeu_ps(lanes, _mm_add_ps(s0, s1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(&a[i], &x[i], n - i);
+}
+
+CPU_TARGET("avx2,fma") static float dot_avx2(const float *a, const float *x, size_t n)
+{
+	__m256 s0 = _mm256_setzero_ps();
+	__m256 s1 = s0;
+	float lanes[8];
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+	{
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&x[i]), s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i + 8]), _mm256_loadu_ps(&x[i + 8]), s1);
+	}
+
+	_mm256_storeu_ps(lanes, _mm256_add_ps(s0, s1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7] + dot_scalar(&a[i], &x[i], n - i);
+}
+
+CPU_TARGET("avx512f") static float dot_avx512(const float *a, const float *x, size_t n)
+{
+	__m512 s0 = _mm512_setzero_ps();
+	__m512 s1 = s0;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32)
+	{
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&x[i]), s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i + 16]), _mm512_loadu_ps(&x[i + 16]), s1);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1)) + dot_scalar(&a[i], &x[i], n - i);
+}
+#endif
+
+static void sgemv_isa(size_t first, size_t m, size_t n, const float *a, const float *x, float *y, int isa)
+{
+	size_t i;
+
+	for (i = first; i < first + m; i++)
+	{
+#ifdef CPU_X86
+		switch (isa)
+		{
+			case CPU_SSE2: y[i] = dot_sse2(&a[i * n], x, n); continue;
+			case CPU_AVX2: y[i] = dot_avx2(&a[i * n], x, n); continue;
+			case CPU_AVX512: y[i] = dot_avx512(&a[i * n], x, n); continue;
+		}
+#endif
+		y[i] = dot_scalar(&a[i * n], x, n);
+	}
+}
+
+/* Multi-lane lookup3. Each group of keys is seeded together and fed the
+ * 12-byte blocks every key in the group has, one key per lane, then each
+ * key is finished on its own with lookup3_continue. Fixed length keys
+ * never leave the vector loop until their last block.
+ */
+
+#define l3_blocks(len) ((len) > 12 ? ((len) - 1) / 12 : 0)
+
+static void hash_csr_scalar(const char *keys, const cl_uint *offsets, size_t first, size_t count, unsigned int seed, unsigned int *hashes)
+{
+	size_t i;
+
+	for (i = first; i < first + count; i++)
+		hashes[i] = lookup3(&keys[offsets[i]], offsets[i + 1] - offsets[i], seed);
+}
+
+/* Seed a group of lanes and work out how many blocks they share. */
+static size_t hash_csr_seed(const cl_uint *offsets, size_t first, int lanes, unsigned int seed, unsigned int *init)
+{
+	size_t blocks = (size_t) -1;
+	size_t len, b;
+	int l;
+
+	for (l = 0; l < lanes; l++)
+	{
+		len = offsets[first + l + 1] - offsets[first + l];
+		init[l] = 0xdeadbeef + (unsigned int) len + seed;
+		b = l3_blocks(len);
+		blocks = b < blocks ? b : blocks;
+	}
+
+	return blocks;
+}
+
+/* Finish each lane from the vector state. */
+static void hash_csr_finish(const char *keys, const cl_uint *offsets, size_t first, int lanes, size_t blocks, const unsigned int *a, const unsigned int *b, const unsigned int *c, unsigned int *hashes)
+{
+	unsigned int state[3];
+	size_t start, len;
+	int l;
+
+	for (l = 0; l < lanes; l++)
+	{
+		start = offsets[first + l] + blocks * 12;
+		len = offsets[first + l + 1] - start;
+		state[0] = a[l];
+		state[1] = b[l];
+		state[2] = c[l];
+		lookup3_continue(state, &keys[start], len);
+		hashes[first + l] = state[2];
+	}
+}
+
+#define l3v_mix(a, b, c, ADD, SUB, XOR, ROT) \
+{ \
+	a = SUB(a, c); a = XOR(a, ROT(c, 4)); c = ADD(c, b); \
+	b = SUB(b, a); b = XOR(b, ROT(a, 6)); a = ADD(a, c); \
+	c = SUB(c, b); c = XOR(c, ROT(b, 8)); b = ADD(b, a); \
+	a = SUB(a, c); a = XOR(a, ROT(c,16)); c = ADD(c, b); \
+	b = SUB(b, a); b = XOR(b, ROT(a,19)); a = ADD(a, c); \
+	c = SUB(c, b); c = XOR(c, ROT(b, 4)); b = ADD(b, a); \
+}
+
+#ifdef CPU_X86
+static unsigned int load_word(const char *p)
+{
+	unsigned int w;
+
+	memcpy(&w, p, sizeof(w)); // x86 is little endian, as lookup3 reads
+	return w;
+}
+
+#define sse2_rot(x, k) _mm_or_si128(_mm_slli_epi32(x, k), _mm_srli_epi32(x, 32 - (k)))
+
+CPU_TARGET("sse2") static __m128i sse2_gather(const char *keys, const cl_uint *offsets, size_t first, size_t at)
+{
+	return _mm_set_epi32(
+		(int) load_word(&keys[offsets[first + 3] + at]),
+		(int) load_word(&keys[offsets[first + 2] + at]),
+		(int) load_word(&keys[offsets[first + 1] + at]),
+		(int) load_word(&keys[offsets[first] + at]));
+}
+
+CPU_TARGET("sse2") static void hash_csr_sse2(const char *keys, const cl_uint *offsets, size_t first, size_t count, unsigned int seed, unsigned int *hashes)
+{
+	unsigned int init[4], ra[4], rb[4], rc[4];
+	__m128i a, b, c;
+	size_t g, blk, blocks;
+
+	for (g = first; g + 4 <= first + count; g += 4)
+	{
+		blocks = hash_csr_seed(offsets, g, 4, seed, init);
+		a = b = c = _mm_loadu_si128((const __m128i *) init);
+
+		for (blk = 0; blk < blocks; blk++)
+		{
+			a = _mm_add_epi32(a, sse2_gather(keys, offsets, g, blk * 12));
+			b = _mm_add_epi32(b, sse2_gather(keys, offsets, g, blk * 12 + 4));
+			c = _mm_add_epi32(c, sse2_gather(keys, offsets, g, blk * 12 + 8));
+			l3v_mix(a, b, c, _mm_add_epi32, _mm_sub_epi32, _mm_xor_si128, sse2_rot);
+		}
+
+		_mm_storeu_si128((__m128i *) ra, a);
+		_mm_storeu_si128((__m128i *) rb, b);
+		_mm_storeu_si128((__m128i *) rc, c);
+		hash_csr_finish(keys, offsets, g, 4, blocks, ra, rb, rc, hashes);
+	}
+
+	hash_csr_scalar(keys, offsets, g, first + count - g, seed, hashes);
+}
+
+#define avx2_rot(x, k) _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32 - (k)))
+
+/* Gathers take signed 32-bit byte offsets, hence the 2GB limit on the blob
+ * in cpu_hash_keys_csr.
+ */
+CPU_TARGET("avx2") static void hash_csr_avx2(const char *keys, const cl_uint *offsets, size_t first, size_t count, unsigned int seed, unsigned int *hashes)
+{
+	unsigned int init[8], ra[8], rb[8], rc[8];
+	__m256i a, b, c, idx;
+	size_t g, blk, blocks;
+
+	for (g = first; g + 8 <= first + count; g += 8)
+	{
+		blocks = hash_csr_seed(offsets, g, 8, seed, init);
+		a = b = c = _mm256_loadu_si256((const __m256i *) init);
+		idx = _mm256_loadu_si256((const __m256i *) &offsets[g]);
+
+		for (blk = 0; blk < blocks; blk++)
+		{
+			a = _mm256_add_epi32(a, _mm256_i32gather_epi32((const int *) keys, idx, 1));
+			b = _mm256_add_epi32(b, _mm256_i32gather_epi32((const int *) (keys + 4), idx, 1));
+			c = _mm256_add_epi32(c, _mm256_i32gather_epi32((const int *) (keys + 8), idx, 1));
+			l3v_mix(a, b, c, _mm256_add_epi32, _mm256_sub_epi32, _mm256_xor_si256, avx2_rot);
+			idx = _mm256_add_epi32(idx, _mm256_set1_epi32(12));
+		}
+
+		_mm256_storeu_si256((__m256i *) ra, a);
+		_mm256_storeu_si256((__m256i *) rb, b);
+		_mm256_storeu_si256((__m256i *) rc, c);
+		hash_csr_finish(keys, offsets, g, 8, blocks, ra, rb, rc, hashes);
+	}
+
+	hash_csr_scalar(keys, offsets, g, first + count - g, seed, hashes);
+}
+
+CPU_TARGET("avx512f") static void hash_csr_avx512(const char *keys, const cl_uint *offsets, size_t first, size_t count, unsigned int seed, unsigned int *hashes)
+{
+	unsigned int init[16], ra[16], rb[16], rc[16];
+	__m512i a, b, c, idx;
+	size_t g, blk, blocks;
+
+	for (g = first; g + 16 <= first + count; g += 16)
+	{
+		blocks = hash_csr_seed(offsets, g, 16, seed, init);
+		a = b = c = _mm512_loadu_si512(init);
+		idx = _mm512_loadu_si512(&offsets[g]);
+
+		for (blk = 0; blk < blocks; blk++)
+		{
+			a = _mm512_add_epi32(a, _mm512_i32gather_epi32(idx, keys, 1));
+			b = _mm512_add_epi32(b, _mm512_i32gather_epi32(idx, keys + 4, 1));
+			c = _mm512_add_epi32(c, _mm512_i32gather_epi32(idx, keys + 8, 1));
+			l3v_mix(a, b, c, _mm512_add_epi32, _mm512_sub_epi32, _mm512_xor_si512, _mm512_rol_epi32);
+			idx = _mm512_add_epi32(idx, _mm512_set1_epi32(12));
+		}
+
+		_mm512_storeu_si512(ra, a);
+		_mm512_storeu_si512(rb, b);
+		_mm512_storeu_si512(rc, c);
+		hash_csr_finish(keys, offsets, g, 16, blocks, ra, rb, rc, hashes);
+	}
+
+	hash_csr_scalar(keys, offsets, g, first + count - g, seed, hashes);
+}
+#endif
+
+static void hash_csr_isa(const char *keys, const cl_uint *offsets, size_t first, size_t count, unsigned int seed, unsigned int *hashes, int isa)
+{
+#ifdef CPU_X86
+	/* The gathers index with signed 32-bit offsets. */
+	if (isa >= CPU_AVX2 && offsets[first + count] > INT_MAX)
+		isa = CPU_SSE2;
+
+	switch (isa)
+	{
+		case CPU_SSE2: hash_csr_sse2(keys, offsets, first, count, seed, hashes); return;
+		case CPU_AVX2: hash_csr_avx2(keys, offsets, first, count, seed, hashes); return;
+		case CPU_AVX512: hash_csr_avx512(keys, offsets, first, count, seed, hashes); return;
+	}
+#endif
+	hash_csr_scalar(keys, offsets, first, count, seed, hashes);
+}
+
+/* Threaded entry points. Each thread runs the current instruction set over
+ * a contiguous range and reductions combine one partial per thread.
+ */
+struct cpu_job
+{
+	int isa;
+	const void *src;
+	const float *x;
+	size_t n;
+	const char *keys;
+	const cl_uint *offsets;
+	unsigned int seed;
+	void *dst;
+	cl_uint mins[PARALLEL_MAX_THREADS];
+	int sums[PARALLEL_MAX_THREADS];
+};
+
+static void min_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct cpu_job *job = (struct cpu_job *) arg;
+	job->mins[thread] = min_uint_isa((const cl_uint *) job->src + first, count, job->isa);
+}
+
+static void sum_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct cpu_job *job = (struct cpu_job *) arg;
+	job->sums[thread] = sum_int_isa((const int *) job->src + first, count, job->isa);
+}
+
+static void sgemv_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct cpu_job *job = (struct cpu_job *) arg;
+	sgemv_isa(first, count, job->n, (const float *) job->src, job->x, (float *) job->dst, job->isa);
+}
+
+static void hash_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct cpu_job *job = (struct cpu_job *) arg;
+	hash_csr_isa(job->keys, job->offsets, first, count, job->seed, (unsigned int *) job->dst, job->isa);
+}
+
+/* Enough work per thread to be worth starting it. */
+#define CPU_MIN_PER_THREAD 4096
+
+static int job_threads(size_t count)
+{
+	size_t max = count / CPU_MIN_PER_THREAD;
+
+	if (max < 1)
+		max = 1;
+	if (max > PARALLEL_MAX_THREADS)
+		max = PARALLEL_MAX_THREADS;
+
+	return (size_t) cpu_threads < max ? cpu_threads : (int) max;
+}
+
+cl_uint cpu_min_uint(const cl_uint *src, size_t n)
+{
+	struct cpu_job job;
+	int threads = job_threads(n);
+
+	job.isa = cpu_get_isa();
+	job.src = src;
+	parallel_for(n, threads, min_job, &job);
+
+	return min_uint_scalar(job.mins, threads);
+}
+
+int cpu_sum_int(const int *src, size_t n)
+{
+	struct cpu_job job;
+	int threads = job_threads(n);
+
+	job.isa = cpu_get_isa();
+	job.src = src;
+	parallel_for(n, threads, sum_job, &job);
+
+	return sum_int_scalar(job.sums, threads);
+}
+
+void cpu_sgemv(size_t m, size_t n, const float *a, const float *x, float *y)
+{
+	struct cpu_job job;
+
+	job.isa = cpu_get_isa();
+	job.src = a;
+	job.x = x;
+	job.n = n;
+	job.dst = y;
+	parallel_for(m, job_threads(m * n) , sgemv_job, &job);
+}
+
+void cpu_hash_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes)
+{
+	struct cpu_job job;
+
+	job.isa = cpu_get_isa();
+	job.keys = keys;
+	job.offsets = offsets;
+	job.seed = seed;
+	job.dst = hashes;
+	parallel_for(num_keys, job_threads(offsets[num_keys]), hash_job, &job);
+}
+
+struct bench_result *cpu_bench(const char *name, bench_fn fn, void *arg, double bytes, double items)
+{
+	struct bench_result *r, *best = NULL;
+	char full_name[64];
+	int saved_isa = cpu_get_isa();
+	int saved_threads = cpu_threads;
+	int best_isa = cpu_detect();
+	int num_cpus = get_num_cpus();
+	int isa;
+
+	if (num_cpus > PARALLEL_MAX_THREADS)
+		num_cpus = PARALLEL_MAX_THREADS;
+
+	for (isa = CPU_SCALAR; isa <= best_isa + (num_cpus > 1); isa++)
+	{
+		/* One pass past the last instruction set runs it threaded. */
+		cpu_isa = isa > best_isa ? best_isa : isa;
+		cpu_threads = isa > best_isa ? num_cpus : 1;
+
+		snprintf(full_name, sizeof(full_name), "%s native %s x%d", name, cpu_isa_name(cpu_isa), cpu_threads);
+		r = bench_run(full_name, fn, arg, bytes, items);
+
+		if (best == NULL || r->median < best->median)
+			best = r;
+	}
+
+	cpu_isa = saved_isa;
+	cpu_threads = saved_threads;
+
+	return best;
+}
@@ -0,0 +1,31 @@
+#ifndef TEST_CPU_H
+#define TEST_CPU_H
+
+/* Native CPU baselines for the kernels in test.cl, so OpenCL results can
+ * be compared with well written host code rather than a scalar loop.
+ * Each operation has scalar, SSE2, AVX2 (with FMA) and AVX-512 versions
+ * picked at run time from CPUID, and can be split across threads.
+ */
+#define CPU_SCALAR 0
+#define CPU_SSE2 1
+#define CPU_AVX2 2
+#define CPU_AVX512 3
+
+int cpu_detect(void);
+void cpu_set_isa(int isa);
+int cpu_get_isa(void);
+const char *cpu_isa_name(int isa);
+void cpu_set_threads(int num_threads);
+int cpu_get_threads(void);
+
+cl_uint cpu_min_uint(const cl_uint *src, size_t n);
+int cpu_sum_int(const int *src, size_t n);
+void cpu_sgemv(size_t m, size_t n, const float *a, const float *x, float *y);
+void cpu_hash_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes);
+
+/* Benchmark fn once per instruction set on one thread, then the best
+ * instruction set on every CPU, and return the fastest result.
+ */
+struct bench_result *cpu_bench(const char *name, bench_fn fn, void *arg, double bytes, double items);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "threads.h"
+#include "graph.h"
+
+/* Use one out-of-order queue when the device supports it, otherwise
+ * num_queues in-order queues (at least one).
+ */
+void graph_init(struct graph *g, cl_context context, cl_device_id device, int num_queues)
+{
+	cl_command_queue_properties props;
+	cl_int err;
+	int i;
+
+	memset(g, 0, sizeof(*g));
+	latch_init(&g->pending, 0);
+
+	err = clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, NULL);
+	CL_CHECK_ERR(err);
+
+	g->out_of_order = (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+	if (g->out_of_order)
+		num_queues = 1;
+	else if (num_queues < 1)
+		num_queues = 1;
+	else if (num_queues > GRAPH_MAX_QUEUES)
+		num_queues = GRAPH_MAX_QUEUES;
+
+	for (i = 0; i < num_queues; i++)
+	{
+		g->queues[i] = clCreateCommandQueue(context, device, prof_queue_properties() | (g->out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0), &err);
+		CL_CHECK_ERR(err);
+	}
+	g->num_queues = num_queues;
+}
+
+static void CL_CALLBACK graph_event_callback(cl_event ev, cl_int status, void *user_data)
+{
+	struct graph_node *node = (struct graph_node *) user_data;
+
+	if (status < 0)
+	{
+		fprintf(stderr, "Graph node %s failed with code %d (%s)\n", node->name, status, get_error_string(status));
+		exit(1);
+	}
+
+	if (node->done != NULL)
+		node->done((int) (node - node->graph->nodes), node->done_arg);
+
+	latch_count_down(&node->graph->pending);
+}
+
+/* Reserve a node and build the wait list from its dependencies. */
+static struct graph_node *graph_add(struct graph *g, const char *name, int type, const int *deps, int num_deps, cl_event *wait, cl_command_queue *queue)
+{
+	struct graph_node *node;
+	int i;
+
+	if (g->num_nodes == GRAPH_MAX_NODES || num_deps > GRAPH_MAX_DEPS)
+	{
+		fprintf(stderr, "Too many graph nodes or dependencies adding %s\n", name);
+		exit(1);
+	}
+
+	for (i = 0; i < num_deps; i++)
+	{
+		if (deps[i] < 0 || deps[i] >= g->num_nodes)
+		{
+			fprintf(stderr, "Graph node %s depends on unknown node %d\n", name, deps[i]);
+			exit(1);
+		}
+		wait[i] = g->nodes[deps[i]].event;
+	}
+
+	node = &g->nodes[g->num_nodes];
+	memset(node, 0, sizeof(*node));
+	node->graph = g;
+	node->name = name;
+	node->type = type;
+
+	*queue = g->queues[g->next_queue];
+	g->next_queue = (g->next_queue + 1) % g->num_queues;
+
+	return node;
+}
+
+/* Kernel arguments are captured when the node is added, so the same
+ * kernel object can be reused with different arguments for later nodes.
+ */
+int graph_kernel(struct graph *g, const char *name, cl_kernel kernel, cl_uint work_dim, const size_t *global_size, const size_t *local_size, const int *deps, int num_deps)
+{
+	cl_event wait[GRAPH_MAX_DEPS];
+	cl_command_queue queue;
+	struct graph_node *node;
+	cl_int err;
+
+	node = graph_add(g, name, GRAPH_KERNEL, deps, num_deps, wait, &queue);
+
+	err = clEnqueueNDRangeKernel(queue, kernel, work_dim, NULL, global_size, local_size, num_deps, num_deps ? wait : NULL, &node->event);
+	CL_CHECK_ERR(err);
+
+	return g->num_nodes++;
+}
+
+/* ptr must stay valid until the node completes. */
+int graph_write(struct graph *g, const char *name, cl_mem mem, size_t offset, size_t size, const void *ptr, const int *deps, int num_deps)
+{
+	cl_event wait[GRAPH_MAX_DEPS];
+	cl_command_queue queue;
+	struct graph_node *node;
+	cl_int err;
+
+	node = graph_add(g, name, GRAPH_WRITE, deps, num_deps, wait, &queue);
+
+	err = clEnqueueWriteBuffer(queue, mem, CL_FALSE, offset, size, ptr, num_deps, num_deps ? wait : NULL, &node->event);
+	CL_CHECK_ERR(err);
+
+	return g->num_nodes++;
+}
+
+int graph_read(struct graph *g, const char *name, cl_mem mem, size_t offset, size_t size, void *ptr, const int *deps, int num_deps)
+{
+	cl_event wait[GRAPH_MAX_DEPS];
+	cl_command_queue queue;
+	struct graph_node *node;
+	cl_int err;
+
+	node = graph_add(g, name, GRAPH_READ, deps, num_deps, wait, &queue);
+
+	err = clEnqueueReadBuffer(queue, mem, CL_FALSE, offset, size, ptr, num_deps, num_deps ? wait : NULL, &node->event);
+	CL_CHECK_ERR(err);
+
+	return g->num_nodes++;
+}
+
+/* Any time before graph_wait(). */
+void graph_on_complete(struct graph *g, int node, graph_done_fn done, void *arg)
+{
+	g->nodes[node].done_arg = arg;
+	g->nodes[node].done = done;
+}
+
+/* Hook up every node's callback and flush every queue so cross-queue
+ * dependencies can make progress, then sleep until all callbacks have
+ * run. Callbacks are only registered here, once graph_on_complete() has
+ * had its chance, so a fast node cannot complete before its done function
+ * is set. Profiles and releases the nodes so the graph can be reused.
+ */
+void graph_wait(struct graph *g)
+{
+	static const int kinds[] = { PROF_KERNEL, PROF_WRITE, PROF_READ };
+	cl_int err;
+	int i;
+
+	latch_add(&g->pending, g->num_nodes);
+	for (i = 0; i < g->num_nodes; i++)
+	{
+		err = clSetEventCallback(g->nodes[i].event, CL_COMPLETE, graph_event_callback, &g->nodes[i]);
+		CL_CHECK_ERR(err);
+	}
+
+	for (i = 0; i < g->num_queues; i++)
+	{
+		err = clFlush(g->queues[i]);
+		CL_CHECK_ERR(err);
+	}
+
+	latch_wait(&g->pending);
+
+	for (i = 0; i < g->num_nodes; i++)
+	{
+		prof_event(g->nodes[i].event, g->nodes[i].name, kinds[g->nodes[i].type]);
+		err = clReleaseEvent(g->nodes[i].event);
+		CL_CHECK_ERR(err);
+	}
+
+	g->num_nodes = 0;
+	g->next_queue = 0;
+}
+
+void graph_release(struct graph *g)
+{
+	cl_int err;
+	int i;
+
+	if (g->num_nodes > 0)
+		graph_wait(g);
+
+	for (i = 0; i < g->num_queues; i++)
+	{
+		err = clReleaseCommandQueue(g->queues[i]);
+		CL_CHECK_ERR(err);
+	}
+
+	latch_destroy(&g->pending);
+}
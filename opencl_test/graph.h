@@ -0,0 +1,54 @@
+#ifndef TEST_GRAPH_H
+#define TEST_GRAPH_H
+
+/* A small task graph over OpenCL events. Nodes are kernels and transfers
+ * that name the earlier nodes they depend on; each is enqueued as soon as
+ * it is added, with its dependencies' events as the wait list, on an
+ * out-of-order queue if the device has one and otherwise round robin
+ * over several in-order queues. Completion is reported through
+ * clSetEventCallback rather than blocking waits; graph_wait() registers
+ * the callbacks and returns once every one has run.
+ */
+#define GRAPH_MAX_NODES 64
+#define GRAPH_MAX_DEPS 8
+#define GRAPH_MAX_QUEUES 4
+
+#define GRAPH_KERNEL 0
+#define GRAPH_WRITE 1
+#define GRAPH_READ 2
+
+/* Called from an OpenCL runtime thread when a node completes, so it must
+ * not call back into the graph.
+ */
+typedef void (*graph_done_fn)(int node, void *arg);
+
+struct graph_node
+{
+	struct graph *graph;
+	const char *name;
+	int type;
+	cl_event event;
+	graph_done_fn done;
+	void *done_arg;
+};
+
+struct graph
+{
+	cl_command_queue queues[GRAPH_MAX_QUEUES];
+	int num_queues;
+	int next_queue;
+	int out_of_order;
+	struct graph_node nodes[GRAPH_MAX_NODES];
+	int num_nodes;
+	struct latch pending;
+};
+
+void graph_init(struct graph *g, cl_context context, cl_device_id device, int num_queues);
+int graph_kernel(struct graph *g, const char *name, cl_kernel kernel, cl_uint work_dim, const size_t *global_size, const size_t *local_size, const int *deps, int num_deps);
+int graph_write(struct graph *g, const char *name, cl_mem mem, size_t offset, size_t size, const void *ptr, const int *deps, int num_deps);
+int graph_read(struct graph *g, const char *name, cl_mem mem, size_t offset, size_t size, void *ptr, const int *deps, int num_deps);
+void graph_on_complete(struct graph *g, int node, graph_done_fn done, void *arg);
+void graph_wait(struct graph *g);
+void graph_release(struct graph *g);
+
+#endif
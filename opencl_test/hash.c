@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "buffer.h"
+#include "hash.h"
+
+#define l3_rotate(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+
+#define l3_mix(a, b, c) \
+{ \
+	a -= c; a ^= l3_rotate(c, 4); c += b; \
+	b -= a; b ^= l3_rotate(a, 6); a += c; \
+	c -= b; c ^= l3_rotate(b, 8); b += a; \
+	a -= c; a ^= l3_rotate(c,16); c += b; \
+	b -= a; b ^= l3_rotate(a,19); a += c; \
+	c -= b; c ^= l3_rotate(b, 4); b += a; \
+}
+
+#define l3_final(a,b,c) \
+{ \
+  c ^= b; c -= l3_rotate(b,14); \
+  a ^= c; a -= l3_rotate(c,11); \
+  b ^= a; b -= l3_rotate(a,25); \
+  c ^= b; c -= l3_rotate(b,16); \
+  a ^= c; a -= l3_rotate(c,4);  \
+  b ^= a; b -= l3_rotate(a,14); \
+  c ^= b; c -= l3_rotate(b,24); \
+}
+
+#define l3_word(k) \
+	((unsigned int) (k)[0] | ((unsigned int) (k)[1] << 8) | \
+	((unsigned int) (k)[2] << 16) | ((unsigned int) (k)[3] << 24))
+
+/* Hash the rest of a key into a state that has already been seeded and
+ * fed any whole blocks, then finalise. state is a, b, c. Lets the
+ * multi-lane CPU code run the common blocks side by side and finish each
+ * key here.
+ */
+void lookup3_continue(unsigned int *state, const void *key, size_t len)
+{
+	unsigned int a = state[0], b = state[1], c = state[2];
+	const unsigned char *k = (const unsigned char *) key;
+
+	while (len > 12)
+	{
+		a += l3_word(k);
+		b += l3_word(k + 4);
+		c += l3_word(k + 8);
+		l3_mix(a,b,c);
+		len -= 12;
+		k += 12;
+	}
+
+	switch(len)
+	{
+		case 12: c+=((unsigned int)k[11])<<24; // fall through
+		case 11: c+=((unsigned int)k[10])<<16; // fall through
+		case 10: c+=((unsigned int)k[9])<<8;   // fall through
+		case 9:  c+=k[8];                      // fall through
+		case 8:  b+=((unsigned int)k[7])<<24;  // fall through
+		case 7:  b+=((unsigned int)k[6])<<16;  // fall through
+		case 6:  b+=((unsigned int)k[5])<<8;   // fall through
+		case 5:  b+=k[4];                      // fall through
+		case 4:  a+=((unsigned int)k[3])<<24;  // fall through
+		case 3:  a+=((unsigned int)k[2])<<16;  // fall through
+		case 2:  a+=((unsigned int)k[1])<<8;   // fall through
+		case 1:  a+=k[0];
+		break;
+		case 0:
+			state[1] = b; // zero length requires no mixing
+			state[2] = c;
+			return;
+	}
+
+	l3_final(a, b, c);
+	state[0] = a;
+	state[1] = b;
+	state[2] = c;
+}
+
+/* hashlittle2. *pc and *pb are the two seeds on the way in and the two
+ * 32-bit hashes on the way out; *pc alone is hashlittle.
+ */
+void lookup3_2(const void *key, size_t len, unsigned int *pc, unsigned int *pb)
+{
+	unsigned int state[3];
+
+	state[0] = state[1] = state[2] = 0xdeadbeef + (unsigned int) len + *pc;
+	state[2] += *pb;
+
+	lookup3_continue(state, key, len);
+
+	*pc = state[2];
+	*pb = state[1];
+}
+
+unsigned int lookup3(const void *key, size_t len, unsigned int seed)
+{
+	unsigned int c = seed;
+	unsigned int b = 0;
+
+	lookup3_2(key, len, &c, &b);
+	return c;
+}
+
+/* Both halves of hashlittle2 as one 64-bit hash. */
+cl_ulong lookup3_64(const void *key, size_t len, unsigned int seed)
+{
+	unsigned int c = seed;
+	unsigned int b = 0;
+
+	lookup3_2(key, len, &c, &b);
+	return (cl_ulong) c | ((cl_ulong) b << 32);
+}
+
+#define rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static cl_ulong read64(const unsigned char *p)
+{
+	cl_ulong v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static cl_ulong read32(const unsigned char *p)
+{
+	return (cl_ulong) p[0] | ((cl_ulong) p[1] << 8) | ((cl_ulong) p[2] << 16) | ((cl_ulong) p[3] << 24);
+}
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static cl_ulong xxh_round(cl_ulong acc, cl_ulong input)
+{
+	acc += input * XXH_P2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_P1;
+}
+
+static cl_ulong xxh_merge(cl_ulong h, cl_ulong v)
+{
+	h ^= xxh_round(0, v);
+	return h * XXH_P1 + XXH_P4;
+}
+
+cl_ulong xxhash64(const void *key, size_t len, unsigned int seed)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	const unsigned char *end = p + len;
+	cl_ulong v1, v2, v3, v4, h;
+
+	if (len >= 32)
+	{
+		v1 = seed + XXH_P1 + XXH_P2;
+		v2 = seed + XXH_P2;
+		v3 = seed;
+		v4 = seed - XXH_P1;
+
+		do
+		{
+			v1 = xxh_round(v1, read64(p));
+			v2 = xxh_round(v2, read64(p + 8));
+			v3 = xxh_round(v3, read64(p + 16));
+			v4 = xxh_round(v4, read64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxh_merge(h, v1);
+		h = xxh_merge(h, v2);
+		h = xxh_merge(h, v3);
+		h = xxh_merge(h, v4);
+	}
+	else
+		h = seed + XXH_P5;
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= xxh_round(0, read64(p));
+		h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+	}
+
+	if (p + 4 <= end)
+	{
+		h ^= read32(p) * XXH_P1;
+		h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+
+	for (; p < end; p++)
+	{
+		h ^= *p * XXH_P5;
+		h = rotl64(h, 11) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+#define MM3_C1 0x87c37b91114253d5ULL
+#define MM3_C2 0x4cf5ad432745937fULL
+
+static cl_ulong mm3_fmix(cl_ulong k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+cl_ulong murmur3_64(const void *key, size_t len, unsigned int seed)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	cl_ulong h1 = seed, h2 = seed;
+	cl_ulong k1, k2;
+	size_t i, nblocks = len / 16;
+
+	for (i = 0; i < nblocks; i++, p += 16)
+	{
+		k1 = read64(p);
+		k2 = read64(p + 8);
+
+		k1 *= MM3_C1; k1 = rotl64(k1, 31); k1 *= MM3_C2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= MM3_C2; k2 = rotl64(k2, 33); k2 *= MM3_C1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	/* The tail, zero padded to two words. */
+	k1 = k2 = 0;
+	for (i = 0; i < (len & 15); i++)
+	{
+		if (i < 8)
+			k1 |= (cl_ulong) p[i] << (8 * i);
+		else
+			k2 |= (cl_ulong) p[i] << (8 * (i - 8));
+	}
+
+	if ((len & 15) > 8)
+	{
+		k2 *= MM3_C2; k2 = rotl64(k2, 33); k2 *= MM3_C1; h2 ^= k2;
+	}
+	if ((len & 15) > 0)
+	{
+		k1 *= MM3_C1; k1 = rotl64(k1, 31); k1 *= MM3_C2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = mm3_fmix(h1);
+	h2 = mm3_fmix(h2);
+	h1 += h2;
+	return h1;
+}
+
+void hash_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes)
+{
+	size_t i;
+
+	for (i = 0; i < num_keys; i++)
+		hashes[i] = lookup3(&keys[offsets[i]], offsets[i + 1] - offsets[i], seed);
+}
+
+void hash_keys_to_soa(const char *keys, size_t num_keys, unsigned int len, cl_uint *words)
+{
+	const unsigned char *p;
+	size_t k;
+	unsigned int w, i;
+	cl_uint word;
+
+	for (k = 0; k < num_keys; k++)
+	{
+		p = (const unsigned char *) &keys[k * len];
+		for (w = 0; w < HASH_SOA_WORDS(len); w++)
+		{
+			word = 0;
+			for (i = 0; i < 4 && w * 4 + i < len; i++)
+				word |= (cl_uint) p[w * 4 + i] << (8 * i);
+			words[w * num_keys + k] = word;
+		}
+	}
+}
+
+void hash64_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, cl_ulong *hashes)
+{
+	size_t i;
+
+	for (i = 0; i < num_keys; i++)
+		hashes[i] = lookup3_64(&keys[offsets[i]], offsets[i + 1] - offsets[i], seed);
+}
+
+void hash_batch_init(struct hash_batch *hb, cl_context context, cl_command_queue queue, cl_program program)
+{
+	cl_int err;
+
+	memset(hb, 0, sizeof(*hb));
+	hb->context = context;
+	hb->queue = queue;
+	hb->local_size = HASH_BATCH_LOCAL_SIZE;
+
+	hb->hash32 = clCreateKernel(program, "lookup3_hash_keys_csr", &err);
+	CL_CHECK_ERR(err);
+	hb->hash64 = clCreateKernel(program, "lookup3_hash64_keys_csr", &err);
+	CL_CHECK_ERR(err);
+}
+
+/* Grow the buffers if this batch does not fit and copy it in. */
+void hash_batch_upload(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys)
+{
+	size_t key_bytes = offsets[num_keys];
+	void *p;
+
+	if (key_bytes > hb->key_capacity || hb->keys.mem == NULL)
+	{
+		if (hb->keys.mem != NULL)
+			buffer_release(&hb->keys);
+		/* Never zero sized, a batch of empty keys is valid. */
+		hb->key_capacity = key_bytes > 0 ? key_bytes : 1;
+		buffer_create(&hb->keys, hb->context, CL_MEM_READ_ONLY, hb->key_capacity, "hash_batch keys");
+	}
+
+	if (num_keys > hb->num_capacity || hb->offsets.mem == NULL)
+	{
+		if (hb->offsets.mem != NULL)
+		{
+			buffer_release(&hb->offsets);
+			buffer_release(&hb->hashes);
+		}
+		/* At least one key, so an empty first batch still has buffers. */
+		hb->num_capacity = num_keys > 0 ? num_keys : 1;
+		buffer_create(&hb->offsets, hb->context, CL_MEM_READ_ONLY, (hb->num_capacity + 1) * sizeof(cl_uint), "hash_batch offsets");
+		buffer_create(&hb->hashes, hb->context, CL_MEM_READ_WRITE, hb->num_capacity * sizeof(cl_ulong), "hash_batch hashes");
+	}
+
+	p = buffer_map(&hb->keys, hb->queue, CL_MAP_WRITE);
+	memcpy(p, keys, key_bytes);
+	buffer_unmap(&hb->keys, hb->queue);
+
+	p = buffer_map(&hb->offsets, hb->queue, CL_MAP_WRITE);
+	memcpy(p, offsets, (num_keys + 1) * sizeof(cl_uint));
+	buffer_unmap(&hb->offsets, hb->queue);
+}
+
+/* Hash the keys already on the device and wait for the result. */
+void hash_batch_enqueue(struct hash_batch *hb, size_t num_keys, unsigned int seed, int wide)
+{
+	cl_kernel kernel = wide ? hb->hash64 : hb->hash32;
+	cl_uint n = (cl_uint) num_keys;
+	size_t global_size;
+	cl_event ev;
+	cl_int err;
+
+	/* The kernels ignore the work-items past num_keys. */
+	global_size = (num_keys + hb->local_size - 1) / hb->local_size * hb->local_size;
+	if (global_size == 0)
+		return;
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &hb->keys.mem);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &hb->offsets.mem);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &hb->hashes.mem);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueNDRangeKernel(hb->queue, kernel, 1, NULL, &global_size, &hb->local_size, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev, wide ? "lookup3_hash64_keys_csr" : "lookup3_hash_keys_csr", PROF_KERNEL);
+
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+}
+
+void hash_batch_run(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes)
+{
+	void *p;
+
+	hash_batch_upload(hb, keys, offsets, num_keys);
+	hash_batch_enqueue(hb, num_keys, seed, 0);
+
+	p = buffer_map(&hb->hashes, hb->queue, CL_MAP_READ);
+	memcpy(hashes, p, num_keys * sizeof(unsigned int));
+	buffer_unmap(&hb->hashes, hb->queue);
+}
+
+void hash_batch_run64(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, cl_ulong *hashes)
+{
+	void *p;
+
+	hash_batch_upload(hb, keys, offsets, num_keys);
+	hash_batch_enqueue(hb, num_keys, seed, 1);
+
+	p = buffer_map(&hb->hashes, hb->queue, CL_MAP_READ);
+	memcpy(hashes, p, num_keys * sizeof(cl_ulong));
+	buffer_unmap(&hb->hashes, hb->queue);
+}
+
+void hash_batch_release(struct hash_batch *hb)
+{
+	cl_int err;
+
+	if (hb->keys.mem != NULL)
+		buffer_release(&hb->keys);
+	if (hb->offsets.mem != NULL)
+	{
+		buffer_release(&hb->offsets);
+		buffer_release(&hb->hashes);
+	}
+
+	err = clReleaseKernel(hb->hash32); CL_CHECK_ERR(err);
+	err = clReleaseKernel(hb->hash64); CL_CHECK_ERR(err);
+}
@@ -0,0 +1,61 @@
+#ifndef TEST_HASH_H
+#define TEST_HASH_H
+
+/* Bob Jenkins' lookup3 (hashlittle and hashlittle2), reading keys a byte
+ * at a time so it gives the same answer on any alignment and matches the
+ * kernels in test.cl.
+ */
+unsigned int lookup3(const void *key, size_t len, unsigned int seed);
+void lookup3_2(const void *key, size_t len, unsigned int *pc, unsigned int *pb);
+cl_ulong lookup3_64(const void *key, size_t len, unsigned int seed);
+void lookup3_continue(unsigned int *state, const void *key, size_t len);
+
+/* 64-bit hashes, reading keys a byte at a time as lookup3 does. xxhash64
+ * is XXH64; murmur3_64 is the first half of MurmurHash3_x64_128. Both
+ * match their kernels in test.cl.
+ */
+cl_ulong xxhash64(const void *key, size_t len, unsigned int seed);
+cl_ulong murmur3_64(const void *key, size_t len, unsigned int seed);
+
+/* Variable-length keys are packed back to back in one blob, CSR style:
+ * key i is keys[offsets[i]] up to keys[offsets[i + 1]], so offsets has
+ * num_keys + 1 entries.
+ */
+void hash_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes);
+void hash64_keys_csr(const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, cl_ulong *hashes);
+
+/* Fixed length keys, len bytes apart, interleaved: word w of key k is at
+ * words[w * num_keys + k], zero padded. words holds
+ * HASH_SOA_WORDS(len) * num_keys words.
+ */
+#define HASH_SOA_WORDS(len) (((len) + 3) / 4)
+
+void hash_keys_to_soa(const char *keys, size_t num_keys, unsigned int len, cl_uint *words);
+
+/* Device batch hashing. Buffers grow to the largest batch seen and are
+ * kept between calls.
+ */
+#define HASH_BATCH_LOCAL_SIZE 64
+
+struct hash_batch
+{
+	cl_context context;
+	cl_command_queue queue;
+	cl_kernel hash32;
+	cl_kernel hash64;
+	struct host_buffer keys;
+	struct host_buffer offsets;
+	struct host_buffer hashes;
+	size_t key_capacity;
+	size_t num_capacity;
+	size_t local_size;
+};
+
+void hash_batch_init(struct hash_batch *hb, cl_context context, cl_command_queue queue, cl_program program);
+void hash_batch_upload(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys);
+void hash_batch_enqueue(struct hash_batch *hb, size_t num_keys, unsigned int seed, int wide);
+void hash_batch_run(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, unsigned int *hashes);
+void hash_batch_run64(struct hash_batch *hb, const char *keys, const cl_uint *offsets, size_t num_keys, unsigned int seed, cl_ulong *hashes);
+void hash_batch_release(struct hash_batch *hb);
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "buffer.h"
+#include "hash.h"
+#include "hashtable.h"
+
+static size_t next_pow2(size_t n)
+{
+	size_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+
+	return p;
+}
+
+/* num_slots is rounded up to a power of two and must be more than the
+ * number of distinct keys; the load factor is distinct keys / slots.
+ * Duplicates take no slot.
+ */
+void hash_table_create(struct hash_table *t, cl_context context, cl_command_queue queue, cl_program program, size_t max_keys, size_t num_slots)
+{
+	cl_int err;
+
+	memset(t, 0, sizeof(*t));
+	t->queue = queue;
+	t->max_keys = max_keys;
+	t->num_slots = next_pow2(num_slots);
+
+	t->hash = clCreateKernel(program, "lookup3_hash_keys_csr", &err);
+	CL_CHECK_ERR(err);
+	t->build = clCreateKernel(program, "hash_table_build", &err);
+	CL_CHECK_ERR(err);
+	t->probe = clCreateKernel(program, "hash_table_probe", &err);
+	CL_CHECK_ERR(err);
+
+	t->slots = clCreateBuffer(context, CL_MEM_READ_WRITE, t->num_slots * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	t->hashes = clCreateBuffer(context, CL_MEM_READ_WRITE, (max_keys > 0 ? max_keys : 1) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	t->first = clCreateBuffer(context, CL_MEM_READ_WRITE, (max_keys > 0 ? max_keys : 1) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+}
+
+static void enqueue(struct hash_table *t, cl_kernel kernel, size_t n, const char *name)
+{
+	size_t local_size = HASH_TABLE_LOCAL_SIZE;
+	size_t global_size = (n + local_size - 1) / local_size * local_size;
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(t->queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, prof_enabled() ? &ev : NULL);
+	CL_CHECK_ERR(err);
+
+	if (prof_enabled())
+	{
+		err = clWaitForEvents(1, &ev);
+		CL_CHECK_ERR(err);
+		prof_event(ev, name, PROF_KERNEL);
+		err = clReleaseEvent(ev);
+		CL_CHECK_ERR(err);
+	}
+}
+
+/* Empty the table and insert keys. Afterwards t->first (on the device)
+ * maps every key to the index of the copy held in the table. Only
+ * enqueues the work.
+ */
+void hash_table_build(struct hash_table *t, cl_mem keys, cl_mem offsets, size_t num_keys)
+{
+	cl_uint empty = HASH_TABLE_EMPTY;
+	cl_uint n = (cl_uint) num_keys;
+	cl_uint seed = HASH_TABLE_SEED;
+	cl_uint mask = (cl_uint) (t->num_slots - 1);
+	cl_int err;
+
+	if (num_keys > t->max_keys)
+	{
+		fprintf(stderr, "Hash table built with %lu keys, sized for %lu\n", (unsigned long) num_keys, (unsigned long) t->max_keys);
+		exit(1);
+	}
+
+	t->keys = keys;
+	t->offsets = offsets;
+	t->num_keys = num_keys;
+
+	err = clEnqueueFillBuffer(t->queue, t->slots, &empty, sizeof(empty), 0, t->num_slots * sizeof(cl_uint), 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	if (num_keys == 0)
+		return;
+
+	err = clSetKernelArg(t->hash, 0, sizeof(cl_mem), &keys);
+	err |= clSetKernelArg(t->hash, 1, sizeof(cl_mem), &offsets);
+	err |= clSetKernelArg(t->hash, 2, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(t->hash, 3, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(t->hash, 4, sizeof(cl_mem), &t->hashes);
+	CL_CHECK_ERR(err);
+
+	enqueue(t, t->hash, num_keys, "lookup3_hash_keys_csr");
+
+	err = clSetKernelArg(t->build, 0, sizeof(cl_mem), &keys);
+	err |= clSetKernelArg(t->build, 1, sizeof(cl_mem), &offsets);
+	err |= clSetKernelArg(t->build, 2, sizeof(cl_mem), &t->hashes);
+	err |= clSetKernelArg(t->build, 3, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(t->build, 4, sizeof(cl_mem), &t->slots);
+	err |= clSetKernelArg(t->build, 5, sizeof(cl_uint), &mask);
+	err |= clSetKernelArg(t->build, 6, sizeof(cl_mem), &t->first);
+	CL_CHECK_ERR(err);
+
+	enqueue(t, t->build, num_keys, "hash_table_build");
+}
+
+/* matches receives, for each key, the index of the equal build key or
+ * HASH_TABLE_EMPTY. Only enqueues the work.
+ */
+void hash_table_probe(struct hash_table *t, cl_mem keys, cl_mem offsets, size_t num_keys, cl_mem matches)
+{
+	cl_uint n = (cl_uint) num_keys;
+	cl_uint seed = HASH_TABLE_SEED;
+	cl_uint mask = (cl_uint) (t->num_slots - 1);
+	cl_int err;
+
+	if (num_keys == 0)
+		return;
+
+	err = clSetKernelArg(t->probe, 0, sizeof(cl_mem), &t->keys);
+	err |= clSetKernelArg(t->probe, 1, sizeof(cl_mem), &t->offsets);
+	err |= clSetKernelArg(t->probe, 2, sizeof(cl_mem), &t->hashes);
+	err |= clSetKernelArg(t->probe, 3, sizeof(cl_mem), &t->slots);
+	err |= clSetKernelArg(t->probe, 4, sizeof(cl_uint), &mask);
+	err |= clSetKernelArg(t->probe, 5, sizeof(cl_mem), &keys);
+	err |= clSetKernelArg(t->probe, 6, sizeof(cl_mem), &offsets);
+	err |= clSetKernelArg(t->probe, 7, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(t->probe, 8, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(t->probe, 9, sizeof(cl_mem), &matches);
+	CL_CHECK_ERR(err);
+
+	enqueue(t, t->probe, num_keys, "hash_table_probe");
+}
+
+void hash_table_release(struct hash_table *t)
+{
+	cl_int err;
+
+	err = clReleaseMemObject(t->slots); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(t->hashes); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(t->first); CL_CHECK_ERR(err);
+	err = clReleaseKernel(t->hash); CL_CHECK_ERR(err);
+	err = clReleaseKernel(t->build); CL_CHECK_ERR(err);
+	err = clReleaseKernel(t->probe); CL_CHECK_ERR(err);
+}
+
+static int host_keys_equal(const char *keys_a, const cl_uint *offsets_a, cl_uint a, const char *keys_b, const cl_uint *offsets_b, cl_uint b)
+{
+	cl_uint len = offsets_a[a + 1] - offsets_a[a];
+
+	return offsets_b[b + 1] - offsets_b[b] == len && memcmp(&keys_a[offsets_a[a]], &keys_b[offsets_b[b]], len) == 0;
+}
+
+void chain_table_build(struct chain_table *t, const char *keys, const cl_uint *offsets, size_t num_keys, cl_uint *first)
+{
+	size_t num_buckets = next_pow2(num_keys > 0 ? num_keys : 1);
+	cl_uint *bucket;
+	cl_uint i, cur;
+
+	t->keys = keys;
+	t->offsets = offsets;
+	t->mask = num_buckets - 1;
+	t->heads = (cl_uint *) malloc(num_buckets * sizeof(cl_uint));
+	t->next = (cl_uint *) malloc((num_keys > 0 ? num_keys : 1) * sizeof(cl_uint));
+	t->hashes = (cl_uint *) malloc((num_keys > 0 ? num_keys : 1) * sizeof(cl_uint));
+	if (t->heads == NULL || t->next == NULL || t->hashes == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	memset(t->heads, 0xff, num_buckets * sizeof(cl_uint));
+
+	for (i = 0; i < num_keys; i++)
+	{
+		t->hashes[i] = lookup3(&keys[offsets[i]], offsets[i + 1] - offsets[i], HASH_TABLE_SEED);
+		bucket = &t->heads[t->hashes[i] & t->mask];
+
+		for (cur = *bucket; cur != HASH_TABLE_EMPTY; cur = t->next[cur])
+			if (t->hashes[cur] == t->hashes[i] && host_keys_equal(keys, offsets, cur, keys, offsets, i))
+				break;
+
+		if (cur != HASH_TABLE_EMPTY)
+		{
+			first[i] = cur;
+			continue;
+		}
+
+		t->next[i] = *bucket;
+		*bucket = i;
+		first[i] = i;
+	}
+}
+
+void chain_table_probe(const struct chain_table *t, const char *keys, const cl_uint *offsets, size_t num_keys, cl_uint *matches)
+{
+	cl_uint h, i, cur;
+
+	for (i = 0; i < num_keys; i++)
+	{
+		h = lookup3(&keys[offsets[i]], offsets[i + 1] - offsets[i], HASH_TABLE_SEED);
+
+		for (cur = t->heads[h & t->mask]; cur != HASH_TABLE_EMPTY; cur = t->next[cur])
+			if (t->hashes[cur] == h && host_keys_equal(t->keys, t->offsets, cur, keys, offsets, i))
+				break;
+
+		matches[i] = cur;
+	}
+}
+
+void chain_table_release(struct chain_table *t)
+{
+	free(t->heads);
+	free(t->next);
+	free(t->hashes);
+}
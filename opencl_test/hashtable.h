@@ -0,0 +1,52 @@
+#ifndef TEST_HASHTABLE_H
+#define TEST_HASHTABLE_H
+
+/* Must match HASH_TABLE_EMPTY in test.cl. */
+#define HASH_TABLE_EMPTY 0xffffffff
+#define HASH_TABLE_SEED 0
+#define HASH_TABLE_LOCAL_SIZE 64
+
+/* Open addressing table on the device, built from CSR packed keys (see
+ * hash.h). The table refers to the build keys by index, so their buffers
+ * must outlive any probe.
+ */
+struct hash_table
+{
+	cl_command_queue queue;
+	cl_kernel hash;
+	cl_kernel build;
+	cl_kernel probe;
+	size_t num_slots;
+	size_t max_keys;
+	cl_mem slots;
+	cl_mem hashes;
+	cl_mem first;
+	cl_mem keys;
+	cl_mem offsets;
+	size_t num_keys;
+};
+
+void hash_table_create(struct hash_table *t, cl_context context, cl_command_queue queue, cl_program program, size_t max_keys, size_t num_slots);
+void hash_table_build(struct hash_table *t, cl_mem keys, cl_mem offsets, size_t num_keys);
+void hash_table_probe(struct hash_table *t, cl_mem keys, cl_mem offsets, size_t num_keys, cl_mem matches);
+void hash_table_release(struct hash_table *t);
+
+/* Host baseline in the style of std::unordered_map: a power of two array
+ * of buckets, each a chain of nodes (here key indices linked through
+ * next), with at most one key per bucket on average.
+ */
+struct chain_table
+{
+	const char *keys;
+	const cl_uint *offsets;
+	cl_uint *hashes;
+	cl_uint *heads;
+	cl_uint *next;
+	size_t mask;
+};
+
+void chain_table_build(struct chain_table *t, const char *keys, const cl_uint *offsets, size_t num_keys, cl_uint *first);
+void chain_table_probe(const struct chain_table *t, const char *keys, const cl_uint *offsets, size_t num_keys, cl_uint *matches);
+void chain_table_release(struct chain_table *t);
+
+#endif
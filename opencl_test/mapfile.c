@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <CL/cl.h>
+
+#include "common.h"
+#include "mapfile.h"
+
+/* Read the rest of the file into a malloc'd buffer, for inputs that
+ * cannot be mapped. m->size is only a hint; pipes report 0. One spare
+ * byte lets a file of the hinted size hit EOF without growing the buffer.
+ */
+static void mapfile_read(struct mapped_file *m)
+{
+	size_t cap = m->size > 0 ? m->size + 1 : (size_t) 1 << 20;
+	size_t len = 0, max;
+	char *buf;
+	int ok;
+#ifdef _WIN32
+	DWORD n;
+#else
+	ssize_t n;
+#endif
+
+	buf = (char *) malloc(cap);
+	if (buf == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (;;)
+	{
+		if (len == cap)
+		{
+			cap *= 2;
+			buf = (char *) realloc(buf, cap);
+			if (buf == NULL)
+			{
+				fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+				exit(1);
+			}
+		}
+
+		/* Keep each request within what one call can return. */
+		max = cap - len < (1 << 30) ? cap - len : (1 << 30);
+#ifdef _WIN32
+		ok = ReadFile(m->file, buf + len, (DWORD) max, &n, NULL);
+		if (!ok)
+		{
+			/* A pipe whose writer has closed reports EOF as an error. */
+			ok = (GetLastError() == ERROR_BROKEN_PIPE);
+			n = 0;
+		}
+#else
+		n = read(m->fd, buf + len, max);
+		ok = (n >= 0);
+#endif
+		if (!ok)
+		{
+			fprintf(stderr, "Failed to read file: %s\n", m->filename);
+			exit(1);
+		}
+		if (n == 0)
+			break;
+		len += (size_t) n;
+	}
+
+	m->copied = 1;
+	m->size = len;
+	if (len == 0)
+		free(buf);
+	else
+		m->data = buf;
+}
+
+/* Exits if the file cannot be opened or read. An empty file maps to
+ * data == NULL and size == 0.
+ */
+void mapfile_open(struct mapped_file *m, const char *filename)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+
+	m->filename = filename;
+	m->data = NULL;
+	m->size = 0;
+	m->copied = 0;
+	m->mapping = NULL;
+
+	m->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m->file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Failed to open file: %s\n", filename);
+		exit(1);
+	}
+
+	if (GetFileType(m->file) != FILE_TYPE_DISK || !GetFileSizeEx(m->file, &size))
+	{
+		mapfile_read(m);
+		return;
+	}
+	m->size = (size_t) size.QuadPart;
+
+	if (m->size == 0)
+		return;
+
+	m->mapping = CreateFileMappingA(m->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (m->mapping != NULL)
+		m->data = MapViewOfFile(m->mapping, FILE_MAP_COPY, 0, 0, 0);
+#else
+	struct stat st;
+
+	m->filename = filename;
+	m->data = NULL;
+	m->size = 0;
+	m->copied = 0;
+
+	m->fd = open(filename, O_RDONLY);
+	if (m->fd < 0 || fstat(m->fd, &st) != 0)
+	{
+		fprintf(stderr, "Failed to open file: %s\n", filename);
+		exit(1);
+	}
+
+	if (!S_ISREG(st.st_mode))
+	{
+		mapfile_read(m);
+		return;
+	}
+	m->size = (size_t) st.st_size;
+
+	if (m->size == 0)
+		return;
+
+	/* Writable but private, since some runtimes want write access to
+	 * pin host memory; nothing is ever written back to the file.
+	 */
+	m->data = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_PRIVATE, m->fd, 0);
+	if (m->data == MAP_FAILED)
+		m->data = NULL;
+	else
+		madvise(m->data, m->size, MADV_SEQUENTIAL);
+#endif
+
+	if (m->data == NULL)
+		mapfile_read(m);
+}
+
+void mapfile_close(struct mapped_file *m)
+{
+	if (m->copied)
+	{
+		free(m->data);
+		m->data = NULL;
+	}
+
+#ifdef _WIN32
+	if (m->data != NULL)
+		UnmapViewOfFile(m->data);
+	if (m->mapping != NULL)
+		CloseHandle(m->mapping);
+	CloseHandle(m->file);
+#else
+	if (m->data != NULL)
+		munmap(m->data, m->size);
+	close(m->fd);
+#endif
+	m->data = NULL;
+	m->size = 0;
+}
+
+cl_mem mapfile_buffer(struct mapped_file *m, cl_context context, size_t offset, size_t size, int *zero_copy)
+{
+	cl_mem mem;
+	cl_int err;
+
+	mem = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_USE_HOST_PTR, size, (char *) m->data + offset, &err);
+	if (err == CL_SUCCESS)
+	{
+		if (zero_copy != NULL)
+			*zero_copy = 1;
+		return mem;
+	}
+
+	mem = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, size, (char *) m->data + offset, &err);
+	CL_CHECK_ERR(err);
+
+	if (zero_copy != NULL)
+		*zero_copy = 0;
+	return mem;
+}
@@ -0,0 +1,34 @@
+#ifndef TEST_MAPFILE_H
+#define TEST_MAPFILE_H
+
+/* A whole file mapped into memory, copy on write, so multi-gigabyte
+ * inputs can be handed to the device without being read into a malloc'd
+ * copy first. The mapping is page aligned, which also satisfies
+ * CL_DEVICE_MEM_BASE_ADDR_ALIGN on the runtimes we use, so a
+ * CL_MEM_USE_HOST_PTR buffer over it can be zero copy. Inputs that
+ * cannot be mapped, such as pipes, are read into memory instead.
+ */
+struct mapped_file
+{
+	const char *filename;
+	void *data;
+	size_t size;
+	int copied;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+void mapfile_open(struct mapped_file *m, const char *filename);
+void mapfile_close(struct mapped_file *m);
+
+/* A read-only buffer over [offset, offset + size) of the mapping. Uses the
+ * mapping directly where the runtime allows it and falls back to copying.
+ * Sets *zero_copy to whether the first worked, if not NULL.
+ */
+cl_mem mapfile_buffer(struct mapped_file *m, cl_context context, size_t offset, size_t size, int *zero_copy);
+
+#endif
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "bench.h"
+#include "spec.h"
+#include "membench.h"
+
+static struct membench_ceilings ceilings[MEMBENCH_MAX_DEVICES];
+static int num_ceilings = 0;
+
+static const int vec_widths[] = { 1, 4, 8, 16 };
+#define NUM_VEC_WIDTHS ((int) (sizeof(vec_widths) / sizeof(vec_widths[0])))
+
+struct mb_launch
+{
+	cl_command_queue queue;
+	cl_kernel kernel;
+	size_t global_size;
+};
+
+static void mb_run_launch(void *arg)
+{
+	struct mb_launch *launch = (struct mb_launch *) arg;
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(launch->queue, launch->kernel, 1, NULL, &launch->global_size, NULL, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+}
+
+struct mb_transfer
+{
+	cl_command_queue queue;
+	cl_mem buffer;
+	void *host;
+	size_t bytes;
+	int to_device;
+};
+
+static void mb_run_transfer(void *arg)
+{
+	struct mb_transfer *t = (struct mb_transfer *) arg;
+	cl_int err;
+
+	if (t->to_device)
+		err = clEnqueueWriteBuffer(t->queue, t->buffer, CL_TRUE, 0, t->bytes, t->host, 0, NULL, NULL);
+	else
+		err = clEnqueueReadBuffer(t->queue, t->buffer, CL_TRUE, 0, t->bytes, t->host, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+}
+
+static double gb_per_sec(const struct bench_result *r)
+{
+	return r->median > 0 ? r->bytes / r->median / 1e9 : 0;
+}
+
+static double max_of(double a, double b)
+{
+	return a > b ? a : b;
+}
+
+/* Host to device and back, from pageable (malloc) and from pinned memory.
+ * Pinned memory is an ALLOC_HOST_PTR buffer kept mapped, which is how most
+ * runtimes hand out page-locked staging memory.
+ */
+static void membench_transfers(cl_context context, cl_command_queue queue, cl_mem dev_buf, size_t bytes, struct membench_ceilings *c)
+{
+	struct mb_transfer t;
+	struct bench_result *r;
+	cl_mem pinned_buf;
+	void *pinned, *pageable;
+	cl_int err;
+
+	pageable = malloc(bytes);
+	if (pageable == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+	memset(pageable, 0, bytes);
+
+	pinned_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &err);
+	CL_CHECK_ERR(err);
+	pinned = clEnqueueMapBuffer(queue, pinned_buf, CL_TRUE, CL_MAP_READ|CL_MAP_WRITE, 0, bytes, 0, NULL, NULL, &err);
+	CL_CHECK_ERR(err);
+	memset(pinned, 0, bytes);
+
+	t.queue = queue;
+	t.buffer = dev_buf;
+	t.bytes = bytes;
+
+	t.host = pageable;
+	t.to_device = 1;
+	r = bench_run("membench h2d pageable", mb_run_transfer, &t, (double) bytes, 0);
+	c->h2d_pageable = gb_per_sec(r);
+
+	t.to_device = 0;
+	r = bench_run("membench d2h pageable", mb_run_transfer, &t, (double) bytes, 0);
+	c->d2h_pageable = gb_per_sec(r);
+
+	t.host = pinned;
+	t.to_device = 1;
+	r = bench_run("membench h2d pinned", mb_run_transfer, &t, (double) bytes, 0);
+	c->h2d_pinned = gb_per_sec(r);
+
+	t.to_device = 0;
+	r = bench_run("membench d2h pinned", mb_run_transfer, &t, (double) bytes, 0);
+	c->d2h_pinned = gb_per_sec(r);
+
+	err = clEnqueueUnmapMemObject(queue, pinned_buf, pinned, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clFinish(queue);
+	CL_CHECK_ERR(err);
+	err = clReleaseMemObject(pinned_buf);
+	CL_CHECK_ERR(err);
+	free(pageable);
+}
+
+/* Measures what the device can sustain, so the kernel benchmarks have
+ * something to be compared with: global read, write and copy bandwidth
+ * at each vector width and with strided and blocked access, transfer
+ * bandwidth over the bus, the cost of an empty launch and peak
+ * single-precision FMA throughput. The best of each goes into the
+ * roofline table printed by membench_print_roofline().
+ */
+void membench_run(cl_context context, cl_device_id device, cl_command_queue queue, size_t bytes)
+{
+	static const char *read_kernels[] = { "mb_read_strided", "mb_read_blocked" };
+	static const char *read_names[] = { "strided", "blocked" };
+	struct membench_ceilings *c;
+	struct spec_cache spec;
+	struct mb_launch launch;
+	struct bench_result *r;
+	cl_mem src_buf, dst_buf, out_buf;
+	cl_kernel kernel;
+	cl_ulong max_alloc;
+	cl_uint compute_units;
+	cl_uint n, magic = 1, value = 0, iters = MEMBENCH_FMA_ITERS, zero = 0;
+	cl_float seed = 1.0f;
+	char options[SPEC_OPTIONS_LEN];
+	char name[64];
+	char *device_name = NULL;
+	int name_len = 0;
+	int v, k;
+	cl_int err;
+
+	printf("membench_run():\n");
+
+	if (num_ceilings == MEMBENCH_MAX_DEVICES)
+	{
+		printf("membench: more than %d devices, skipped\n", MEMBENCH_MAX_DEVICES);
+		return;
+	}
+	c = &ceilings[num_ceilings++];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->label, sizeof(c->label), "%s", get_device_info(device, CL_DEVICE_NAME, &device_name, &name_len));
+	free(device_name);
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+	CL_CHECK_ERR(err);
+
+	/* Two buffers of this size are live for the copy. Whole uint16s so
+	 * every vector width sees the same bytes.
+	 */
+	if (bytes > max_alloc)
+		bytes = (size_t) max_alloc;
+	bytes = bytes / 64 * 64;
+	if (bytes == 0)
+	{
+		printf("membench: buffer too small, skipped\n");
+		return;
+	}
+
+	spec_init(&spec, context, device, MEMBENCH_FILE);
+
+	launch.queue = queue;
+	launch.global_size = (size_t) compute_units * MEMBENCH_ITEMS_PER_CU;
+
+	src_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+	CL_CHECK_ERR(err);
+	dst_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+	CL_CHECK_ERR(err);
+	out_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, launch.global_size * sizeof(cl_float), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	/* Zeros sum to zero, never to magic. */
+	err = clEnqueueFillBuffer(queue, src_buf, &zero, sizeof(zero), 0, bytes, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clFinish(queue);
+	CL_CHECK_ERR(err);
+
+	for (v = 0; v < NUM_VEC_WIDTHS; v++)
+	{
+		snprintf(options, sizeof(options), "-DMB_VEC=%d", vec_widths[v]);
+		n = (cl_uint) (bytes / (sizeof(cl_uint) * vec_widths[v]));
+
+		for (k = 0; k < 2; k++)
+		{
+			kernel = spec_kernel(&spec, read_kernels[k], options);
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_buf);
+			err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &n);
+			err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &magic);
+			err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &out_buf);
+			CL_CHECK_ERR(err);
+
+			snprintf(name, sizeof(name), "membench read %s uint%d", read_names[k], vec_widths[v]);
+			launch.kernel = kernel;
+			r = bench_run(name, mb_run_launch, &launch, (double) bytes, 0);
+			c->read = max_of(c->read, gb_per_sec(r));
+		}
+
+		kernel = spec_kernel(&spec, "mb_write", options);
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst_buf);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &value);
+		CL_CHECK_ERR(err);
+
+		snprintf(name, sizeof(name), "membench write uint%d", vec_widths[v]);
+		launch.kernel = kernel;
+		r = bench_run(name, mb_run_launch, &launch, (double) bytes, 0);
+		c->write = max_of(c->write, gb_per_sec(r));
+
+		kernel = spec_kernel(&spec, "mb_copy", options);
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_buf);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &dst_buf);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &n);
+		CL_CHECK_ERR(err);
+
+		/* Read plus write. */
+		snprintf(name, sizeof(name), "membench copy uint%d", vec_widths[v]);
+		launch.kernel = kernel;
+		r = bench_run(name, mb_run_launch, &launch, 2.0 * bytes, 0);
+		c->copy = max_of(c->copy, gb_per_sec(r));
+	}
+
+	membench_transfers(context, queue, src_buf, bytes, c);
+
+	/* Launch latency: one work-item, nothing to do. */
+	launch.kernel = spec_kernel(&spec, "mb_empty", "");
+	launch.global_size = 1;
+	r = bench_run("membench empty launch", mb_run_launch, &launch, 0, 1);
+	c->launch_us = r->median * 1e6;
+
+	kernel = spec_kernel(&spec, "mb_fma", "");
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out_buf);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &iters);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_float), &seed);
+	CL_CHECK_ERR(err);
+
+	launch.kernel = kernel;
+	launch.global_size = (size_t) compute_units * MEMBENCH_ITEMS_PER_CU;
+	r = bench_run("membench fma", mb_run_launch, &launch, 0, (double) launch.global_size * iters * 32);
+	c->gflops = r->median > 0 ? r->items / r->median / 1e9 : 0;
+
+	printf("%s: read %.2f, write %.2f, copy %.2f GB/sec, launch %.1f us, %.1f GFLOP/sec\n",
+		c->label, c->read, c->write, c->copy, c->launch_us, c->gflops);
+
+	err = clReleaseMemObject(src_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(dst_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(out_buf); CL_CHECK_ERR(err);
+	spec_release(&spec);
+}
+
+/* The ridge point is the arithmetic intensity, in flops per byte read, at
+ * which a kernel stops being bound by memory bandwidth and becomes bound
+ * by compute. Kernels below it should be judged against the read
+ * bandwidth, kernels above it against GFLOP/sec.
+ */
+void membench_print_roofline(void)
+{
+	const struct membench_ceilings *c;
+	int i;
+
+	if (num_ceilings == 0)
+		return;
+
+	printf("\nRoofline ceilings (GB/sec unless noted):\n");
+	printf("%-32s %8s %8s %8s %8s %8s %8s %8s %10s %9s %11s\n",
+		"device", "read", "write", "copy", "h2d pin", "h2d page", "d2h pin", "d2h page",
+		"launch us", "GFLOP/s", "ridge F/B");
+
+	for (i = 0; i < num_ceilings; i++)
+	{
+		c = &ceilings[i];
+		printf("%-32.32s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %10.1f %9.1f %11.2f\n",
+			c->label, c->read, c->write, c->copy, c->h2d_pinned, c->h2d_pageable,
+			c->d2h_pinned, c->d2h_pageable, c->launch_us, c->gflops,
+			c->read > 0 ? c->gflops / c->read : 0);
+	}
+}
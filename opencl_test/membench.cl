@@ -0,0 +1,121 @@
+/* Memory and launch micro-benchmarks, built once per vector width:
+ *
+ *   -DMB_VEC=n  1 (uint), 4 (uint4), 8 (uint8) or 16 (uint16)
+ *
+ * n is always in elements of that width. The read kernels only store
+ * their sum if it equals magic; the host reads zeros and passes a
+ * non-zero magic, so nothing is written but the loads cannot be optimized
+ * away.
+ */
+#ifndef MB_VEC
+#define MB_VEC 1
+#endif
+
+#define MB_CAT(a, b) a ## b
+#define MB_XCAT(a, b) MB_CAT(a, b)
+
+#if MB_VEC == 1
+#define MB_T uint
+#else
+#define MB_T MB_XCAT(uint, MB_VEC)
+#endif
+
+uint mb_sum(MB_T v)
+{
+#if MB_VEC == 1
+	return v;
+#else
+#if MB_VEC == 16
+	uint8 v8 = v.lo + v.hi;
+	uint4 v4 = v8.lo + v8.hi;
+#elif MB_VEC == 8
+	uint4 v4 = v.lo + v.hi;
+#else
+	uint4 v4 = v;
+#endif
+	return v4.x + v4.y + v4.z + v4.w;
+#endif
+}
+
+/* Grid stride: on every step neighbouring work-items read neighbouring
+ * elements, which is what GPUs coalesce.
+ */
+__kernel void mb_read_strided(__global const MB_T *src, uint n, uint magic, __global uint *out)
+{
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+	MB_T acc = 0;
+	uint i;
+
+	for (i = gid; i < n; i += stride)
+		acc += src[i];
+
+	if (mb_sum(acc) == magic)
+		out[gid] = mb_sum(acc);
+}
+
+/* Blocked: each work-item walks its own contiguous range, which is what
+ * CPU caches and prefetchers want.
+ */
+__kernel void mb_read_blocked(__global const MB_T *src, uint n, uint magic, __global uint *out)
+{
+	uint gid = get_global_id(0);
+	uint per = (n + get_global_size(0) - 1) / get_global_size(0);
+	uint first = gid * per;
+	uint last = min(first + per, n);
+	MB_T acc = 0;
+	uint i;
+
+	for (i = first; i < last; i++)
+		acc += src[i];
+
+	if (mb_sum(acc) == magic)
+		out[gid] = mb_sum(acc);
+}
+
+__kernel void mb_write(__global MB_T *dst, uint n, uint value)
+{
+	uint stride = get_global_size(0);
+	uint i;
+
+	for (i = get_global_id(0); i < n; i += stride)
+		dst[i] = (MB_T) value;
+}
+
+__kernel void mb_copy(__global const MB_T *src, __global MB_T *dst, uint n)
+{
+	uint stride = get_global_size(0);
+	uint i;
+
+	for (i = get_global_id(0); i < n; i += stride)
+		dst[i] = src[i];
+}
+
+__kernel void mb_empty(void)
+{
+}
+
+/* Compute ceiling: four independent float4 multiply-add chains per
+ * work-item, 32 flops per iteration.
+ */
+__kernel void mb_fma(__global float *out, uint iters, float seed)
+{
+	float4 a = (float4) (seed, seed + 1.0f, seed + 2.0f, seed + 3.0f) + get_global_id(0);
+	float4 b = a + 4.0f;
+	float4 c = a + 8.0f;
+	float4 d = a + 12.0f;
+	float4 m = (float4) (0.999f);
+	float4 k = (float4) (0.001f);
+	uint i;
+
+	for (i = 0; i < iters; i++)
+	{
+		a = mad(a, m, k);
+		b = mad(b, m, k);
+		c = mad(c, m, k);
+		d = mad(d, m, k);
+	}
+
+	a = a + b + c + d;
+	out[get_global_id(0)] = a.x + a.y + a.z + a.w;
+}
@@ -0,0 +1,30 @@
+#ifndef TEST_MEMBENCH_H
+#define TEST_MEMBENCH_H
+
+/* Per-device ceilings from the memory micro-benchmarks, for judging how
+ * close each kernel gets to what the device can do. Bandwidths are GB/sec
+ * and the best over the access patterns and vector widths tried.
+ */
+#define MEMBENCH_FILE "membench.cl"
+#define MEMBENCH_MAX_DEVICES 16
+#define MEMBENCH_FMA_ITERS 4096
+#define MEMBENCH_ITEMS_PER_CU 1024
+
+struct membench_ceilings
+{
+	char label[64];
+	double read;
+	double write;
+	double copy;
+	double h2d_pinned;
+	double h2d_pageable;
+	double d2h_pinned;
+	double d2h_pageable;
+	double launch_us;
+	double gflops;
+};
+
+void membench_run(cl_context context, cl_device_id device, cl_command_queue queue, size_t bytes);
+void membench_print_roofline(void);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "bench.h"
+#include "prof.h"
+#include "multidev.h"
+
+/* Add devices to a set, each with its own context, queue and program.
+ */
+int md_init_devices(struct md_set *set, cl_device_id *devices, int num_devices, const char *filename)
+{
+	struct md_device *dev;
+	char *name = NULL;
+	int name_len = 0;
+	int j;
+	cl_int err;
+
+	set->devices = (struct md_device *) realloc(set->devices, (set->num + num_devices) * sizeof(struct md_device));
+	if (set->devices == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (j = 0; j < num_devices; j++)
+	{
+		dev = &set->devices[set->num++];
+		dev->device = devices[j];
+		dev->weight = 1.0;
+
+		get_device_info(devices[j], CL_DEVICE_NAME, &name, &name_len);
+		strncpy(dev->name, name, sizeof(dev->name) - 1);
+		dev->name[sizeof(dev->name) - 1] = '\0';
+
+		dev->context = clCreateContext(NULL, 1, &devices[j], NULL, NULL, &err);
+		CL_CHECK_ERR(err);
+		dev->queue = clCreateCommandQueue(dev->context, devices[j], prof_queue_properties(), &err);
+		CL_CHECK_ERR(err);
+		dev->program = get_program_from_file(dev->context, devices[j], filename);
+	}
+
+	if (name != NULL)
+		free(name);
+
+	return set->num;
+}
+
+/* Open every device of the given type on every platform.
+ */
+int md_init(struct md_set *set, cl_device_type device_type, const char *filename)
+{
+	cl_platform_id *platforms = NULL;
+	cl_device_id *devices = NULL;
+	cl_uint num;
+	int num_platforms, num_devices;
+	int i;
+
+	set->devices = NULL;
+	set->num = 0;
+
+	num_platforms = get_platforms(&platforms);
+
+	for (i = 0; i < num_platforms; i++)
+	{
+		/* get_devices() exits on CL_DEVICE_NOT_FOUND, so check first. */
+		if (clGetDeviceIDs(platforms[i], device_type, 0, NULL, &num) != CL_SUCCESS)
+			continue;
+
+		num_devices = get_devices(platforms[i], device_type, &devices);
+		md_init_devices(set, devices, num_devices, filename);
+		free(devices);
+	}
+
+	if (platforms != NULL)
+		free(platforms);
+
+	return set->num;
+}
+
+void md_release(struct md_set *set)
+{
+	cl_int err;
+	int i;
+
+	for (i = 0; i < set->num; i++)
+	{
+		err = clReleaseProgram(set->devices[i].program); CL_CHECK_ERR(err);
+		err = clReleaseCommandQueue(set->devices[i].queue); CL_CHECK_ERR(err);
+		err = clReleaseContext(set->devices[i].context); CL_CHECK_ERR(err);
+	}
+
+	free(set->devices);
+	set->devices = NULL;
+	set->num = 0;
+}
+
+/* Split total items between the devices in proportion to their weights, in
+ * multiples of align. Whatever is left after rounding goes to the fastest
+ * device, so total should itself be a multiple of align.
+ */
+void md_partition(const struct md_set *set, size_t total, size_t align, size_t *counts)
+{
+	double sum = 0.0;
+	size_t assigned = 0;
+	int fastest = 0;
+	int i;
+
+	for (i = 0; i < set->num; i++)
+	{
+		sum += set->devices[i].weight;
+		if (set->devices[i].weight > set->devices[fastest].weight)
+			fastest = i;
+	}
+
+	for (i = 0; i < set->num; i++)
+	{
+		counts[i] = (size_t) ((double) total * set->devices[i].weight / sum);
+		counts[i] -= counts[i] % align;
+		assigned += counts[i];
+	}
+
+	counts[fastest] += total - assigned;
+}
+
+/* Enqueue each device's share on its own queue, flush them all so the
+ * devices run concurrently, then wait for each and merge. Returns the wall
+ * time of the whole run.
+ */
+double md_run(struct md_set *set, const size_t *counts, md_enqueue_fn enqueue, md_complete_fn complete, void *arg)
+{
+	void **states;
+	size_t first;
+	double t0, elapsed;
+	cl_int err;
+	int i;
+
+	states = (void **) calloc(set->num, sizeof(void *));
+	if (states == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	t0 = bench_now();
+
+	first = 0;
+	for (i = 0; i < set->num; i++)
+	{
+		if (counts[i] > 0)
+		{
+			enqueue(&set->devices[i], first, counts[i], arg, &states[i]);
+			err = clFlush(set->devices[i].queue);
+			CL_CHECK_ERR(err);
+		}
+		first += counts[i];
+	}
+
+	for (i = 0; i < set->num; i++)
+	{
+		if (counts[i] > 0)
+		{
+			err = clFinish(set->devices[i].queue);
+			CL_CHECK_ERR(err);
+		}
+	}
+
+	elapsed = bench_now() - t0;
+
+	first = 0;
+	for (i = 0; i < set->num; i++)
+	{
+		if (counts[i] > 0)
+			complete(&set->devices[i], first, counts[i], arg, states[i]);
+		first += counts[i];
+	}
+
+	free(states);
+
+	return elapsed;
+}
+
+/* Time count items on each device alone and use the rate as its weight.
+ * The first run on each device is a warmup.
+ */
+void md_calibrate(struct md_set *set, size_t count, md_enqueue_fn enqueue, md_complete_fn complete, void *arg)
+{
+	size_t *counts;
+	double t;
+	int i;
+
+	counts = (size_t *) calloc(set->num, sizeof(size_t));
+	if (counts == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < set->num; i++)
+	{
+		counts[i] = count;
+		md_run(set, counts, enqueue, complete, arg);
+		t = md_run(set, counts, enqueue, complete, arg);
+		counts[i] = 0;
+
+		set->devices[i].weight = t > 0 ? (double) count / t : 1.0;
+		printf("    [%d] %s: %.2f M items/sec\n", i, set->devices[i].name, set->devices[i].weight / 1e6);
+	}
+
+	free(counts);
+}
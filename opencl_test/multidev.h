@@ -0,0 +1,40 @@
+#ifndef TEST_MULTIDEV_H
+#define TEST_MULTIDEV_H
+
+/* Every device of the requested type on every platform, each with its
+ * own context since contexts cannot span platforms. weight is the
+ * measured throughput used to size each device's share of a workload.
+ */
+struct md_device
+{
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	char name[64];
+	double weight;
+};
+
+struct md_set
+{
+	struct md_device *devices;
+	int num;
+};
+
+/* Enqueue (without waiting) the work for items [first, first + count) on
+ * dev->queue, keeping whatever must be released later in *state.
+ * complete is called once everything on the queue has finished, to merge
+ * the device's results and release *state.
+ */
+typedef void (*md_enqueue_fn)(struct md_device *dev, size_t first, size_t count, void *arg, void **state);
+typedef void (*md_complete_fn)(struct md_device *dev, size_t first, size_t count, void *arg, void *state);
+
+int md_init(struct md_set *set, cl_device_type device_type, const char *filename);
+int md_init_devices(struct md_set *set, cl_device_id *devices, int num_devices, const char *filename);
+void md_release(struct md_set *set);
+
+void md_partition(const struct md_set *set, size_t total, size_t align, size_t *counts);
+double md_run(struct md_set *set, const size_t *counts, md_enqueue_fn enqueue, md_complete_fn complete, void *arg);
+void md_calibrate(struct md_set *set, size_t count, md_enqueue_fn enqueue, md_complete_fn complete, void *arg);
+
+#endif
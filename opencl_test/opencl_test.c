@@ -4,571 +4,4528 @@
 #include <math.h>
 #include <time.h>
 #include <CL/cl.h>
-#include <Windows.h>
 
 #include "common.h"
+#include "bench.h"
+#include "prof.h"
+#include "autotune.h"
+#include "multidev.h"
+#include "stream.h"
+#include "buffer.h"
+#include "hash.h"
+#include "cpu.h"
+#include "reduce.h"
+#include "scan.h"
+#include "hashtable.h"
+#include "threads.h"
+#include "graph.h"
+#include "runtime.h"
+#include "spec.h"
+#include "mapfile.h"
+#include "membench.h"
+#include "batch.h"
 
 #define GLOBAL_SIZE 1024
 #define LOCAL_SIZE 16
 
+/* Print per-element results as well as the checks (--verbose). */
+static int verbose = 0;
+
+/* Host threads for preparing inputs and checking results (--host-threads),
+ * started once in main().
+ */
+static struct thread_pool host_pool;
+static int host_threads = 1;
+
+/* Round up to a multiple of align. */
+size_t round_up(size_t n, size_t align)
+{
+	return (n + align - 1) / align * align;
+}
+
+/* Input generation and checking on the host pool. Each job writes only its
+ * own range and its own per-thread slot, so the results do not depend on
+ * the thread count.
+ */
+struct lcg_fill
+{
+	cl_uint *dst;
+	size_t n;
+	cl_uint seed;
+	cl_uint mins[PARALLEL_MAX_THREADS];
+};
+
+/* The minp generator, restarted every LCG_FILL_BLOCK items from a seed
+ * derived from the block number so blocks can be filled in any order.
+ */
+#define LCG_FILL_BLOCK 65536
+
+static void lcg_fill_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct lcg_fill *f = (struct lcg_fill *) arg;
+	cl_uint a = f->seed;
+	cl_uint b, min = (cl_uint) -1;
+	size_t blk, i, end;
+
+	for (blk = first; blk < first + count; blk++)
+	{
+		b = f->seed + (cl_uint) blk * 0x9e3779b9u;
+		end = (blk + 1) * LCG_FILL_BLOCK < f->n ? (blk + 1) * LCG_FILL_BLOCK : f->n;
+		for (i = blk * LCG_FILL_BLOCK; i < end; i++)
+		{
+			f->dst[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
+			min = f->dst[i] < min ? f->dst[i] : min;
+		}
+	}
+
+	f->mins[thread] = min;
+}
+
+/* Fill dst with n pseudo-random values and return their min. */
+cl_uint host_fill_lcg(cl_uint *dst, size_t n, cl_uint seed)
+{
+	struct lcg_fill f;
+	cl_uint min = (cl_uint) -1;
+	int i;
+
+	f.dst = dst;
+	f.n = n;
+	f.seed = seed;
+	for (i = 0; i < PARALLEL_MAX_THREADS; i++)
+		f.mins[i] = (cl_uint) -1;
+
+	pool_for(&host_pool, (n + LCG_FILL_BLOCK - 1) / LCG_FILL_BLOCK, host_threads, lcg_fill_job, &f);
+
+	for (i = 0; i < PARALLEL_MAX_THREADS; i++)
+		min = f.mins[i] < min ? f.mins[i] : min;
+	return min;
+}
+
+struct charset_fill
+{
+	char *dst;
+	const char *charset;
+	size_t len;
+};
+
+static void charset_fill_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct charset_fill *f = (struct charset_fill *) arg;
+	size_t i;
+
+	for (i = first; i < first + count; i++)
+		f->dst[i] = f->charset[i % f->len];
+}
+
+/* The charset repeated over n bytes. */
+void host_fill_charset(char *dst, size_t n, const char *charset)
+{
+	struct charset_fill f;
+
+	f.dst = dst;
+	f.charset = charset;
+	f.len = strlen(charset);
+	pool_for(&host_pool, n, host_threads, charset_fill_job, &f);
+}
+
+struct matrix_fill
+{
+	float *aa;
+	float *b;
+	size_t n;
+};
+
+static void matrix_fill_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct matrix_fill *f = (struct matrix_fill *) arg;
+	size_t i, j;
+
+	for (i = first; i < first + count; i++)
+	{
+		for (j = 0; j < f->n; j++)
+			f->aa[i * f->n + j] = (float) 1.1 * i * j;
+
+		f->b[i] = (float) 2.2 * i;
+	}
+}
+
+/* The matrix_multiply inputs, a row per item. */
+void host_fill_matrix(float *aa, float *b, size_t n)
+{
+	struct matrix_fill f;
+
+	f.aa = aa;
+	f.b = b;
+	f.n = n;
+	pool_for(&host_pool, n, host_threads, matrix_fill_job, &f);
+}
+
+struct hash_check
+{
+	const char *keys;
+	unsigned int len;
+	unsigned int seed;
+	const unsigned int *hashes;
+	int errors[PARALLEL_MAX_THREADS];
+};
+
+static void hash_check_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct hash_check *c = (struct hash_check *) arg;
+	size_t i;
+
+	for (i = first; i < first + count; i++)
+		if (c->hashes[i] != lookup3(&c->keys[i * c->len], c->len, c->seed))
+			c->errors[thread]++;
+}
+
+/* Whether hashes[i] is the lookup3 of fixed length key i, for every i. */
+int host_check_hashes(const char *keys, size_t num_keys, unsigned int len, unsigned int seed, const unsigned int *hashes)
+{
+	struct hash_check c;
+	int i, errors = 0;
+
+	c.keys = keys;
+	c.len = len;
+	c.seed = seed;
+	c.hashes = hashes;
+	memset(c.errors, 0, sizeof(c.errors));
+
+	pool_for(&host_pool, num_keys, host_threads, hash_check_job, &c);
+
+	for (i = 0; i < PARALLEL_MAX_THREADS; i++)
+		errors += c.errors[i];
+	return errors == 0;
+}
+
+/* One NDRange launch, run to completion, for timing with bench_run().
+ */
+struct kernel_launch
+{
+	const char *name;
+	cl_command_queue queue;
+	cl_kernel kernel;
+	size_t global_size;
+	size_t local_size;
+};
+
+void run_kernel_launch(void *arg)
+{
+	struct kernel_launch *launch = (struct kernel_launch *) arg;
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(launch->queue, launch->kernel, 1, NULL, &launch->global_size, launch->local_size ? &launch->local_size : NULL, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev, launch->name, PROF_KERNEL);
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+}
+
+/* Autotuner launch for kernels whose arguments do not depend on the
+ * configuration.
+ */
+int run_tune_launch(cl_command_queue queue, cl_kernel kernel, const struct tune_config *cfg, void *arg)
+{
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &cfg->global_size, &cfg->local_size, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+		return err;
+
+	return clFinish(queue);
+}
+
+/* Push the inputs to the device, run the kernel and pull the outputs back
+ * through the buffer layer, so copy and zero-copy transfer costs can be
+ * compared.
+ */
+#define ROUND_TRIP_MAX_BUFFERS 4
+
+struct buffer_round_trip
+{
+	struct kernel_launch *launch;
+	struct host_buffer *inputs[ROUND_TRIP_MAX_BUFFERS];
+	int num_inputs;
+	struct host_buffer *outputs[ROUND_TRIP_MAX_BUFFERS];
+	int num_outputs;
+};
+
+void run_buffer_round_trip(void *arg)
+{
+	struct buffer_round_trip *rt = (struct buffer_round_trip *) arg;
+	int i;
+
+	for (i = 0; i < rt->num_inputs; i++)
+	{
+		buffer_map(rt->inputs[i], rt->launch->queue, CL_MAP_WRITE);
+		buffer_unmap(rt->inputs[i], rt->launch->queue);
+	}
+
+	run_kernel_launch(rt->launch);
+
+	for (i = 0; i < rt->num_outputs; i++)
+	{
+		buffer_map(rt->outputs[i], rt->launch->queue, CL_MAP_READ);
+		buffer_unmap(rt->outputs[i], rt->launch->queue);
+	}
+}
+
+/* Native CPU baselines, timed with cpu_bench() across every instruction
+ * set and thread count.
+ */
+struct native_arg
+{
+	const void *src;
+	const float *x;
+	float *y;
+	size_t m;
+	size_t n;
+	const char *keys;
+	const cl_uint *offsets;
+	unsigned int *hashes;
+};
+
+void run_native_min(void *arg)
+{
+	struct native_arg *a = (struct native_arg *) arg;
+	cpu_min_uint((const cl_uint *) a->src, a->n);
+}
+
+void run_native_sum(void *arg)
+{
+	struct native_arg *a = (struct native_arg *) arg;
+	cpu_sum_int((const int *) a->src, a->n);
+}
+
+void run_native_sgemv(void *arg)
+{
+	struct native_arg *a = (struct native_arg *) arg;
+	cpu_sgemv(a->m, a->n, (const float *) a->src, a->x, a->y);
+}
+
+void run_native_hash(void *arg)
+{
+	struct native_arg *a = (struct native_arg *) arg;
+	cpu_hash_keys_csr(a->keys, a->offsets, a->n, 0, a->hashes);
+}
+
+/* Each get_ids readback checks its own array as soon as it lands. */
+struct get_ids_check
+{
+	const int *ids;
+	int divisor;
+	int modulus;
+	int correct;
+};
+
+static void get_ids_read_done(int node, void *arg)
+{
+	struct get_ids_check *check = (struct get_ids_check *) arg;
+	int i;
+
+	check->correct = 1;
+	for (i = 0; i < GLOBAL_SIZE; i++)
+		if (check->ids[i] != (check->modulus ? (i / check->divisor) % check->modulus : i / check->divisor))
+			check->correct = 0;
+}
+
 void run_get_ids(cl_context context, cl_command_queue queue, cl_program program)
 {
 	cl_int err;
 	cl_kernel kernel;
-	cl_event ev[5];
-	cl_mem global_ids_buf;
-	cl_mem group_ids_buf;
-	cl_mem local_ids_buf;
-	int global_ids[GLOBAL_SIZE];
-	int group_ids[GLOBAL_SIZE];
-	int local_ids[GLOBAL_SIZE];
+	cl_device_id device;
+	struct graph graph;
+	struct host_buffer global_ids_buf;
+	struct host_buffer group_ids_buf;
+	struct host_buffer local_ids_buf;
+	int *global_ids;
+	int *group_ids;
+	int *local_ids;
 	size_t global_size = GLOBAL_SIZE;
 	size_t local_size = LOCAL_SIZE;
+	struct kernel_launch launch;
+	struct buffer_round_trip round_trip;
+	struct get_ids_check checks[3];
+	int kernel_node;
 	int i;
 
+	global_ids = (int *) malloc(GLOBAL_SIZE*sizeof(int));
+	group_ids = (int *) malloc(GLOBAL_SIZE*sizeof(int));
+	local_ids = (int *) malloc(GLOBAL_SIZE*sizeof(int));
+
+	if (global_ids == NULL || group_ids == NULL || local_ids == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
 	/* Create buffers. */
-	global_ids_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, GLOBAL_SIZE*sizeof(int), global_ids, &err);
-	group_ids_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, GLOBAL_SIZE*sizeof(int), group_ids, &err);
-	local_ids_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, GLOBAL_SIZE*sizeof(int), local_ids, &err);
-	CL_CHECK_ERR(err);
+	buffer_create(&global_ids_buf, context, CL_MEM_READ_WRITE, GLOBAL_SIZE*sizeof(int), "get_ids global_ids");
+	buffer_create(&group_ids_buf, context, CL_MEM_READ_WRITE, GLOBAL_SIZE*sizeof(int), "get_ids group_ids");
+	buffer_create(&local_ids_buf, context, CL_MEM_READ_WRITE, GLOBAL_SIZE*sizeof(int), "get_ids local_ids");
 	
 	/* Create kernel. */
 	kernel = clCreateKernel(program, "get_ids", &err);
 	CL_CHECK_ERR(err);
 	
-	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &global_ids_buf);
-	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &group_ids_buf);
-	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &local_ids_buf);
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &global_ids_buf.mem);
+	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &group_ids_buf.mem);
+	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &local_ids_buf.mem);
 	CL_CHECK_ERR(err);
 
-	/* Enqueue kernel. */
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev[0]); 
-	CL_CHECK_ERR(err);
-	
-	/* Copy the output. */
-	err = clEnqueueReadBuffer(queue, global_ids_buf, CL_FALSE, 0, GLOBAL_SIZE*sizeof(int), global_ids, 0, NULL, &ev[1]);
-	err = clEnqueueReadBuffer(queue, group_ids_buf, CL_FALSE, 0, GLOBAL_SIZE*sizeof(int), group_ids, 0, NULL, &ev[2]);
-	err = clEnqueueReadBuffer(queue, local_ids_buf, CL_FALSE, 0, GLOBAL_SIZE*sizeof(int), local_ids, 0, NULL, &ev[3]);
-	CL_CHECK_ERR(err);
+	memset(checks, 0, sizeof(checks));
+	checks[0].ids = global_ids;
+	checks[0].divisor = 1;
+	checks[0].modulus = 0;
+	checks[1].ids = group_ids;
+	checks[1].divisor = LOCAL_SIZE;
+	checks[1].modulus = 0;
+	checks[2].ids = local_ids;
+	checks[2].divisor = 1;
+	checks[2].modulus = LOCAL_SIZE;
 
-	err = clWaitForEvents(4, ev);
+	/* The three readbacks only depend on the kernel, not on each other. */
+	err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
 	CL_CHECK_ERR(err);
+	graph_init(&graph, context, device, 3);
 
-	err = clReleaseEvent(ev[0]);
-	err = clReleaseEvent(ev[1]);
-	err = clReleaseEvent(ev[2]);
-	err = clReleaseEvent(ev[3]);
-	CL_CHECK_ERR(err);
+	kernel_node = graph_kernel(&graph, "get_ids", kernel, 1, &global_size, &local_size, NULL, 0);
+	graph_on_complete(&graph, graph_read(&graph, "get_ids read global_ids", global_ids_buf.mem, 0, GLOBAL_SIZE*sizeof(int), global_ids, &kernel_node, 1), get_ids_read_done, &checks[0]);
+	graph_on_complete(&graph, graph_read(&graph, "get_ids read group_ids", group_ids_buf.mem, 0, GLOBAL_SIZE*sizeof(int), group_ids, &kernel_node, 1), get_ids_read_done, &checks[1]);
+	graph_on_complete(&graph, graph_read(&graph, "get_ids read local_ids", local_ids_buf.mem, 0, GLOBAL_SIZE*sizeof(int), local_ids, &kernel_node, 1), get_ids_read_done, &checks[2]);
 
-	clFinish(queue); // should be unnecessary since we're waiting for events above
+	graph_wait(&graph);
+	graph_release(&graph);
 
 	/* Print result. */
-	for (i = 0; i < GLOBAL_SIZE; i++)
+	for (i = 0; verbose && i < GLOBAL_SIZE; i++)
 		printf("global_id = %d group_id = %d local_id = %d\n", global_ids[i], group_ids[i], local_ids[i]);
 
+	if (bench_check(checks[0].correct && checks[1].correct && checks[2].correct))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	/* Benchmark the kernel on its own, then with transfers. */
+	launch.name = "get_ids";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size = global_size;
+	launch.local_size = local_size;
+	bench_run("get_ids", run_kernel_launch, &launch, 3.0 * global_size * sizeof(int), (double) global_size);
+
+	round_trip.launch = &launch;
+	round_trip.num_inputs = 0;
+	round_trip.outputs[0] = &global_ids_buf;
+	round_trip.outputs[1] = &group_ids_buf;
+	round_trip.outputs[2] = &local_ids_buf;
+	round_trip.num_outputs = 3;
+	bench_run("get_ids round trip", run_buffer_round_trip, &round_trip, 3.0 * global_size * sizeof(int), (double) global_size);
+
 	/* Clean up. */
-	err = clReleaseMemObject(global_ids_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(group_ids_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(local_ids_buf); CL_CHECK_ERR(err);
+	buffer_release(&global_ids_buf);
+	buffer_release(&group_ids_buf);
+	buffer_release(&local_ids_buf);
 	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+
+	free(global_ids);
+	free(group_ids);
+	free(local_ids);
 }
 
-void run_sum_numbers(cl_context context, cl_command_queue queue, cl_program program)
+/* Sums an n x n matrix of ones; n is rounded up to a multiple of
+ * LOCAL_SIZE.
+ */
+void run_sum_numbers(cl_context context, cl_command_queue queue, cl_program program, size_t n)
 {
 	cl_int err;
 	cl_kernel kernel;
-	cl_event ev[5];
-	cl_mem numbers_buf;
-	cl_mem sums_buf;
+	cl_event ev;
+	struct host_buffer numbers_buf;
+	struct host_buffer sums_buf;
 	int *numbers;
 	int *sums;
 	int total;
-	size_t global_size = GLOBAL_SIZE;
+	size_t global_size = round_up(n, LOCAL_SIZE);
 	size_t local_size = LOCAL_SIZE;
 	size_t num_groups = (global_size / local_size);
+	struct kernel_launch launch;
+	struct buffer_round_trip round_trip;
+	struct native_arg native;
+	struct bench_result *r, *best;
 	unsigned int i;
 
 	/* Create buffers. */
-	numbers = (int *) malloc(global_size * global_size * sizeof(int));
-	sums = (int *) malloc(num_groups * sizeof(int));
-	
-	if (numbers == NULL || sums == NULL)
-	{
-		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
-		exit(1);
-	}
+	buffer_create(&numbers_buf, context, CL_MEM_READ_ONLY, global_size * global_size * sizeof(int), "sum_numbers numbers");
+	buffer_create(&sums_buf, context, CL_MEM_READ_WRITE, num_groups * sizeof(int), "sum_numbers sums");
 
+	/* Fill the input in place. */
+	numbers = (int *) buffer_map(&numbers_buf, queue, CL_MAP_WRITE);
 	for (i = 0; i < global_size * global_size; i++)
 		numbers[i] = 1;
-
-	for (i = 0; i < global_size; i++)
-		sums[i] = 0;
-
-	numbers_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, global_size * global_size * sizeof(float), numbers, &err);
-	sums_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, num_groups * sizeof(float), sums, &err);
-	CL_CHECK_ERR(err);
+	buffer_unmap(&numbers_buf, queue);
 
 	/* Create kernel. */
 	kernel = clCreateKernel(program, "sum_numbers", &err);
 	CL_CHECK_ERR(err);
 	
-	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &numbers_buf);
-	err = clSetKernelArg(kernel, 1, local_size * sizeof(float), NULL);
-	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &sums_buf);
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &numbers_buf.mem);
+	err = clSetKernelArg(kernel, 1, local_size * sizeof(int), NULL);
+	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &sums_buf.mem);
 	CL_CHECK_ERR(err);
 	
 	/* Enqueue kernel. */
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev[0]); 
-	CL_CHECK_ERR(err);
-	
-	/* Copy the output. */
-	err = clEnqueueReadBuffer(queue, sums_buf, CL_FALSE, 0, num_groups * sizeof(float), sums, 0, NULL, &ev[1]);
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev); 
 	CL_CHECK_ERR(err);
 
-	err = clWaitForEvents(2, ev);
+	err = clWaitForEvents(1, &ev);
 	CL_CHECK_ERR(err);
 
-	err = clReleaseEvent(ev[0]);
-	err = clReleaseEvent(ev[1]);
+	prof_event(ev, "sum_numbers", PROF_KERNEL);
+
+	err = clReleaseEvent(ev);
 	CL_CHECK_ERR(err);
-	
-	clFinish(queue); // should be unnecessary since we're waiting for events above
 
 	/* Print result. */
+	sums = (int *) buffer_map(&sums_buf, queue, CL_MAP_READ);
 	total = 0;
 
 	for (i = 0; i < num_groups; i++)
 		total += sums[i];
+	buffer_unmap(&sums_buf, queue);
 	
 	printf("OpenCL sum = %d\n", total);
-	total = 1 * global_size * global_size;
-	printf("Normal sum = %d\n", total);
+	if (bench_check(total == (int) (global_size * global_size)))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	launch.name = "sum_numbers";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size = global_size;
+	launch.local_size = local_size;
+	r = bench_run("sum_numbers", run_kernel_launch, &launch, (double) global_size * global_size * sizeof(int), (double) global_size * global_size);
+
+	numbers = (int *) buffer_map(&numbers_buf, queue, CL_MAP_READ);
+	printf("Native sum = %d\n", cpu_sum_int(numbers, global_size * global_size));
 
-	err = clReleaseMemObject(numbers_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(sums_buf); CL_CHECK_ERR(err);
+	native.src = numbers;
+	native.n = global_size * global_size;
+	best = cpu_bench("sum_numbers", run_native_sum, &native, (double) global_size * global_size * sizeof(int), (double) global_size * global_size);
+	bench_print_speedup(r, best);
+	buffer_unmap(&numbers_buf, queue);
+
+	round_trip.launch = &launch;
+	round_trip.inputs[0] = &numbers_buf;
+	round_trip.num_inputs = 1;
+	round_trip.outputs[0] = &sums_buf;
+	round_trip.num_outputs = 1;
+	bench_run("sum_numbers round trip", run_buffer_round_trip, &round_trip, (double) global_size * global_size * sizeof(int), (double) global_size * global_size);
+
+	buffer_release(&numbers_buf);
+	buffer_release(&sums_buf);
 	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
 }
 
-void run_matrix_multiply(cl_context context, cl_command_queue queue, cl_program program)
+/* CPU references for the dense linear algebra kernels. Accumulate in
+ * double so the comparison is against something more accurate than the
+ * device result.
+ */
+void sgemv_reference(unsigned int m, unsigned int n, const float *a, const float *x, float *y)
+{
+	unsigned int i, j;
+	double sum;
+
+	for (i = 0; i < m; i++)
+	{
+		sum = 0.0;
+		for (j = 0; j < n; j++)
+			sum += (double) a[(size_t) i * n + j] * x[j];
+		y[i] = (float) sum;
+	}
+}
+
+void sgemm_reference(unsigned int m, unsigned int n, unsigned int k, const float *a, const float *b, float *c)
+{
+	unsigned int i, j, l;
+	double *row;
+
+	row = (double *) malloc(n * sizeof(double));
+	if (row == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < m; i++)
+	{
+		for (j = 0; j < n; j++)
+			row[j] = 0.0;
+
+		for (l = 0; l < k; l++)
+			for (j = 0; j < n; j++)
+				row[j] += (double) a[(size_t) i * k + l] * b[(size_t) l * n + j];
+
+		for (j = 0; j < n; j++)
+			c[(size_t) i * n + j] = (float) row[j];
+	}
+
+	free(row);
+}
+
+/* Compare with a relative tolerance, printing the first mismatch.
+ */
+int floats_match(const float *got, const float *want, size_t num)
+{
+	size_t i;
+	double diff, scale;
+
+	for (i = 0; i < num; i++)
+	{
+		diff = fabs((double) got[i] - want[i]);
+		scale = fabs((double) want[i]) > 1.0 ? fabs((double) want[i]) : 1.0;
+		if (diff / scale > 1e-3)
+		{
+			printf("mismatch at %u: got %f, expected %f\n", (unsigned int) i, got[i], want[i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Small deterministic values in [-1, 1) so sums stay well conditioned. */
+void fill_floats(float *p, size_t num, cl_uint seed)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		p[i] = (float) (seed >> 8) / (float) (1 << 23) - 1.0f;
+	}
+}
+
+/* c = aa b for an n x n matrix; n is rounded up to a multiple of
+ * LOCAL_SIZE.
+ */
+void run_matrix_multiply(cl_context context, cl_command_queue queue, cl_program program, unsigned int n)
 {
 	cl_int err;
 	cl_kernel kernel;
-	cl_event ev[5];
-	cl_mem aa_buf;
-	cl_mem b_buf;
-	cl_mem c_buf;
+	cl_event ev;
+	struct host_buffer aa_buf;
+	struct host_buffer b_buf;
+	struct host_buffer c_buf;
 	float *aa;
 	float *b;
 	float *c;
-	size_t global_size = GLOBAL_SIZE;
+	float *ref;
+	size_t global_size;
 	size_t local_size = LOCAL_SIZE;
-	cl_uint i, j;
-	unsigned int n;
+	struct kernel_launch launch;
+	struct buffer_round_trip round_trip;
+	struct native_arg native;
+	struct bench_result *r, *best;
+	cl_uint i;
 	
 	/* Create buffers. */
-	n = GLOBAL_SIZE;
+	n = (unsigned int) round_up(n, LOCAL_SIZE);
+	global_size = n;
 	
-	aa = (float *) malloc(n * n * sizeof(float));
-	b = (float *) malloc(n * sizeof(float));
-	c = (float *) malloc(n * sizeof(float));
-
-	if (aa == NULL || b == NULL || c == NULL)
+	ref = (float *) malloc(n * sizeof(float));
+	if (ref == NULL)
 	{
 		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
 		exit(1);
 	}
 
-	for (i = 0; i < GLOBAL_SIZE; i++)
-	{
-		for(j = 0; j < GLOBAL_SIZE; j++)
-			aa[i*GLOBAL_SIZE+j] = (float) 1.1 * i * j;
+	buffer_create(&aa_buf, context, CL_MEM_READ_ONLY, (size_t) n * n * sizeof(float), "matrix_multiply aa");
+	buffer_create(&b_buf, context, CL_MEM_READ_ONLY, n * sizeof(float), "matrix_multiply b");
+	buffer_create(&c_buf, context, CL_MEM_READ_WRITE, n * sizeof(float), "matrix_multiply c");
 
-		b[i] = (float) 2.2 * i;
-		c[i] = (float) 0.0;
-	}
+	/* Fill the inputs in place. */
+	aa = (float *) buffer_map(&aa_buf, queue, CL_MAP_WRITE);
+	b = (float *) buffer_map(&b_buf, queue, CL_MAP_WRITE);
 
-	aa_buf = clCreateBuffer(context, CL_MEM_USE_HOST_PTR, GLOBAL_SIZE * GLOBAL_SIZE * sizeof(float), aa, &err);
-	b_buf = clCreateBuffer(context, CL_MEM_USE_HOST_PTR, GLOBAL_SIZE * sizeof(float), b, &err);
-	c_buf = clCreateBuffer(context, CL_MEM_USE_HOST_PTR, GLOBAL_SIZE * sizeof(float), c, &err);
-	CL_CHECK_ERR(err);
+	host_fill_matrix(aa, b, n);
+	sgemv_reference(n, n, aa, b, ref);
+
+	buffer_unmap(&aa_buf, queue);
+	buffer_unmap(&b_buf, queue);
 	
 	/* Create kernel. */
 	kernel = clCreateKernel(program, "matrix_multiply", &err);
 	CL_CHECK_ERR(err);
 	
 	err = clSetKernelArg(kernel, 0, sizeof(cl_uint), &n);
-	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &aa_buf);
-	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &b_buf);
-	err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &c_buf);
+	err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &aa_buf.mem);
+	err = clSetKernelArg(kernel, 2, sizeof(cl_mem), &b_buf.mem);
+	err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &c_buf.mem);
 	CL_CHECK_ERR(err);
 	
 	/* Enqueue kernel. */
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev[0]); 
-	CL_CHECK_ERR(err);
-	
-	/* Copy the output. */
-	err = clEnqueueReadBuffer(queue, c_buf, CL_FALSE, 0, GLOBAL_SIZE * sizeof(float), c, 0, NULL, &ev[1]);
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev); 
 	CL_CHECK_ERR(err);
 
-	err = clWaitForEvents(2, ev);
+	err = clWaitForEvents(1, &ev);
 	CL_CHECK_ERR(err);
 
-	err = clReleaseEvent(ev[0]);
-	err = clReleaseEvent(ev[1]);
+	prof_event(ev, "matrix_multiply", PROF_KERNEL);
+
+	err = clReleaseEvent(ev);
 	CL_CHECK_ERR(err);
 	
-	clFinish(queue); // should be unnecessary since we're waiting for events above
-	
 	/* Print result. */
+	c = (float *) buffer_map(&c_buf, queue, CL_MAP_READ);
 	
-	for(i = 0; i < n; i++)
+	for(i = 0; verbose && i < n; i++)
 		printf("c[%d] %f\n", i, c[i]);
 
-	err = clReleaseMemObject(aa_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(b_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(c_buf); CL_CHECK_ERR(err);
-	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
-	
-	free(aa);
-	free(b);
-	free(c);
-}
+	if (bench_check(floats_match(c, ref, n)))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
 
-#define KEY_LEN 100
+	buffer_unmap(&c_buf, queue);
 
-#define l3_rotate(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+	launch.name = "matrix_multiply";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size = global_size;
+	launch.local_size = local_size;
+	r = bench_run("matrix_multiply", run_kernel_launch, &launch, ((double) n * n + 2.0 * n) * sizeof(float), (double) n * n);
 
-#define l3_mix(a, b, c) \
-{ \
-	a -= c; a ^= l3_rotate(c, 4); c += b; \
-	b -= a; b ^= l3_rotate(a, 6); a += c; \
-	c -= b; c ^= l3_rotate(b, 8); b += a; \
-	a -= c; a ^= l3_rotate(c,16); c += b; \
-	b -= a; b ^= l3_rotate(a,19); a += c; \
-	c -= b; c ^= l3_rotate(b, 4); b += a; \
-}
+	native.src = buffer_map(&aa_buf, queue, CL_MAP_READ);
+	native.x = (const float *) buffer_map(&b_buf, queue, CL_MAP_READ);
+	native.y = ref;
+	native.m = n;
+	native.n = n;
+	best = cpu_bench("matrix_multiply", run_native_sgemv, &native, ((double) n * n + 2.0 * n) * sizeof(float), (double) n * n);
+	bench_print_speedup(r, best);
+	buffer_unmap(&aa_buf, queue);
+	buffer_unmap(&b_buf, queue);
 
-#define l3_final(a,b,c) \
-{ \
-  c ^= b; c -= l3_rotate(b,14); \
-  a ^= c; a -= l3_rotate(c,11); \
-  b ^= a; b -= l3_rotate(a,25); \
-  c ^= b; c -= l3_rotate(b,16); \
-  a ^= c; a -= l3_rotate(c,4);  \
-  b ^= a; b -= l3_rotate(a,14); \
-  c ^= b; c -= l3_rotate(b,24); \
-}
+	round_trip.launch = &launch;
+	round_trip.inputs[0] = &aa_buf;
+	round_trip.inputs[1] = &b_buf;
+	round_trip.num_inputs = 2;
+	round_trip.outputs[0] = &c_buf;
+	round_trip.num_outputs = 1;
+	bench_run("matrix_multiply round trip", run_buffer_round_trip, &round_trip, ((double) n * n + 2.0 * n) * sizeof(float), (double) n * n);
 
-unsigned int lookup3(char *key, int len, int seed)
-{
-	unsigned int a, b, c;
-	char *k8;
-	unsigned int *k;
+	buffer_release(&aa_buf);
+	buffer_release(&b_buf);
+	buffer_release(&c_buf);
+	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
 	
-	a = b = c = 0xdeadbeef + (((unsigned int) len) << 2) + seed;
-	k = (unsigned int *) key;
-
-	while (len > 12)
-	{
-		a += k[0];
-		b += k[1];
-		c += k[2];
-		l3_mix(a,b,c);
-		len -= 12;
-		k += 3;
-	}
-
-	k8 = (char *) k;
-
-    switch(len)
-    {
-		case 12:
-			c+=k[4]+(((unsigned int)k[5])<<16);
-			b+=k[2]+(((unsigned int)k[3])<<16);
-			a+=k[0]+(((unsigned int)k[1])<<16);
-		break;
-		case 11:
-			c+=((unsigned int)k8[10])<<16; // fall through
-		case 10:
-			c+=k[4];
-			b+=k[2]+(((unsigned int)k[3])<<16);
-			a+=k[0]+(((unsigned int)k[1])<<16);
-		break;
-		case 9:
-			c+=k8[8]; // fall through
-		case 8:
-			b+=k[2]+(((unsigned int)k[3])<<16);
-			a+=k[0]+(((unsigned int)k[1])<<16);
-		break;
-		case 7:
-			b+=((unsigned int)k8[6])<<16; // fall through
-		case 6:
-			b+=k[2];
-			a+=k[0]+(((unsigned int)k[1])<<16);
-		break;
-		case 5:
-			b+=k8[4]; // fall through
-		case 4:
-			a+=k[0]+(((unsigned int)k[1])<<16);
-		break;
-		case 3:
-			a+=((unsigned int)k8[2])<<16; // fall through
-		case 2:
-			a+=k[0];
-		break;
-		case 1:
-			a+=k8[0];
-			break;
-		case 0:
-			return c; // zero length requires no mixing
-    }
-
-	l3_final(a, b, c);
-	return c;
+	free(ref);
 }
 
-void run_hash_test(cl_context context, cl_command_queue queue, cl_program program)
+#define SGEMV_LOCAL_SIZE 64
+
+void run_sgemv(cl_context context, cl_command_queue queue, cl_program program, unsigned int m, unsigned int n)
 {
 	cl_int err;
 	cl_kernel kernel;
-	cl_event ev[5];
-	cl_mem keys_buf;
-	cl_mem hashes_buf;
-	char *keys;
-	unsigned int len = KEY_LEN;
-	unsigned int seed = 0;
-	unsigned int *hashes;
-	size_t global_size = GLOBAL_SIZE;
-	size_t local_size = LOCAL_SIZE;
-	char *charset = "abcdefghijklmnopqrstuvwxyz";
-	cl_uint i, l;
-	
-	/* Create buffers. */
-	keys = (char *) malloc(global_size * len * sizeof(char));
-	hashes = (unsigned int *) malloc(global_size * sizeof(int));
+	struct graph graph;
+	int write_nodes[2];
+	int kernel_node;
+	cl_mem a_buf, x_buf, y_buf;
+	float *a, *x, *y, *ref;
+	size_t local_size = SGEMV_LOCAL_SIZE;
+	size_t max_local_size;
+	size_t global_size;
+	struct kernel_launch launch;
+	struct native_arg native;
+	struct bench_result *r, *best;
+	cl_device_id device;
 
-	if (keys == NULL || hashes == NULL)
+	a = (float *) malloc((size_t) m * n * sizeof(float));
+	x = (float *) malloc(n * sizeof(float));
+	y = (float *) malloc(m * sizeof(float));
+	ref = (float *) malloc(m * sizeof(float));
+
+	if (a == NULL || x == NULL || y == NULL || ref == NULL)
 	{
 		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
 		exit(1);
 	}
-	
-	l = strlen(charset);
-	for (i = 0; (i + l) < (global_size * len); i += l)
-		strncpy(&keys[i], charset, l);
-	strncpy(&keys[i], charset, (global_size * len) % l);
-	
-	keys_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, global_size * KEY_LEN * sizeof(char), keys, &err);
-	hashes_buf = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, global_size * sizeof(unsigned int), hashes, &err);
+
+	fill_floats(a, (size_t) m * n, 1);
+	fill_floats(x, n, 2);
+
+	a_buf = clCreateBuffer(context, CL_MEM_READ_ONLY, (size_t) m * n * sizeof(float), NULL, &err);
 	CL_CHECK_ERR(err);
-	
-	/* Create kernel. */
-	kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+	x_buf = clCreateBuffer(context, CL_MEM_READ_ONLY, n * sizeof(float), NULL, &err);
 	CL_CHECK_ERR(err);
-	
-	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &keys_buf);
+	y_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, m * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	kernel = clCreateKernel(program, "sgemv", &err);
+	CL_CHECK_ERR(err);
+
+	/* The reduction needs a power of two that fits the kernel's limit. */
+	clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, NULL);
+	err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local_size, NULL);
+	CL_CHECK_ERR(err);
+	while (local_size > max_local_size)
+		local_size /= 2;
+	global_size = (size_t) m * local_size;
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_uint), &m);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &a_buf);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &x_buf);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &y_buf);
+	err |= clSetKernelArg(kernel, 5, local_size * sizeof(float), NULL);
+	CL_CHECK_ERR(err);
+
+	/* The matrix and vector uploads can overlap; the kernel waits on both. */
+	graph_init(&graph, context, device, 2);
+	write_nodes[0] = graph_write(&graph, "sgemv write a", a_buf, 0, (size_t) m * n * sizeof(float), a, NULL, 0);
+	write_nodes[1] = graph_write(&graph, "sgemv write x", x_buf, 0, n * sizeof(float), x, NULL, 0);
+	kernel_node = graph_kernel(&graph, "sgemv", kernel, 1, &global_size, &local_size, write_nodes, 2);
+	graph_read(&graph, "sgemv read", y_buf, 0, m * sizeof(float), y, &kernel_node, 1);
+	graph_wait(&graph);
+	graph_release(&graph);
+
+	printf("run_sgemv(%u x %u):\n", m, n);
+	sgemv_reference(m, n, a, x, ref);
+	if (bench_check(floats_match(y, ref, m)))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	launch.name = "sgemv";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size = global_size;
+	launch.local_size = local_size;
+	r = bench_run("sgemv", run_kernel_launch, &launch, ((double) m * n + n + m) * sizeof(float), (double) m);
+	if (r->median > 0)
+		printf("sgemv: %.2f GFLOP/sec\n", 2.0 * m * n / r->median / 1e9);
+
+	native.src = a;
+	native.x = x;
+	native.y = ref;
+	native.m = m;
+	native.n = n;
+	best = cpu_bench("sgemv", run_native_sgemv, &native, ((double) m * n + n + m) * sizeof(float), (double) m);
+	bench_print_speedup(r, best);
+
+	err = clReleaseMemObject(a_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(x_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(y_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+
+	free(a);
+	free(x);
+	free(y);
+	free(ref);
+}
+
+/* Must match SGEMM_TS in test.cl. */
+#define SGEMM_TS 16
+
+/* One 2D NDRange launch, run to completion. */
+struct kernel_launch_2d
+{
+	const char *name;
+	cl_command_queue queue;
+	cl_kernel kernel;
+	size_t global_size[2];
+	size_t local_size[2];
+};
+
+void run_kernel_launch_2d(void *arg)
+{
+	struct kernel_launch_2d *launch = (struct kernel_launch_2d *) arg;
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(launch->queue, launch->kernel, 2, NULL, launch->global_size, launch->local_size, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev, launch->name, PROF_KERNEL);
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+}
+
+/* C = A B for any m, n, k. The matrices are zero padded up to multiples of
+ * the tile size, which does not change the product, and only the m x n
+ * corner is compared against the CPU.
+ */
+void run_sgemm(cl_context context, cl_command_queue queue, cl_program program, unsigned int m, unsigned int n, unsigned int k)
+{
+	cl_int err;
+	cl_kernel kernel;
+	cl_event ev[2];
+	cl_mem a_buf, b_buf, c_buf;
+	float *a, *b, *c, *ref;
+	float *ap, *bp, *cp;
+	cl_uint mp, np, kp;
+	cl_uint i;
+	struct kernel_launch_2d launch;
+	struct bench_result *r;
+
+	mp = (cl_uint) round_up(m, SGEMM_TS);
+	np = (cl_uint) round_up(n, SGEMM_TS);
+	kp = (cl_uint) round_up(k, SGEMM_TS);
+
+	a = (float *) malloc((size_t) m * k * sizeof(float));
+	b = (float *) malloc((size_t) k * n * sizeof(float));
+	c = (float *) malloc((size_t) m * n * sizeof(float));
+	ref = (float *) malloc((size_t) m * n * sizeof(float));
+	ap = (float *) calloc((size_t) mp * kp, sizeof(float));
+	bp = (float *) calloc((size_t) kp * np, sizeof(float));
+	cp = (float *) malloc((size_t) mp * np * sizeof(float));
+
+	if (a == NULL || b == NULL || c == NULL || ref == NULL || ap == NULL || bp == NULL || cp == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	fill_floats(a, (size_t) m * k, 3);
+	fill_floats(b, (size_t) k * n, 4);
+
+	for (i = 0; i < m; i++)
+		memcpy(&ap[(size_t) i * kp], &a[(size_t) i * k], k * sizeof(float));
+	for (i = 0; i < k; i++)
+		memcpy(&bp[(size_t) i * np], &b[(size_t) i * n], n * sizeof(float));
+
+	a_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) mp * kp * sizeof(float), ap, &err);
+	CL_CHECK_ERR(err);
+	b_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) kp * np * sizeof(float), bp, &err);
+	CL_CHECK_ERR(err);
+	c_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, (size_t) mp * np * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	kernel = clCreateKernel(program, "sgemm_tiled", &err);
+	CL_CHECK_ERR(err);
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_uint), &mp);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &np);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &kp);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &a_buf);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &b_buf);
+	err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &c_buf);
+	CL_CHECK_ERR(err);
+
+	launch.name = "sgemm_tiled";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size[0] = np / 4;
+	launch.global_size[1] = mp;
+	launch.local_size[0] = SGEMM_TS / 4;
+	launch.local_size[1] = SGEMM_TS;
+
+	err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, launch.global_size, launch.local_size, 0, NULL, &ev[0]);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(queue, c_buf, CL_FALSE, 0, (size_t) mp * np * sizeof(float), cp, 0, NULL, &ev[1]);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(2, ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev[0], "sgemm_tiled", PROF_KERNEL);
+	prof_event(ev[1], "sgemm_tiled read", PROF_READ);
+
+	err = clReleaseEvent(ev[0]);
+	err = clReleaseEvent(ev[1]);
+	CL_CHECK_ERR(err);
+
+	for (i = 0; i < m; i++)
+		memcpy(&c[(size_t) i * n], &cp[(size_t) i * np], n * sizeof(float));
+
+	printf("run_sgemm(%u x %u x %u):\n", m, n, k);
+	sgemm_reference(m, n, k, a, b, ref);
+	if (bench_check(floats_match(c, ref, (size_t) m * n)))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	r = bench_run("sgemm_tiled", run_kernel_launch_2d, &launch, ((double) mp * kp + (double) kp * np + (double) mp * np) * sizeof(float), (double) m * n);
+	if (r->median > 0)
+		printf("sgemm_tiled: %.2f GFLOP/sec\n", 2.0 * m * n * k / r->median / 1e9);
+
+	err = clReleaseMemObject(a_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(b_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(c_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+
+	free(a);
+	free(b);
+	free(c);
+	free(ref);
+	free(ap);
+	free(bp);
+	free(cp);
+}
+
+#define KEY_LEN 100
+
+/* The other hashes run by run_hash_test() on its keys. Interleaved
+ * variants hash the keys_to_soa layout, keys_per_item keys per work-item.
+ * Every variant is a 64-bit hash checked against its host reference.
+ */
+typedef cl_ulong (*hash64_fn)(const void *key, size_t len, unsigned int seed);
+
+struct hash_variant
+{
+	const char *kernel;
+	int interleaved;
+	int keys_per_item;
+	hash64_fn reference;
+};
+
+static const struct hash_variant hash_variants[] =
+{
+	{ "lookup3_hash64_keys", 0, 1, lookup3_64 },
+	{ "xxhash64_keys", 0, 1, xxhash64 },
+	{ "murmur3_x64_keys", 0, 1, murmur3_64 },
+	{ "lookup3_hash64_keys_soa4", 1, 4, lookup3_64 },
+	{ "lookup3_hash64_keys_soa8", 1, 8, lookup3_64 },
+};
+
+#define NUM_HASH_VARIANTS ((int) (sizeof(hash_variants) / sizeof(hash_variants[0])))
+
+struct hash64_ref
+{
+	hash64_fn fn;
+	const char *keys;
+	unsigned int len;
+	unsigned int seed;
+	cl_ulong *hashes;
+};
+
+static void hash64_ref_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct hash64_ref *h = (struct hash64_ref *) arg;
+	size_t i;
+
+	for (i = first; i < first + count; i++)
+		h->hashes[i] = h->fn(&h->keys[i * h->len], h->len, h->seed);
+}
+
+/* num_keys must be a multiple of every keys_per_item. */
+void run_hash_variants(cl_context context, cl_command_queue queue, cl_program program, struct host_buffer *keys_buf, size_t num_keys, unsigned int len, const struct bench_result *baseline)
+{
+	struct kernel_launch launch;
+	struct kernel_launch_2d transpose;
+	struct hash64_ref ref;
+	struct bench_result *r;
+	cl_kernel kernel, transpose_kernel;
+	cl_mem words_buf, hashes_buf;
+	cl_ulong *hashes, *expected;
+	cl_uint n = (cl_uint) num_keys;
+	unsigned int seed = 0;
+	int v;
+	cl_int err;
+
+	hashes = (cl_ulong *) malloc(num_keys * sizeof(cl_ulong));
+	expected = (cl_ulong *) malloc(num_keys * sizeof(cl_ulong));
+	if (hashes == NULL || expected == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	words_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, num_keys * HASH_SOA_WORDS(len) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	hashes_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, num_keys * sizeof(cl_ulong), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	/* The interleaved copy of the keys, made once. */
+	transpose_kernel = clCreateKernel(program, "keys_to_soa", &err);
+	CL_CHECK_ERR(err);
+	err = clSetKernelArg(transpose_kernel, 0, sizeof(cl_mem), &keys_buf->mem);
+	err |= clSetKernelArg(transpose_kernel, 1, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(transpose_kernel, 2, sizeof(cl_uint), &len);
+	err |= clSetKernelArg(transpose_kernel, 3, sizeof(cl_mem), &words_buf);
+	CL_CHECK_ERR(err);
+
+	transpose.name = "keys_to_soa";
+	transpose.queue = queue;
+	transpose.kernel = transpose_kernel;
+	transpose.global_size[0] = num_keys;
+	transpose.global_size[1] = HASH_SOA_WORDS(len);
+	transpose.local_size[0] = LOCAL_SIZE;
+	transpose.local_size[1] = 1;
+	run_kernel_launch_2d(&transpose);
+
+	ref.keys = (const char *) buffer_map(keys_buf, queue, CL_MAP_READ);
+	ref.len = len;
+	ref.seed = seed;
+	ref.hashes = expected;
+
+	launch.queue = queue;
+	launch.local_size = 0;
+
+	for (v = 0; v < NUM_HASH_VARIANTS; v++)
+	{
+		ref.fn = hash_variants[v].reference;
+		pool_for(&host_pool, num_keys, host_threads, hash64_ref_job, &ref);
+
+		kernel = clCreateKernel(program, hash_variants[v].kernel, &err);
+		CL_CHECK_ERR(err);
+
+		if (hash_variants[v].interleaved)
+		{
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &words_buf);
+			err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &n);
+			err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &len);
+			err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &seed);
+			err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &hashes_buf);
+		}
+		else
+		{
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &keys_buf->mem);
+			err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &len);
+			err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
+			err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &hashes_buf);
+		}
+		CL_CHECK_ERR(err);
+
+		launch.name = hash_variants[v].kernel;
+		launch.kernel = kernel;
+		launch.global_size = num_keys / hash_variants[v].keys_per_item;
+		run_kernel_launch(&launch);
+
+		err = clEnqueueReadBuffer(queue, hashes_buf, CL_TRUE, 0, num_keys * sizeof(cl_ulong), hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		printf("%s: result %s\n", hash_variants[v].kernel,
+			bench_check(memcmp(hashes, expected, num_keys * sizeof(cl_ulong)) == 0) ? "correct" : "incorrect");
+
+		r = bench_run(hash_variants[v].kernel, run_kernel_launch, &launch, (double) num_keys * len, (double) num_keys);
+		bench_print_speedup(r, baseline);
+
+		err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+	}
+
+	buffer_unmap(keys_buf, queue);
+
+	err = clReleaseMemObject(words_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(hashes_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(transpose_kernel); CL_CHECK_ERR(err);
+	free(hashes);
+	free(expected);
+}
+
+/* num_keys fixed length keys of len bytes. */
+void run_hash_test(cl_context context, cl_command_queue queue, cl_program program, size_t num_keys, unsigned int len)
+{
+	cl_int err;
+	cl_kernel kernel;
+	cl_event ev;
+	struct host_buffer keys_buf;
+	struct host_buffer hashes_buf;
+	char *keys;
+	unsigned int seed = 0;
+	unsigned int *hashes;
+	size_t global_size = round_up(num_keys, LOCAL_SIZE);
+	size_t local_size = LOCAL_SIZE;
+	char *charset = "abcdefghijklmnopqrstuvwxyz";
+	struct kernel_launch launch;
+	struct buffer_round_trip round_trip;
+	struct tune_config tuned;
+	struct native_arg native;
+	struct bench_result *r, *best;
+	cl_uint *offsets;
+	unsigned int *native_hashes;
+	cl_device_id device;
+	cl_uint i;
+	int ok;
+	
+	/* Create buffers. */
+	buffer_create(&keys_buf, context, CL_MEM_READ_ONLY, global_size * len * sizeof(char), "lookup3_hash_keys keys");
+	buffer_create(&hashes_buf, context, CL_MEM_READ_WRITE, global_size * sizeof(unsigned int), "lookup3_hash_keys hashes");
+
+	/* Fill the keys in place. */
+	keys = (char *) buffer_map(&keys_buf, queue, CL_MAP_WRITE);
+	host_fill_charset(keys, global_size * len, charset);
+	buffer_unmap(&keys_buf, queue);
+	
+	/* Create kernel. */
+	kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+	CL_CHECK_ERR(err);
+	
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &keys_buf.mem);
 	err = clSetKernelArg(kernel, 1, sizeof(unsigned int), &len);
 	err = clSetKernelArg(kernel, 2, sizeof(unsigned int), &seed);
-	err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &hashes_buf);
+	err = clSetKernelArg(kernel, 3, sizeof(cl_mem), &hashes_buf.mem);
+	CL_CHECK_ERR(err);
+	
+	/* Enqueue kernel. */
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev); 
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev, "lookup3_hash_keys", PROF_KERNEL);
+
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+	
+	/* Print result. */
+	printf("run_hash_test():\n");
+
+	keys = (char *) buffer_map(&keys_buf, queue, CL_MAP_READ);
+	hashes = (unsigned int *) buffer_map(&hashes_buf, queue, CL_MAP_READ);
+
+	ok = host_check_hashes(keys, global_size, len, seed, hashes);
+	for (i = 0; verbose && i < global_size; i++)
+		printf("%d: %d %d\n", i, hashes[i], lookup3(&keys[(size_t) i*len], len, seed));
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	buffer_unmap(&keys_buf, queue);
+	buffer_unmap(&hashes_buf, queue);
+
+	launch.name = "lookup3_hash_keys";
+	launch.queue = queue;
+	launch.kernel = kernel;
+	launch.global_size = global_size;
+	launch.local_size = local_size;
+
+	/* One key per work-item, so only the local size is tuned. */
+	clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, NULL);
+	if (autotune_kernel(queue, device, kernel, "lookup3_hash_keys", global_size, 1, run_tune_launch, NULL, &tuned))
+		launch.local_size = tuned.local_size;
+
+	r = bench_run("lookup3_hash_keys", run_kernel_launch, &launch, (double) global_size * len, (double) global_size);
+
+	/* Fixed length keys are CSR keys with evenly spaced offsets. */
+	offsets = (cl_uint *) malloc((global_size + 1) * sizeof(cl_uint));
+	native_hashes = (unsigned int *) malloc(global_size * sizeof(unsigned int));
+	if (offsets == NULL || native_hashes == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i <= global_size; i++)
+		offsets[i] = i * len;
+
+	native.keys = (const char *) buffer_map(&keys_buf, queue, CL_MAP_READ);
+	native.offsets = offsets;
+	native.hashes = native_hashes;
+	native.n = global_size;
+	best = cpu_bench("lookup3_hash_keys", run_native_hash, &native, (double) global_size * len, (double) global_size);
+	bench_print_speedup(r, best);
+	buffer_unmap(&keys_buf, queue);
+
+	free(offsets);
+	free(native_hashes);
+
+	round_trip.launch = &launch;
+	round_trip.inputs[0] = &keys_buf;
+	round_trip.num_inputs = 1;
+	round_trip.outputs[0] = &hashes_buf;
+	round_trip.num_outputs = 1;
+	bench_run("lookup3_hash_keys round trip", run_buffer_round_trip, &round_trip, (double) global_size * len, (double) global_size);
+
+	/* 64-bit and multi-key variants on the same keys. */
+	run_hash_variants(context, queue, program, &keys_buf, global_size, len, r);
+
+	/* Clean up. */
+	buffer_release(&keys_buf);
+	buffer_release(&hashes_buf);
+	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+}
+
+/* Variable-length batch hashing. Keys are random lowercase strings of
+ * HASH_MIN_KEY_LEN to HASH_MAX_KEY_LEN bytes, roughly the shape of URLs and
+ * record IDs.
+ */
+#define HASH_MIN_KEY_LEN 4
+#define HASH_MAX_KEY_LEN 128
+
+/* lookup3 over fixed length keys packed (lookup3_hash_keys) and
+ * interleaved (lookup3_hash_keys_soa) at each key length, with the
+ * transpose between the two timed on its own.
+ */
+void run_hash_soa_test(cl_context context, cl_command_queue queue, cl_program program, size_t num_keys)
+{
+	static const unsigned int key_lens[] = { 4, 12, 16, 32, 64, 100, 256 };
+	unsigned int max_len = key_lens[sizeof(key_lens) / sizeof(key_lens[0]) - 1];
+	struct kernel_launch launch;
+	struct kernel_launch_2d transpose;
+	struct bench_result *aos, *soa;
+	cl_kernel aos_kernel, soa_kernel, transpose_kernel;
+	cl_mem keys_buf, words_buf, hashes_buf;
+	cl_uint *key_words, *words, *ref_words;
+	unsigned int *hashes;
+	cl_uint n, seed = 0;
+	size_t s, key_bytes, num_words;
+	unsigned int len;
+	char name[64];
+	int ok = 1;
+	cl_int err;
+
+	num_keys = round_up(num_keys, LOCAL_SIZE);
+	n = (cl_uint) num_keys;
+
+	/* Keys are filled a word at a time. */
+	key_words = (cl_uint *) malloc(round_up(num_keys * max_len, 4));
+	words = (cl_uint *) malloc(num_keys * HASH_SOA_WORDS(max_len) * sizeof(cl_uint));
+	ref_words = (cl_uint *) malloc(num_keys * HASH_SOA_WORDS(max_len) * sizeof(cl_uint));
+	hashes = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	if (key_words == NULL || words == NULL || ref_words == NULL || hashes == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("run_hash_soa_test(): %lu keys\n", (unsigned long) num_keys);
+
+	aos_kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+	CL_CHECK_ERR(err);
+	soa_kernel = clCreateKernel(program, "lookup3_hash_keys_soa", &err);
+	CL_CHECK_ERR(err);
+	transpose_kernel = clCreateKernel(program, "keys_to_soa", &err);
+	CL_CHECK_ERR(err);
+
+	for (s = 0; s < sizeof(key_lens) / sizeof(key_lens[0]); s++)
+	{
+		len = key_lens[s];
+		key_bytes = num_keys * len;
+		num_words = num_keys * HASH_SOA_WORDS(len);
+
+		host_fill_lcg(key_words, round_up(key_bytes, 4) / 4, 12345 + len);
+		hash_keys_to_soa((const char *) key_words, num_keys, len, ref_words);
+
+		keys_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, key_bytes, key_words, &err);
+		CL_CHECK_ERR(err);
+		words_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, num_words * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+		hashes_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, num_keys * sizeof(unsigned int), NULL, &err);
+		CL_CHECK_ERR(err);
+
+		err = clSetKernelArg(aos_kernel, 0, sizeof(cl_mem), &keys_buf);
+		err |= clSetKernelArg(aos_kernel, 1, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(aos_kernel, 2, sizeof(cl_uint), &seed);
+		err |= clSetKernelArg(aos_kernel, 3, sizeof(cl_mem), &hashes_buf);
+		err |= clSetKernelArg(transpose_kernel, 0, sizeof(cl_mem), &keys_buf);
+		err |= clSetKernelArg(transpose_kernel, 1, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(transpose_kernel, 2, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(transpose_kernel, 3, sizeof(cl_mem), &words_buf);
+		err |= clSetKernelArg(soa_kernel, 0, sizeof(cl_mem), &words_buf);
+		err |= clSetKernelArg(soa_kernel, 1, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(soa_kernel, 2, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(soa_kernel, 3, sizeof(cl_uint), &seed);
+		err |= clSetKernelArg(soa_kernel, 4, sizeof(cl_mem), &hashes_buf);
+		CL_CHECK_ERR(err);
+
+		launch.queue = queue;
+		launch.global_size = num_keys;
+		launch.local_size = LOCAL_SIZE;
+
+		/* Packed. */
+		snprintf(name, sizeof(name), "lookup3 packed len %u", len);
+		launch.name = name;
+		launch.kernel = aos_kernel;
+		run_kernel_launch(&launch);
+
+		err = clEnqueueReadBuffer(queue, hashes_buf, CL_TRUE, 0, num_keys * sizeof(unsigned int), hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		if (!host_check_hashes((const char *) key_words, num_keys, len, seed, hashes))
+			ok = 0;
+
+		aos = bench_run(name, run_kernel_launch, &launch, (double) key_bytes, (double) num_keys);
+
+		/* Transpose. */
+		snprintf(name, sizeof(name), "keys_to_soa len %u", len);
+		transpose.name = name;
+		transpose.queue = queue;
+		transpose.kernel = transpose_kernel;
+		transpose.global_size[0] = num_keys;
+		transpose.global_size[1] = HASH_SOA_WORDS(len);
+		transpose.local_size[0] = LOCAL_SIZE;
+		transpose.local_size[1] = 1;
+		run_kernel_launch_2d(&transpose);
+
+		err = clEnqueueReadBuffer(queue, words_buf, CL_TRUE, 0, num_words * sizeof(cl_uint), words, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		if (memcmp(words, ref_words, num_words * sizeof(cl_uint)) != 0)
+			ok = 0;
+
+		bench_run(name, run_kernel_launch_2d, &transpose, (double) key_bytes + num_words * sizeof(cl_uint), (double) num_keys);
+
+		/* Interleaved. */
+		memset(hashes, 0, num_keys * sizeof(unsigned int));
+		err = clEnqueueWriteBuffer(queue, hashes_buf, CL_TRUE, 0, num_keys * sizeof(unsigned int), hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		snprintf(name, sizeof(name), "lookup3 soa len %u", len);
+		launch.name = name;
+		launch.kernel = soa_kernel;
+		run_kernel_launch(&launch);
+
+		err = clEnqueueReadBuffer(queue, hashes_buf, CL_TRUE, 0, num_keys * sizeof(unsigned int), hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		if (!host_check_hashes((const char *) key_words, num_keys, len, seed, hashes))
+			ok = 0;
+
+		soa = bench_run(name, run_kernel_launch, &launch, (double) num_words * sizeof(cl_uint), (double) num_keys);
+		bench_print_speedup(soa, aos);
+
+		err = clReleaseMemObject(keys_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(words_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(hashes_buf); CL_CHECK_ERR(err);
+	}
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	err = clReleaseKernel(aos_kernel); CL_CHECK_ERR(err);
+	err = clReleaseKernel(soa_kernel); CL_CHECK_ERR(err);
+	err = clReleaseKernel(transpose_kernel); CL_CHECK_ERR(err);
+
+	free(key_words);
+	free(words);
+	free(ref_words);
+	free(hashes);
+}
+
+struct hash_batch_bench
+{
+	struct hash_batch *hb;
+	const char *keys;
+	const cl_uint *offsets;
+	size_t num_keys;
+	unsigned int *hashes;
+	cl_ulong *hashes64;
+};
+
+void run_hash_cpu(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash_keys_csr(a->keys, a->offsets, a->num_keys, 0, a->hashes);
+}
+
+void run_hash64_cpu(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash64_keys_csr(a->keys, a->offsets, a->num_keys, 0, a->hashes64);
+}
+
+void run_hash_batch_kernel(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash_batch_enqueue(a->hb, a->num_keys, 0, 0);
+}
+
+void run_hash64_batch_kernel(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash_batch_enqueue(a->hb, a->num_keys, 0, 1);
+}
+
+void run_hash_batch_call(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash_batch_run(a->hb, a->keys, a->offsets, a->num_keys, 0, a->hashes);
+}
+
+void run_hash64_batch_call(void *arg)
+{
+	struct hash_batch_bench *a = (struct hash_batch_bench *) arg;
+	hash_batch_run64(a->hb, a->keys, a->offsets, a->num_keys, 0, a->hashes64);
+}
+
+void make_csr_keys(size_t num_keys, char **keys, cl_uint **offsets)
+{
+	char *charset = "abcdefghijklmnopqrstuvwxyz";
+	unsigned int r = 12345;
+	size_t i, total;
+	cl_uint len;
+
+	*offsets = (cl_uint *) malloc((num_keys + 1) * sizeof(cl_uint));
+	if (*offsets == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	total = 0;
+	for (i = 0; i < num_keys; i++)
+	{
+		r = r * 1103515245 + 12345;
+		len = HASH_MIN_KEY_LEN + (r >> 16) % (HASH_MAX_KEY_LEN - HASH_MIN_KEY_LEN + 1);
+		(*offsets)[i] = (cl_uint) total;
+		total += len;
+	}
+	(*offsets)[num_keys] = (cl_uint) total;
+
+	*keys = (char *) malloc(total);
+	if (*keys == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (i = 0; i < total; i++)
+	{
+		r = r * 1103515245 + 12345;
+		(*keys)[i] = charset[(r >> 16) % 26];
+	}
+}
+
+void run_hash_batch(cl_context context, cl_command_queue queue, cl_program program, size_t num_keys)
+{
+	struct hash_batch hb;
+	struct hash_batch_bench arg;
+	struct native_arg native;
+	struct bench_result *r, *best;
+	char *keys;
+	cl_uint *offsets;
+	unsigned int *hashes, *ref;
+	cl_ulong *hashes64, *ref64;
+	double bytes;
+	size_t i;
+	int ok;
+
+	make_csr_keys(num_keys, &keys, &offsets);
+	bytes = (double) offsets[num_keys];
+
+	hashes = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	ref = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	hashes64 = (cl_ulong *) malloc(num_keys * sizeof(cl_ulong));
+	ref64 = (cl_ulong *) malloc(num_keys * sizeof(cl_ulong));
+	if (hashes == NULL || ref == NULL || hashes64 == NULL || ref64 == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("run_hash_batch(): %lu keys, %.1f MB\n", (unsigned long) num_keys, bytes / (1 << 20));
+
+	/* Reference hashes on the host. */
+	hash_keys_csr(keys, offsets, num_keys, 0, ref);
+	hash64_keys_csr(keys, offsets, num_keys, 0, ref64);
+
+	hash_batch_init(&hb, context, queue, program);
+	hash_batch_run(&hb, keys, offsets, num_keys, 0, hashes);
+	hash_batch_run64(&hb, keys, offsets, num_keys, 0, hashes64);
+
+	ok = 1;
+	for (i = 0; i < num_keys; i++)
+	{
+		if (hashes[i] != ref[i] || hashes64[i] != ref64[i])
+		{
+			ok = 0;
+			break;
+		}
+	}
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	arg.hb = &hb;
+	arg.keys = keys;
+	arg.offsets = offsets;
+	arg.num_keys = num_keys;
+	arg.hashes = hashes;
+	arg.hashes64 = hashes64;
+
+	/* Keys/sec and bytes/sec for the existing CPU lookup3, the kernel
+	 * alone, and a whole call including the transfers.
+	 */
+	native.keys = keys;
+	native.offsets = offsets;
+	native.hashes = ref;
+	native.n = num_keys;
+
+	bench_run("lookup3 csr cpu", run_hash_cpu, &arg, bytes, (double) num_keys);
+	best = cpu_bench("lookup3 csr", run_native_hash, &native, bytes, (double) num_keys);
+	r = bench_run("lookup3 csr kernel", run_hash_batch_kernel, &arg, bytes, (double) num_keys);
+	bench_print_speedup(r, best);
+	r = bench_run("lookup3 csr call", run_hash_batch_call, &arg, bytes, (double) num_keys);
+	bench_print_speedup(r, best);
+	bench_run("lookup3 64 csr cpu", run_hash64_cpu, &arg, bytes, (double) num_keys);
+	bench_run("lookup3 64 csr kernel", run_hash64_batch_kernel, &arg, bytes, (double) num_keys);
+	bench_run("lookup3 64 csr call", run_hash64_batch_call, &arg, bytes, (double) num_keys);
+
+	hash_batch_release(&hb);
+	free(keys);
+	free(offsets);
+	free(hashes);
+	free(ref);
+	free(hashes64);
+	free(ref64);
+}
+
+/* Service-style hashing: many small batches, each uploaded, hashed and
+ * read back. The cold path creates the kernel and buffers for every batch
+ * the way the other run_* functions do; the pooled path takes them from
+ * the runtime, so repeat batches create nothing.
+ */
+struct service_launch
+{
+	struct rt_device *dev;
+	const char *keys;
+	const cl_uint *offsets;
+	size_t num_keys;
+	unsigned int *hashes;
+	int pooled;
+};
+
+void run_service_batch(void *arg)
+{
+	struct service_launch *a = (struct service_launch *) arg;
+	struct rt_device *dev = a->dev;
+	size_t key_bytes = a->offsets[a->num_keys];
+	size_t local_size = HASH_BATCH_LOCAL_SIZE;
+	size_t global_size = (a->num_keys + local_size - 1) / local_size * local_size;
+	cl_uint n = (cl_uint) a->num_keys;
+	cl_uint seed = 0;
+	cl_kernel kernel;
+	cl_mem keys_buf, offsets_buf, hashes_buf;
+	cl_int err;
+
+	if (a->pooled)
+	{
+		kernel = runtime_kernel(dev, "lookup3_hash_keys_csr");
+		keys_buf = runtime_buffer(dev, CL_MEM_READ_ONLY, key_bytes);
+		offsets_buf = runtime_buffer(dev, CL_MEM_READ_ONLY, (a->num_keys + 1) * sizeof(cl_uint));
+		hashes_buf = runtime_buffer(dev, CL_MEM_WRITE_ONLY, a->num_keys * sizeof(cl_uint));
+	}
+	else
+	{
+		kernel = clCreateKernel(dev->program, "lookup3_hash_keys_csr", &err);
+		CL_CHECK_ERR(err);
+		keys_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, key_bytes, NULL, &err);
+		CL_CHECK_ERR(err);
+		offsets_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, (a->num_keys + 1) * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+		hashes_buf = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, a->num_keys * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+	}
+
+	err = clEnqueueWriteBuffer(dev->queue, keys_buf, CL_FALSE, 0, key_bytes, a->keys, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueWriteBuffer(dev->queue, offsets_buf, CL_FALSE, 0, (a->num_keys + 1) * sizeof(cl_uint), a->offsets, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &keys_buf);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &offsets_buf);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &n);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &hashes_buf);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueNDRangeKernel(dev->queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(dev->queue, hashes_buf, CL_TRUE, 0, a->num_keys * sizeof(cl_uint), a->hashes, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	if (a->pooled)
+	{
+		runtime_buffer_put(dev, keys_buf);
+		runtime_buffer_put(dev, offsets_buf);
+		runtime_buffer_put(dev, hashes_buf);
+	}
+	else
+	{
+		err = clReleaseMemObject(keys_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(offsets_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(hashes_buf); CL_CHECK_ERR(err);
+		err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
+	}
+}
+
+void run_service_test(struct rt_device *dev, size_t num_keys)
+{
+	struct service_launch launch;
+	struct bench_result *cold, *pooled;
+	char *keys;
+	cl_uint *offsets;
+	unsigned int *hashes, *ref;
+	double bytes;
+	size_t i;
+	int ok;
+
+	make_csr_keys(num_keys, &keys, &offsets);
+	bytes = (double) offsets[num_keys];
+
+	hashes = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	ref = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	if (hashes == NULL || ref == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("run_service_test(): batches of %lu keys\n", (unsigned long) num_keys);
+	hash_keys_csr(keys, offsets, num_keys, 0, ref);
+
+	launch.dev = dev;
+	launch.keys = keys;
+	launch.offsets = offsets;
+	launch.num_keys = num_keys;
+	launch.hashes = hashes;
+
+	ok = 1;
+	for (launch.pooled = 0; launch.pooled <= 1; launch.pooled++)
+	{
+		memset(hashes, 0, num_keys * sizeof(unsigned int));
+		run_service_batch(&launch);
+		for (i = 0; i < num_keys; i++)
+			if (hashes[i] != ref[i])
+				ok = 0;
+	}
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	launch.pooled = 0;
+	cold = bench_run("service batch cold", run_service_batch, &launch, bytes, (double) num_keys);
+	launch.pooled = 1;
+	pooled = bench_run("service batch pooled", run_service_batch, &launch, bytes, (double) num_keys);
+	bench_print_speedup(pooled, cold);
+
+	runtime_print_stats(dev);
+
+	free(keys);
+	free(offsets);
+	free(hashes);
+	free(ref);
+}
+
+/* Many small requests, alternately BATCH_REQUEST_KEYS keys to hash and
+ * BATCH_REQUEST_VALUES values to take the min of, flushed batch_size at a
+ * time. A batch size of 1 is a launch per request.
+ */
+#define BATCH_REQUEST_KEYS 16
+#define BATCH_REQUEST_VALUES 256
+
+struct batch_bench
+{
+	struct batch *b;
+	int mode;
+	size_t batch_size;
+	size_t num_requests;
+	const char *keys;
+	const cl_uint *offsets;
+	const cl_uint *values;
+	unsigned int *hashes;
+	cl_uint *mins;
+	size_t *slots;
+};
+
+void run_batch_requests(void *arg)
+{
+	struct batch_bench *a = (struct batch_bench *) arg;
+	const cl_uint *results;
+	size_t first, last, r;
+
+	for (first = 0; first < a->num_requests; first += a->batch_size)
+	{
+		last = first + a->batch_size < a->num_requests ? first + a->batch_size : a->num_requests;
+
+		for (r = first; r < last; r++)
+		{
+			if (r & 1)
+				a->slots[r - first] = batch_add_min(a->b, &a->values[r / 2 * BATCH_REQUEST_VALUES], BATCH_REQUEST_VALUES);
+			else
+				a->slots[r - first] = batch_add_hash(a->b, a->keys, &a->offsets[r / 2 * BATCH_REQUEST_KEYS], BATCH_REQUEST_KEYS, 0);
+		}
+
+		batch_flush(a->b, a->mode);
+		results = batch_results(a->b);
+
+		for (r = first; r < last; r++)
+		{
+			if (r & 1)
+				a->mins[r / 2] = results[a->slots[r - first]];
+			else
+				memcpy(&a->hashes[r / 2 * BATCH_REQUEST_KEYS], &results[a->slots[r - first]], BATCH_REQUEST_KEYS * sizeof(cl_uint));
+		}
+	}
+}
+
+void run_batch_test(cl_context context, cl_device_id device, cl_command_queue queue, cl_program program, size_t num_requests)
+{
+	static const size_t batch_sizes[] = { 1, 4, 16, 64, 256, 1024 };
+	static const char *mode_names[] = { "launch", "persistent" };
+	struct batch b;
+	struct batch_bench arg;
+	struct bench_result *r, *single[2];
+	size_t num_hash = (num_requests + 1) / 2;
+	size_t num_min = num_requests / 2;
+	size_t num_keys = num_hash * BATCH_REQUEST_KEYS;
+	size_t max_batch = batch_sizes[sizeof(batch_sizes) / sizeof(batch_sizes[0]) - 1];
+	char *keys;
+	cl_uint *offsets, *values, *mins, *ref_mins;
+	unsigned int *hashes, *ref;
+	unsigned int x = 2463534242u;
+	char name[64];
+	size_t i, j, s;
+	int mode, ok;
+
+	make_csr_keys(num_keys, &keys, &offsets);
+
+	values = (cl_uint *) malloc((num_min * BATCH_REQUEST_VALUES + 1) * sizeof(cl_uint));
+	mins = (cl_uint *) malloc((num_min + 1) * sizeof(cl_uint));
+	ref_mins = (cl_uint *) malloc((num_min + 1) * sizeof(cl_uint));
+	hashes = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	ref = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	arg.slots = (size_t *) malloc(max_batch * sizeof(size_t));
+	if (values == NULL || mins == NULL || ref_mins == NULL || hashes == NULL || ref == NULL || arg.slots == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("run_batch_test(): %lu requests of %d keys or %d values\n", (unsigned long) num_requests, BATCH_REQUEST_KEYS, BATCH_REQUEST_VALUES);
+
+	/* References on the host. */
+	hash_keys_csr(keys, offsets, num_keys, 0, ref);
+	for (i = 0; i < num_min; i++)
+	{
+		ref_mins[i] = (cl_uint) -1;
+		for (j = 0; j < BATCH_REQUEST_VALUES; j++)
+		{
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			values[i * BATCH_REQUEST_VALUES + j] = x;
+			ref_mins[i] = x < ref_mins[i] ? x : ref_mins[i];
+		}
+	}
+
+	batch_init(&b, context, device, queue, program);
+
+	arg.b = &b;
+	arg.num_requests = num_requests;
+	arg.keys = keys;
+	arg.offsets = offsets;
+	arg.values = values;
+	arg.hashes = hashes;
+	arg.mins = mins;
+
+	ok = 1;
+	for (mode = BATCH_LAUNCH; mode <= BATCH_PERSISTENT; mode++)
+	{
+		arg.mode = mode;
+		single[mode] = NULL;
+
+		for (s = 0; s < sizeof(batch_sizes) / sizeof(batch_sizes[0]); s++)
+		{
+			arg.batch_size = batch_sizes[s];
+
+			memset(hashes, 0, num_keys * sizeof(unsigned int));
+			memset(mins, 0, num_min * sizeof(cl_uint));
+			run_batch_requests(&arg);
+			if (memcmp(hashes, ref, num_keys * sizeof(unsigned int)) != 0 || memcmp(mins, ref_mins, num_min * sizeof(cl_uint)) != 0)
+				ok = 0;
+
+			snprintf(name, sizeof(name), "batch %s %lu", mode_names[mode], (unsigned long) batch_sizes[s]);
+			r = bench_run(name, run_batch_requests, &arg, 0, (double) num_requests);
+			printf("%s: %.0f requests/sec\n", name, r->median > 0 ? num_requests / r->median : 0);
+
+			if (single[mode] == NULL)
+				single[mode] = r;
+			else
+				bench_print_speedup(r, single[mode]);
+		}
+	}
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	batch_release(&b);
+
+	free(keys);
+	free(offsets);
+	free(values);
+	free(mins);
+	free(ref_mins);
+	free(hashes);
+	free(ref);
+	free(arg.slots);
+}
+
+/* End-to-end fixed length key hashing, HOST_BATCH_KEYS keys at a time:
+ * fill on the host, upload, hash, read back and check. Each host thread
+ * has its own queue, kernel and buffers on the shared context, so the
+ * threads only meet in the runtime.
+ */
+#define HOST_BATCH_KEYS 16384
+
+struct host_submit_thread
+{
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem keys_buf;
+	cl_mem hashes_buf;
+	char *keys;
+	unsigned int *hashes;
+};
+
+struct host_submit
+{
+	struct host_submit_thread *threads;
+	size_t num_keys;
+	unsigned int len;
+	int num_threads;
+	int errors[PARALLEL_MAX_THREADS];
+};
+
+static void host_submit_job(size_t first, size_t count, int thread, void *arg)
+{
+	struct host_submit *h = (struct host_submit *) arg;
+	struct host_submit_thread *t = &h->threads[thread];
+	size_t batch, n, i;
+	cl_int err;
+
+	for (batch = first; batch < first + count; batch++)
+	{
+		n = h->num_keys - batch * HOST_BATCH_KEYS;
+		if (n > HOST_BATCH_KEYS)
+			n = HOST_BATCH_KEYS;
+
+		for (i = 0; i < n * h->len; i++)
+			t->keys[i] = 'a' + (char) ((batch * 7 + i * 13) % 26);
+
+		/* In order: the blocking read also means the upload is done
+		 * before the keys are overwritten.
+		 */
+		err = clEnqueueWriteBuffer(t->queue, t->keys_buf, CL_FALSE, 0, n * h->len, t->keys, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clEnqueueNDRangeKernel(t->queue, t->kernel, 1, NULL, &n, NULL, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clEnqueueReadBuffer(t->queue, t->hashes_buf, CL_TRUE, 0, n * sizeof(unsigned int), t->hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		for (i = 0; i < n; i++)
+			if (t->hashes[i] != lookup3(&t->keys[i * h->len], h->len, 0))
+				h->errors[thread]++;
+	}
+}
+
+void run_host_submit(void *arg)
+{
+	struct host_submit *h = (struct host_submit *) arg;
+
+	pool_for(&host_pool, (h->num_keys + HOST_BATCH_KEYS - 1) / HOST_BATCH_KEYS, h->num_threads, host_submit_job, h);
+}
+
+/* Throughput against host thread count, doubling up to --host-threads. */
+void run_host_scaling(cl_context context, cl_device_id device, cl_program program, size_t num_keys, unsigned int len)
+{
+	struct host_submit h;
+	struct host_submit_thread *t;
+	struct bench_result *r, *single = NULL;
+	int counts[PARALLEL_MAX_THREADS];
+	double rates[PARALLEL_MAX_THREADS];
+	int num_counts = 0;
+	cl_uint seed = 0;
+	char name[64];
+	int i, n, ok;
+	cl_int err;
+
+	h.threads = (struct host_submit_thread *) malloc(host_threads * sizeof(struct host_submit_thread));
+	if (h.threads == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	h.num_keys = num_keys;
+	h.len = len;
+
+	printf("run_host_scaling(): %lu keys of %u bytes, batches of %d, up to %d threads\n", (unsigned long) num_keys, len, HOST_BATCH_KEYS, host_threads);
+
+	for (i = 0; i < host_threads; i++)
+	{
+		t = &h.threads[i];
+		t->queue = clCreateCommandQueue(context, device, prof_queue_properties(), &err);
+		CL_CHECK_ERR(err);
+		t->kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+		CL_CHECK_ERR(err);
+		t->keys_buf = clCreateBuffer(context, CL_MEM_READ_ONLY, (size_t) HOST_BATCH_KEYS * len, NULL, &err);
+		CL_CHECK_ERR(err);
+		t->hashes_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, HOST_BATCH_KEYS * sizeof(unsigned int), NULL, &err);
+		CL_CHECK_ERR(err);
+
+		err = clSetKernelArg(t->kernel, 0, sizeof(cl_mem), &t->keys_buf);
+		err |= clSetKernelArg(t->kernel, 1, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(t->kernel, 2, sizeof(cl_uint), &seed);
+		err |= clSetKernelArg(t->kernel, 3, sizeof(cl_mem), &t->hashes_buf);
+		CL_CHECK_ERR(err);
+
+		t->keys = (char *) malloc((size_t) HOST_BATCH_KEYS * len);
+		t->hashes = (unsigned int *) malloc(HOST_BATCH_KEYS * sizeof(unsigned int));
+		if (t->keys == NULL || t->hashes == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+
+	ok = 1;
+	for (n = 1; ; n = n * 2 < host_threads ? n * 2 : host_threads)
+	{
+		h.num_threads = n;
+		memset(h.errors, 0, sizeof(h.errors));
+		run_host_submit(&h);
+		for (i = 0; i < n; i++)
+			if (h.errors[i] != 0)
+				ok = 0;
+
+		snprintf(name, sizeof(name), "host submit %d threads", n);
+		r = bench_run(name, run_host_submit, &h, (double) num_keys * len, (double) num_keys);
+		if (single == NULL)
+			single = r;
+		else
+			bench_print_speedup(r, single);
+
+		counts[num_counts] = n;
+		rates[num_counts++] = r->median > 0 ? num_keys / r->median : 0;
+
+		if (n == host_threads)
+			break;
+	}
+
+	if (bench_check(ok))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+
+	printf("%8s %14s %8s %10s\n", "threads", "keys/sec", "speedup", "efficiency");
+	for (i = 0; i < num_counts; i++)
+		printf("%8d %14.0f %7.2fx %9.0f%%\n", counts[i], rates[i],
+			rates[0] > 0 ? rates[i] / rates[0] : 0,
+			rates[0] > 0 ? 100.0 * rates[i] / rates[0] / counts[i] : 0);
+
+	for (i = 0; i < host_threads; i++)
+	{
+		t = &h.threads[i];
+		err = clReleaseMemObject(t->keys_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(t->hashes_buf); CL_CHECK_ERR(err);
+		err = clReleaseKernel(t->kernel); CL_CHECK_ERR(err);
+		err = clReleaseCommandQueue(t->queue); CL_CHECK_ERR(err);
+		free(t->keys);
+		free(t->hashes);
+	}
+	free(h.threads);
+}
+
+/* Generic kernels against variants built with their sizes as -D constants
+ * through the specialization cache. Each variant is checked against the
+ * host before it is timed, and the specialized timings are reported as a
+ * speedup over the generic kernel.
+ */
+#define SPEC_NUM_KEYS (1 << 20)
+#define SPEC_MATRIX_N 4096
+#define SPEC_SGEMM_N 512
+
+void run_spec_test(cl_context context, cl_device_id device, cl_command_queue queue)
+{
+	static const int vec_widths[] = { 0, 1, 4, 8, 16 };
+	static const int tile_sizes[] = { 8, 16, 32 };
+	struct spec_cache spec;
+	struct kernel_launch launch;
+	struct kernel_launch_2d launch_2d;
+	struct bench_result *r, *generic;
+	cl_mem keys_buf, hashes_buf, a_buf, x_buf, y_buf, c_buf;
+	cl_kernel kernel;
+	char *keys;
+	unsigned int *hashes, *ref;
+	float *a, *x, *y, *y_ref, *b, *c, *c_ref;
+	cl_uint len = KEY_LEN;
+	cl_uint seed = 0;
+	cl_uint n = SPEC_MATRIX_N;
+	cl_uint sn = SPEC_SGEMM_N;
+	size_t max_local;
+	char options[SPEC_OPTIONS_LEN];
+	char name[64];
+	size_t i;
+	int v, ok;
+	cl_int err;
+
+	keys = (char *) malloc((size_t) SPEC_NUM_KEYS * KEY_LEN);
+	hashes = (unsigned int *) malloc(SPEC_NUM_KEYS * sizeof(unsigned int));
+	ref = (unsigned int *) malloc(SPEC_NUM_KEYS * sizeof(unsigned int));
+	a = (float *) malloc((size_t) n * n * sizeof(float));
+	x = (float *) malloc(n * sizeof(float));
+	y = (float *) malloc(n * sizeof(float));
+	y_ref = (float *) malloc(n * sizeof(float));
+	b = (float *) malloc((size_t) sn * sn * sizeof(float));
+	c = (float *) malloc((size_t) sn * sn * sizeof(float));
+	c_ref = (float *) malloc((size_t) sn * sn * sizeof(float));
+
+	if (keys == NULL || hashes == NULL || ref == NULL || a == NULL || x == NULL || y == NULL || y_ref == NULL || b == NULL || c == NULL || c_ref == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("run_spec_test():\n");
+	spec_init(&spec, context, device, "test.cl");
+
+	/* Fixed length keys, generic and with -DKEY_LEN. */
+	for (i = 0; i < (size_t) SPEC_NUM_KEYS * KEY_LEN; i++)
+		keys[i] = 'a' + (char) (i * 7 % 26);
+	for (i = 0; i < SPEC_NUM_KEYS; i++)
+		ref[i] = lookup3(&keys[i * KEY_LEN], KEY_LEN, seed);
+
+	keys_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) SPEC_NUM_KEYS * KEY_LEN, keys, &err);
+	CL_CHECK_ERR(err);
+	hashes_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, SPEC_NUM_KEYS * sizeof(unsigned int), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	launch.queue = queue;
+	launch.global_size = SPEC_NUM_KEYS;
+	launch.local_size = 0;
+	generic = NULL;
+
+	for (v = 0; v < 2; v++)
+	{
+		if (v)
+			snprintf(options, sizeof(options), "-DKEY_LEN=%u", len);
+		else
+			options[0] = '\0';
+
+		kernel = spec_kernel(&spec, "lookup3_hash_keys", options);
+		err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &keys_buf);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
+		err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &hashes_buf);
+		CL_CHECK_ERR(err);
+
+		snprintf(name, sizeof(name), "lookup3_hash_keys %s", v ? options : "generic");
+		launch.name = name;
+		launch.kernel = kernel;
+		run_kernel_launch(&launch);
+
+		err = clEnqueueReadBuffer(queue, hashes_buf, CL_TRUE, 0, SPEC_NUM_KEYS * sizeof(unsigned int), hashes, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		ok = memcmp(hashes, ref, SPEC_NUM_KEYS * sizeof(unsigned int)) == 0;
+		printf("%s: result %s\n", name, bench_check(ok) ? "correct" : "incorrect");
+
+		r = bench_run(name, run_kernel_launch, &launch, (double) SPEC_NUM_KEYS * KEY_LEN, (double) SPEC_NUM_KEYS);
+		if (v)
+			bench_print_speedup(r, generic);
+		else
+			generic = r;
+	}
+
+	err = clReleaseMemObject(keys_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(hashes_buf); CL_CHECK_ERR(err);
+
+	/* matrix_multiply with the row length fixed and then vectorized. */
+	fill_floats(a, (size_t) n * n, 1);
+	fill_floats(x, n, 2);
+	sgemv_reference(n, n, a, x, y_ref);
+
+	a_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) n * n * sizeof(float), a, &err);
+	CL_CHECK_ERR(err);
+	x_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, n * sizeof(float), x, &err);
+	CL_CHECK_ERR(err);
+	y_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, n * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	launch.global_size = n;
+	generic = NULL;
+
+	for (v = 0; v < (int) (sizeof(vec_widths) / sizeof(vec_widths[0])); v++)
+	{
+		if (vec_widths[v])
+			snprintf(options, sizeof(options), "-DMATRIX_N=%u -DMATRIX_VEC=%d", n, vec_widths[v]);
+		else
+			options[0] = '\0';
+
+		kernel = spec_kernel(&spec, "matrix_multiply", options);
+		err = clSetKernelArg(kernel, 0, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &a_buf);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &x_buf);
+		err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &y_buf);
+		CL_CHECK_ERR(err);
+
+		snprintf(name, sizeof(name), "matrix_multiply %s", vec_widths[v] ? options : "generic");
+		launch.name = name;
+		launch.kernel = kernel;
+		run_kernel_launch(&launch);
+
+		err = clEnqueueReadBuffer(queue, y_buf, CL_TRUE, 0, n * sizeof(float), y, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		printf("%s: result %s\n", name, bench_check(floats_match(y, y_ref, n)) ? "correct" : "incorrect");
+
+		r = bench_run(name, run_kernel_launch, &launch, ((double) n * n + 2.0 * n) * sizeof(float), (double) n);
+		if (vec_widths[v])
+			bench_print_speedup(r, generic);
+		else
+			generic = r;
+	}
+
+	err = clReleaseMemObject(a_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(x_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(y_buf); CL_CHECK_ERR(err);
+
+	/* sgemm_tiled at each tile size that fits the device. SPEC_SGEMM_N is
+	 * a multiple of all of them, so no padding is needed, and the start of
+	 * a is reused as the right-hand side.
+	 */
+	fill_floats(b, (size_t) sn * sn, 3);
+	sgemm_reference(sn, sn, sn, b, a, c_ref);
+
+	a_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) sn * sn * sizeof(float), b, &err);
+	CL_CHECK_ERR(err);
+	x_buf = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, (size_t) sn * sn * sizeof(float), a, &err);
+	CL_CHECK_ERR(err);
+	c_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, (size_t) sn * sn * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	launch_2d.queue = queue;
+	launch_2d.global_size[0] = sn / 4;
+	launch_2d.global_size[1] = sn;
+
+	for (v = 0; v < (int) (sizeof(tile_sizes) / sizeof(tile_sizes[0])); v++)
+	{
+		snprintf(options, sizeof(options), "-DSGEMM_TS=%d", tile_sizes[v]);
+		kernel = spec_kernel(&spec, "sgemm_tiled", options);
+
+		err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+		CL_CHECK_ERR(err);
+		if ((size_t) tile_sizes[v] * tile_sizes[v] / 4 > max_local)
+			continue;
+
+		err = clSetKernelArg(kernel, 0, sizeof(cl_uint), &sn);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &sn);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &sn);
+		err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &a_buf);
+		err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &x_buf);
+		err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &c_buf);
+		CL_CHECK_ERR(err);
+
+		snprintf(name, sizeof(name), "sgemm_tiled %s", options);
+		launch_2d.name = name;
+		launch_2d.kernel = kernel;
+		launch_2d.local_size[0] = tile_sizes[v] / 4;
+		launch_2d.local_size[1] = tile_sizes[v];
+		run_kernel_launch_2d(&launch_2d);
+
+		err = clEnqueueReadBuffer(queue, c_buf, CL_TRUE, 0, (size_t) sn * sn * sizeof(float), c, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		printf("%s: result %s\n", name, bench_check(floats_match(c, c_ref, (size_t) sn * sn)) ? "correct" : "incorrect");
+
+		bench_run(name, run_kernel_launch_2d, &launch_2d, 3.0 * sn * sn * sizeof(float), (double) sn * sn);
+	}
+
+	err = clReleaseMemObject(a_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(x_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(c_buf); CL_CHECK_ERR(err);
+
+	printf("Specialization cache: %d variants built, %d kernel hits\n", spec.builds, spec.hits);
+	spec_release(&spec);
+
+	free(keys);
+	free(hashes);
+	free(ref);
+	free(a);
+	free(x);
+	free(y);
+	free(y_ref);
+	free(b);
+	free(c);
+	free(c_ref);
+}
+
+/* Every type and operator of the generic reduction, finished on the device
+ * and on the host, checked against reduce_host(). n need not be a power
+ * of two.
+ */
+struct reduce_launch
+{
+	struct reducer *r;
+	cl_mem src;
+	size_t n;
+	struct reduce_result result;
+};
+
+void run_reduce_launch(void *arg)
+{
+	struct reduce_launch *a = (struct reduce_launch *) arg;
+	reducer_run(a->r, a->src, a->n, &a->result);
+}
+
+int reduce_results_match(int type, int op, const struct reduce_result *x, const struct reduce_result *y, size_t n)
+{
+	double a, b;
+
+	if (op == REDUCE_ARGMIN && x->index != y->index)
+		return 0;
+
+	switch (type)
+	{
+		case REDUCE_INT: return x->value.i == y->value.i;
+		case REDUCE_UINT: return x->value.u == y->value.u;
+		case REDUCE_FLOAT: a = x->value.f; b = y->value.f; break;
+		default: a = x->value.d; b = y->value.d; break;
+	}
+
+	/* Floating point sums depend on the order of the additions. */
+	if (op == REDUCE_SUM)
+		return fabs(a - b) <= 1e-5 * n * (type == REDUCE_FLOAT ? 1.0 : 1e-8);
+
+	return a == b;
+}
+
+void run_reduce_test(cl_context context, cl_device_id device, cl_command_queue queue, size_t n)
+{
+	static const size_t sizes[] = { sizeof(cl_int), sizeof(cl_uint), sizeof(cl_float), sizeof(cl_double) };
+	struct reducer r;
+	struct reduce_launch launch;
+	struct reduce_result ref;
+	struct host_buffer src_buf;
+	char name[64];
+	void *src;
+	unsigned int seed = 1;
+	int type, op, pass;
+	cl_int *ip;
+	cl_uint *up;
+	cl_float *fp;
+	cl_double *dp;
+	size_t i;
+
+	printf("run_reduce_test(%lu):\n", (unsigned long) n);
+
+	for (type = REDUCE_INT; type <= REDUCE_DOUBLE; type++)
+	{
+		buffer_create(&src_buf, context, CL_MEM_READ_ONLY, n * sizes[type], "reduce src");
+		src = buffer_map(&src_buf, queue, CL_MAP_WRITE);
+		ip = (cl_int *) src;
+		up = (cl_uint *) src;
+		fp = (cl_float *) src;
+		dp = (cl_double *) src;
+
+		/* Small values so integer sums cannot overflow. */
+		for (i = 0; i < n; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			switch (type)
+			{
+				case REDUCE_INT: ip[i] = (cl_int) ((seed >> 16) % 2001) - 1000; break;
+				case REDUCE_UINT: up[i] = (seed >> 16) % 1000; break;
+				case REDUCE_FLOAT: fp[i] = (cl_float) ((seed >> 16) % 2001) / 1000.0f - 1.0f; break;
+				case REDUCE_DOUBLE: dp[i] = (cl_double) ((seed >> 16) % 2001) / 1000.0 - 1.0; break;
+			}
+		}
+
+		for (op = REDUCE_SUM; op <= REDUCE_ARGMIN; op++)
+		{
+			reduce_host(src, n, type, op, &ref);
+
+			for (pass = REDUCE_ON_DEVICE; pass <= REDUCE_ON_HOST; pass++)
+			{
+				if (!reducer_init(&r, context, device, queue, type, op, pass))
+				{
+					printf("reduce %s: not supported\n", reduce_type_name(type));
+					continue;
+				}
+
+				snprintf(name, sizeof(name), "reduce %s %s (%s)", reduce_type_name(type), reduce_op_name(op), pass == REDUCE_ON_DEVICE ? "device" : "host");
+
+				launch.r = &r;
+				launch.src = src_buf.mem;
+				launch.n = n;
+
+				buffer_unmap(&src_buf, queue);
+				run_reduce_launch(&launch);
+				printf("%s: %s\n", name, bench_check(reduce_results_match(type, op, &launch.result, &ref, n)) ? "result correct" : "result incorrect");
+
+				bench_run(name, run_reduce_launch, &launch, (double) n * sizes[type], (double) n);
+				src = buffer_map(&src_buf, queue, CL_MAP_READ);
+
+				reducer_release(&r);
+			}
+		}
+
+		buffer_unmap(&src_buf, queue);
+		buffer_release(&src_buf);
+	}
+}
+
+/* Scan, compaction and histogram, checked against the host and timed in
+ * elements/sec.
+ */
+#define SCAN_HISTOGRAM_BINS 256
+
+struct scan_launch
+{
+	struct scanner *s;
+	cl_command_queue queue;
+	cl_mem src;
+	cl_mem dst;
+	cl_mem bins;
+	cl_mem offsets;
+	size_t n;
+	int inclusive;
+	cl_uint threshold;
+	size_t kept;
+};
+
+void run_scan_launch(void *arg)
+{
+	struct scan_launch *a = (struct scan_launch *) arg;
+	cl_int err;
+
+	scan_run(a->s, a->src, a->dst, a->n, a->inclusive);
+	err = clFinish(a->queue);
+	CL_CHECK_ERR(err);
+}
+
+void run_compact_launch(void *arg)
+{
+	struct scan_launch *a = (struct scan_launch *) arg;
+	a->kept = compact_run(a->s, a->src, a->dst, a->n, a->threshold);
+}
+
+void run_histogram_launch(void *arg)
+{
+	struct scan_launch *a = (struct scan_launch *) arg;
+	cl_int err;
+
+	histogram_run(a->s, a->src, a->n, 0, SCAN_HISTOGRAM_BINS, a->bins, a->offsets);
+	err = clFinish(a->queue);
+	CL_CHECK_ERR(err);
+}
+
+void run_scan_test(cl_context context, cl_device_id device, cl_command_queue queue, cl_program program, size_t n)
+{
+	struct scanner s;
+	struct scan_launch launch;
+	struct host_buffer src_buf, dst_buf, bins_buf, offsets_buf;
+	cl_uint *src, *dst, *bins, *offsets;
+	cl_uint *ref_bins;
+	cl_uint sum, kept;
+	unsigned int seed = 1;
+	size_t i;
+	int ok;
+
+	printf("run_scan_test(%lu):\n", (unsigned long) n);
+
+	ref_bins = (cl_uint *) calloc(SCAN_HISTOGRAM_BINS, sizeof(cl_uint));
+	if (ref_bins == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	buffer_create(&src_buf, context, CL_MEM_READ_ONLY, n * sizeof(cl_uint), "scan src");
+	buffer_create(&dst_buf, context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), "scan dst");
+	buffer_create(&bins_buf, context, CL_MEM_READ_WRITE, SCAN_HISTOGRAM_BINS * sizeof(cl_uint), "histogram bins");
+	buffer_create(&offsets_buf, context, CL_MEM_READ_WRITE, SCAN_HISTOGRAM_BINS * sizeof(cl_uint), "histogram offsets");
+
+	src = (cl_uint *) buffer_map(&src_buf, queue, CL_MAP_WRITE);
+	for (i = 0; i < n; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		src[i] = (seed >> 16) & 0xffff;
+	}
+	buffer_unmap(&src_buf, queue);
+
+	scanner_init(&s, context, device, queue, program, n);
+
+	launch.s = &s;
+	launch.queue = queue;
+	launch.src = src_buf.mem;
+	launch.dst = dst_buf.mem;
+	launch.bins = bins_buf.mem;
+	launch.offsets = offsets_buf.mem;
+	launch.n = n;
+	launch.threshold = 0x4000;
+
+	/* Exclusive and inclusive scans. */
+	for (launch.inclusive = SCAN_EXCLUSIVE; launch.inclusive <= SCAN_INCLUSIVE; launch.inclusive++)
+	{
+		run_scan_launch(&launch);
+
+		src = (cl_uint *) buffer_map(&src_buf, queue, CL_MAP_READ);
+		dst = (cl_uint *) buffer_map(&dst_buf, queue, CL_MAP_READ);
+		ok = 1;
+		sum = 0;
+		for (i = 0; i < n && ok; i++)
+		{
+			if (launch.inclusive)
+				sum += src[i];
+			ok = dst[i] == sum;
+			if (!launch.inclusive)
+				sum += src[i];
+		}
+		buffer_unmap(&src_buf, queue);
+		buffer_unmap(&dst_buf, queue);
+
+		printf("%s scan: %s\n", launch.inclusive ? "inclusive" : "exclusive", bench_check(ok) ? "result correct" : "result incorrect");
+		bench_run(launch.inclusive ? "scan inclusive" : "scan exclusive", run_scan_launch, &launch, 2.0 * n * sizeof(cl_uint), (double) n);
+	}
+
+	/* Compaction. */
+	run_compact_launch(&launch);
+
+	src = (cl_uint *) buffer_map(&src_buf, queue, CL_MAP_READ);
+	dst = (cl_uint *) buffer_map(&dst_buf, queue, CL_MAP_READ);
+	ok = 1;
+	kept = 0;
+	for (i = 0; i < n && ok; i++)
+	{
+		if (src[i] < launch.threshold)
+			ok = kept < launch.kept && dst[kept++] == src[i];
+	}
+	ok = ok && kept == launch.kept;
+	buffer_unmap(&src_buf, queue);
+	buffer_unmap(&dst_buf, queue);
+
+	printf("compact: kept %lu, %s\n", (unsigned long) launch.kept, bench_check(ok) ? "result correct" : "result incorrect");
+	bench_run("compact", run_compact_launch, &launch, 2.0 * n * sizeof(cl_uint), (double) n);
+
+	/* Histogram and bucket offsets. */
+	run_histogram_launch(&launch);
+
+	src = (cl_uint *) buffer_map(&src_buf, queue, CL_MAP_READ);
+	for (i = 0; i < n; i++)
+		ref_bins[src[i] & (SCAN_HISTOGRAM_BINS - 1)]++;
+	buffer_unmap(&src_buf, queue);
+
+	bins = (cl_uint *) buffer_map(&bins_buf, queue, CL_MAP_READ);
+	offsets = (cl_uint *) buffer_map(&offsets_buf, queue, CL_MAP_READ);
+	ok = 1;
+	sum = 0;
+	for (i = 0; i < SCAN_HISTOGRAM_BINS && ok; i++)
+	{
+		ok = bins[i] == ref_bins[i] && offsets[i] == sum;
+		sum += ref_bins[i];
+	}
+	buffer_unmap(&bins_buf, queue);
+	buffer_unmap(&offsets_buf, queue);
+
+	printf("histogram: %s\n", bench_check(ok) ? "result correct" : "result incorrect");
+	bench_run("histogram", run_histogram_launch, &launch, (double) n * sizeof(cl_uint), (double) n);
+
+	scanner_release(&s);
+	buffer_release(&src_buf);
+	buffer_release(&dst_buf);
+	buffer_release(&bins_buf);
+	buffer_release(&offsets_buf);
+	free(ref_bins);
+}
+
+/* Device hash table build and probe at several load factors, against the
+ * chained host table. The build keys are user IDs with one in eight
+ * repeated; half the probe keys are present.
+ */
+#define HASH_TABLE_DUP_RATE 8
+
+struct hash_table_launch
+{
+	struct hash_table *t;
+	struct chain_table *c;
+	cl_command_queue queue;
+	struct host_buffer *keys;
+	struct host_buffer *offsets;
+	struct host_buffer *probe_keys;
+	struct host_buffer *probe_offsets;
+	struct host_buffer *matches;
+	size_t num_keys;
+	size_t num_probes;
+	const char *host_keys;
+	const cl_uint *host_offsets;
+	const char *host_probe_keys;
+	const cl_uint *host_probe_offsets;
+	cl_uint *first;
+	cl_uint *host_matches;
+};
+
+void run_hash_table_build(void *arg)
+{
+	struct hash_table_launch *a = (struct hash_table_launch *) arg;
+	cl_int err;
+
+	hash_table_build(a->t, a->keys->mem, a->offsets->mem, a->num_keys);
+	err = clFinish(a->queue);
+	CL_CHECK_ERR(err);
+}
+
+void run_hash_table_probe(void *arg)
+{
+	struct hash_table_launch *a = (struct hash_table_launch *) arg;
+	cl_int err;
+
+	hash_table_probe(a->t, a->probe_keys->mem, a->probe_offsets->mem, a->num_probes, a->matches->mem);
+	err = clFinish(a->queue);
+	CL_CHECK_ERR(err);
+}
+
+void run_chain_table_build(void *arg)
+{
+	struct hash_table_launch *a = (struct hash_table_launch *) arg;
+
+	chain_table_release(a->c);
+	chain_table_build(a->c, a->host_keys, a->host_offsets, a->num_keys, a->first);
+}
+
+void run_chain_table_probe(void *arg)
+{
+	struct hash_table_launch *a = (struct hash_table_launch *) arg;
+	chain_table_probe(a->c, a->host_probe_keys, a->host_probe_offsets, a->num_probes, a->host_matches);
+}
+
+int csr_keys_equal(const char *keys_a, const cl_uint *offsets_a, cl_uint a, const char *keys_b, const cl_uint *offsets_b, cl_uint b)
+{
+	cl_uint len = offsets_a[a + 1] - offsets_a[a];
+
+	return offsets_b[b + 1] - offsets_b[b] == len && memcmp(&keys_a[offsets_a[a]], &keys_b[offsets_b[b]], len) == 0;
+}
+
+/* CSR pack "user-<id>" for ids[0..n). */
+void make_id_keys(const cl_uint *ids, size_t n, char **keys, cl_uint **offsets)
+{
+	char key[32];
+	size_t i, total, len;
+
+	*offsets = (cl_uint *) malloc((n + 1) * sizeof(cl_uint));
+	*keys = (char *) malloc(n * 16 + 1);
+	if (*offsets == NULL || *keys == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	total = 0;
+	for (i = 0; i < n; i++)
+	{
+		len = sprintf(key, "user-%u", ids[i]);
+		(*offsets)[i] = (cl_uint) total;
+		memcpy(&(*keys)[total], key, len);
+		total += len;
+	}
+	(*offsets)[n] = (cl_uint) total;
+}
+
+void upload_csr_keys(cl_context context, cl_command_queue queue, const char *keys, const cl_uint *offsets, size_t n, struct host_buffer *keys_buf, struct host_buffer *offsets_buf)
+{
+	buffer_create(keys_buf, context, CL_MEM_READ_ONLY, offsets[n] > 0 ? offsets[n] : 1, "hash table keys");
+	memcpy(buffer_map(keys_buf, queue, CL_MAP_WRITE), keys, offsets[n]);
+	buffer_unmap(keys_buf, queue);
+
+	buffer_create(offsets_buf, context, CL_MEM_READ_ONLY, (n + 1) * sizeof(cl_uint), "hash table offsets");
+	memcpy(buffer_map(offsets_buf, queue, CL_MAP_WRITE), offsets, (n + 1) * sizeof(cl_uint));
+	buffer_unmap(offsets_buf, queue);
+}
+
+void run_hash_table_test(cl_context context, cl_command_queue queue, cl_program program, size_t num_slots)
+{
+	static const double load_factors[] = { 0.25, 0.5, 0.75, 0.9 };
+	struct hash_table t;
+	struct chain_table c;
+	struct hash_table_launch launch;
+	struct host_buffer keys_buf, offsets_buf, probe_keys_buf, probe_offsets_buf, matches_buf;
+	char *keys, *probe_keys;
+	cl_uint *offsets, *probe_offsets;
+	cl_uint *ids, *first, *ref_first, *matches, *ref_matches;
+	size_t unique, distinct, n, i, l;
+	unsigned int seed = 1;
+	char name[64];
+	cl_int err;
+	int ok;
+
+	for (l = 0; l < sizeof(load_factors) / sizeof(load_factors[0]); l++)
+	{
+		unique = (size_t) (load_factors[l] * num_slots);
+		n = unique + unique / HASH_TABLE_DUP_RATE;
+
+		ids = (cl_uint *) malloc(n * sizeof(cl_uint));
+		first = (cl_uint *) malloc(n * sizeof(cl_uint));
+		ref_first = (cl_uint *) malloc(n * sizeof(cl_uint));
+		matches = (cl_uint *) malloc(n * sizeof(cl_uint));
+		ref_matches = (cl_uint *) malloc(n * sizeof(cl_uint));
+		if (ids == NULL || first == NULL || ref_first == NULL || matches == NULL || ref_matches == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+
+		/* Distinct ids, then repeats of earlier ones. */
+		for (i = 0; i < unique; i++)
+			ids[i] = (cl_uint) (i * 2654435761u);
+		for (; i < n; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			ids[i] = ids[(seed >> 8) % unique];
+		}
+		make_id_keys(ids, n, &keys, &offsets);
+
+		/* Every other probe is an id that was never inserted. */
+		for (i = 0; i < n; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			ids[i] = (i & 1) ? ids[(seed >> 8) % unique] : (cl_uint) ((unique + (seed >> 8)) * 2654435761u);
+		}
+		make_id_keys(ids, n, &probe_keys, &probe_offsets);
+
+		upload_csr_keys(context, queue, keys, offsets, n, &keys_buf, &offsets_buf);
+		upload_csr_keys(context, queue, probe_keys, probe_offsets, n, &probe_keys_buf, &probe_offsets_buf);
+		buffer_create(&matches_buf, context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), "hash table matches");
+
+		hash_table_create(&t, context, queue, program, n, num_slots);
+		chain_table_build(&c, keys, offsets, n, ref_first);
+		chain_table_probe(&c, probe_keys, probe_offsets, n, ref_matches);
+
+		launch.t = &t;
+		launch.c = &c;
+		launch.queue = queue;
+		launch.keys = &keys_buf;
+		launch.offsets = &offsets_buf;
+		launch.probe_keys = &probe_keys_buf;
+		launch.probe_offsets = &probe_offsets_buf;
+		launch.matches = &matches_buf;
+		launch.num_keys = n;
+		launch.num_probes = n;
+		launch.host_keys = keys;
+		launch.host_offsets = offsets;
+		launch.host_probe_keys = probe_keys;
+		launch.host_probe_offsets = probe_offsets;
+		launch.first = ref_first;
+		launch.host_matches = ref_matches;
+
+		run_hash_table_build(&launch);
+		run_hash_table_probe(&launch);
+
+		/* Which copy of a duplicate wins the slot depends on timing, so
+		 * check that each key maps to an equal key that maps to itself,
+		 * one per distinct id.
+		 */
+		err = clEnqueueReadBuffer(queue, t.first, CL_TRUE, 0, n * sizeof(cl_uint), first, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		memcpy(matches, buffer_map(&matches_buf, queue, CL_MAP_READ), n * sizeof(cl_uint));
+		buffer_unmap(&matches_buf, queue);
+
+		ok = 1;
+		distinct = 0;
+		for (i = 0; i < n && ok; i++)
+		{
+			ok = first[i] < n && first[first[i]] == first[i] && csr_keys_equal(keys, offsets, first[i], keys, offsets, (cl_uint) i);
+			distinct += first[i] == i;
+
+			if (ok && ref_matches[i] == HASH_TABLE_EMPTY)
+				ok = matches[i] == HASH_TABLE_EMPTY;
+			else if (ok)
+				ok = matches[i] < n && first[matches[i]] == matches[i] && csr_keys_equal(keys, offsets, matches[i], probe_keys, probe_offsets, (cl_uint) i);
+		}
+		ok = ok && distinct == unique;
+
+		printf("hash table load factor %.2f: %lu keys, %lu distinct, %s\n", load_factors[l], (unsigned long) n, (unsigned long) unique, bench_check(ok) ? "result correct" : "result incorrect");
+
+		snprintf(name, sizeof(name), "hash table build lf %.2f", load_factors[l]);
+		bench_run(name, run_hash_table_build, &launch, (double) offsets[n], (double) n);
+		snprintf(name, sizeof(name), "hash table probe lf %.2f", load_factors[l]);
+		bench_run(name, run_hash_table_probe, &launch, (double) probe_offsets[n], (double) n);
+		snprintf(name, sizeof(name), "chain table build lf %.2f", load_factors[l]);
+		bench_run(name, run_chain_table_build, &launch, (double) offsets[n], (double) n);
+		snprintf(name, sizeof(name), "chain table probe lf %.2f", load_factors[l]);
+		bench_run(name, run_chain_table_probe, &launch, (double) probe_offsets[n], (double) n);
+
+		hash_table_release(&t);
+		chain_table_release(&c);
+		buffer_release(&keys_buf);
+		buffer_release(&offsets_buf);
+		buffer_release(&probe_keys_buf);
+		buffer_release(&probe_offsets_buf);
+		buffer_release(&matches_buf);
+		free(keys);
+		free(offsets);
+		free(probe_keys);
+		free(probe_offsets);
+		free(ids);
+		free(first);
+		free(ref_first);
+		free(matches);
+		free(ref_matches);
+	}
+}
+
+/* One minp pass followed by the reduce pass, run to completion.
+ */
+struct minp_launch
+{
+	cl_command_queue queue;
+	cl_kernel minp;
+	cl_kernel reduce;
+	size_t global_work_size;
+	size_t local_work_size;
+	size_t num_groups;
+};
+
+void run_minp_launch(void *arg)
+{
+	struct minp_launch *launch = (struct minp_launch *) arg;
+	cl_event ev[2];
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(launch->queue, launch->minp, 1, NULL, &launch->global_work_size, &launch->local_work_size, 0, NULL, &ev[0]);
+	CL_CHECK_ERR(err);
+	err = clEnqueueNDRangeKernel(launch->queue, launch->reduce, 1, NULL, &launch->num_groups, NULL, 1, &ev[0], &ev[1]);
+	CL_CHECK_ERR(err);
+
+	err = clWaitForEvents(1, &ev[1]);
+	CL_CHECK_ERR(err);
+
+	prof_event(ev[0], "minp", PROF_KERNEL);
+	prof_event(ev[1], "reduce", PROF_KERNEL);
+
+	err = clReleaseEvent(ev[0]);
+	err = clReleaseEvent(ev[1]);
+	CL_CHECK_ERR(err);
+}
+
+int run_minp_tune_launch(cl_command_queue queue, cl_kernel kernel, const struct tune_config *cfg, void *arg)
+{
+	struct minp_launch *launch = (struct minp_launch *) arg;
+	size_t num_groups = cfg->global_size / cfg->local_size;
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(queue, launch->minp, 1, NULL, &cfg->global_size, &cfg->local_size, 0, NULL, &ev);
+	if (err != CL_SUCCESS)
+		return err;
+	err = clEnqueueNDRangeKernel(queue, launch->reduce, 1, NULL, &num_groups, NULL, 1, &ev, NULL);
+	clReleaseEvent(ev);
+	if (err != CL_SUCCESS)
+		return err;
+
+	return clFinish(queue);
+}
+
+/* num_src_items is rounded up to whole uint4 wavefronts. */
+void run_minp_test(cl_context context, cl_command_queue queue, cl_program program, unsigned int num_src_items)
+{
+	cl_kernel minp;
+	cl_kernel reduce;
+	cl_uint dev;
+	cl_uint ws = 64;
+	time_t ltime;
+	cl_uint *src_ptr;
+	cl_uint min;
+	struct host_buffer src_buf;
+	cl_mem dst_buf, dbg_buf;
+	cl_uint *dst_ptr, *dbg_ptr;
+	cl_uint compute_units;
+	size_t global_work_size, local_work_size, num_groups;
+	cl_device_id device;
+	cl_device_type device_type;
+	struct minp_launch launch;
+	struct tune_config tuned;
+	struct native_arg native;
+	struct bench_result *r, *best;
+	cl_event ev;
+	cl_int err;
+
+	num_src_items = (unsigned int) round_up(num_src_items, 4 * ws);
+
+	time(&ltime);
+	buffer_create(&src_buf, context, CL_MEM_READ_ONLY, num_src_items * sizeof(cl_uint), "minp src");
+	src_ptr = (cl_uint *) buffer_map(&src_buf, queue, CL_MAP_WRITE);
+
+	min = host_fill_lcg(src_ptr, num_src_items, (cl_uint) ltime);
+
+	buffer_unmap(&src_buf, queue);
+	
+	clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
+
+	if (device_type == CL_DEVICE_TYPE_CPU)
+	{
+		global_work_size = compute_units * 1; // 1 thread per core
+		local_work_size = 1;
+		dev = 0; // blocked access
+	}
+	else
+	{
+		global_work_size = compute_units * 7 * ws; // 7 wavefronts per SIMD
+		while ((num_src_items / 4) % global_work_size != 0)
+			global_work_size += ws;
+		local_work_size = ws;
+		dev = 1; // strided access
+	}
+		
+	num_groups = global_work_size / local_work_size;
+
+	minp = clCreateKernel(program, "minp", &err);
+	CL_CHECK_ERR(err);
+	reduce = clCreateKernel(program, "reduce", &err);
+	CL_CHECK_ERR(err);
+
+	/* Sized for the most work-groups any tuned configuration can have. */
+	dst_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, (num_src_items / 4) * sizeof(cl_uint), NULL, &err); 
+	CL_CHECK_ERR(err);
+	dbg_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 4 * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+		
+	clSetKernelArg(minp, 0, sizeof(void *), (void*) &src_buf.mem);
+	clSetKernelArg(minp, 1, sizeof(void *), (void*) &dst_buf);
+	clSetKernelArg(minp, 2, sizeof(cl_uint), (void*) NULL);
+	clSetKernelArg(minp, 3, sizeof(void *), (void*) &dbg_buf);
+	clSetKernelArg(minp, 4, sizeof(num_src_items), (void*) &num_src_items);
+	clSetKernelArg(minp, 5, sizeof(dev), (void*) &dev);
+	clSetKernelArg(reduce, 0, sizeof(void *), (void*) &src_buf.mem);
+	clSetKernelArg(reduce, 1, sizeof(void *), (void*) &dst_buf);
+
+	launch.queue = queue;
+	launch.minp = minp;
+	launch.reduce = reduce;
+	launch.global_work_size = global_work_size;
+	launch.local_work_size = local_work_size;
+	launch.num_groups = num_groups;
+
+	/* Replace the guess above with a tuned configuration if there is one.
+	 * Each work-item reads items_per_item uint4s.
+	 */
+	if (autotune_kernel(queue, device, minp, "minp", num_src_items / 4, 1024, run_minp_tune_launch, &launch, &tuned))
+	{
+		launch.global_work_size = global_work_size = tuned.global_size;
+		launch.local_work_size = local_work_size = tuned.local_size;
+		launch.num_groups = num_groups = tuned.global_size / tuned.local_size;
+	}
+
+	r = bench_run("minp", run_minp_launch, &launch, (double) num_src_items * sizeof(cl_uint), (double) num_src_items);
+
+	native.src = buffer_map(&src_buf, queue, CL_MAP_READ);
+	native.n = num_src_items;
+	best = cpu_bench("minp", run_native_min, &native, (double) num_src_items * sizeof(cl_uint), (double) num_src_items);
+	bench_print_speedup(r, best);
+	buffer_unmap(&src_buf, queue);
+
+	dst_ptr = (cl_uint *) clEnqueueMapBuffer(queue, dst_buf, CL_TRUE, CL_MAP_READ, 0,  num_groups * sizeof(cl_uint), 0, NULL, &ev, &err);
+	CL_CHECK_ERR(err);
+	prof_event(ev, "minp map dst", PROF_MAP);
+	err = clReleaseEvent(ev); CL_CHECK_ERR(err);
+	dbg_ptr = (cl_uint *) clEnqueueMapBuffer(queue, dbg_buf, CL_TRUE, CL_MAP_READ, 0,  4 * sizeof(cl_uint), 0, NULL, &ev, &err);
+	CL_CHECK_ERR(err);
+	prof_event(ev, "minp map dbg", PROF_MAP);
+	err = clReleaseEvent(ev); CL_CHECK_ERR(err);
+		
+	printf("%d groups, %d threads, count %d, stride %d\n", dbg_ptr[0], dbg_ptr[1], dbg_ptr[2], dbg_ptr[3]);
+	if (bench_check(dst_ptr[0] == min))
+		printf("result correct\n");
+	else
+		printf("result incorrect\n");
+	printf("\n");
+
+	/* Clean up. */
+	err = clEnqueueUnmapMemObject(queue, dst_buf, dst_ptr, 0, NULL, NULL); CL_CHECK_ERR(err);
+	err = clEnqueueUnmapMemObject(queue, dbg_buf, dbg_ptr, 0, NULL, NULL); CL_CHECK_ERR(err);
+	buffer_release(&src_buf);
+	err = clReleaseMemObject(dst_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(dbg_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(minp); CL_CHECK_ERR(err);
+	err = clReleaseKernel(reduce); CL_CHECK_ERR(err);
+}
+
+/* Multi-device drivers. Each splits one large workload between every
+ * device, weighted by a calibration run, and merges the results.
+ */
+struct md_hash_arg
+{
+	char *keys;
+	unsigned int len;
+	unsigned int seed;
+	unsigned int *hashes;
+};
+
+struct md_hash_state
+{
+	cl_kernel kernel;
+	cl_mem keys_buf;
+	cl_mem hashes_buf;
+};
+
+void md_hash_enqueue(struct md_device *dev, size_t first, size_t count, void *arg, void **state)
+{
+	struct md_hash_arg *a = (struct md_hash_arg *) arg;
+	struct md_hash_state *st;
+	cl_int err;
+
+	st = (struct md_hash_state *) malloc(sizeof(struct md_hash_state));
+	if (st == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	st->keys_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, count * a->len, NULL, &err);
+	CL_CHECK_ERR(err);
+	st->hashes_buf = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, count * sizeof(unsigned int), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->kernel = clCreateKernel(dev->program, "lookup3_hash_keys", &err);
+	CL_CHECK_ERR(err);
+
+	err = clSetKernelArg(st->kernel, 0, sizeof(cl_mem), &st->keys_buf);
+	err |= clSetKernelArg(st->kernel, 1, sizeof(unsigned int), &a->len);
+	err |= clSetKernelArg(st->kernel, 2, sizeof(unsigned int), &a->seed);
+	err |= clSetKernelArg(st->kernel, 3, sizeof(cl_mem), &st->hashes_buf);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueWriteBuffer(dev->queue, st->keys_buf, CL_FALSE, 0, count * a->len, &a->keys[first * a->len], 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueNDRangeKernel(dev->queue, st->kernel, 1, NULL, &count, NULL, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(dev->queue, st->hashes_buf, CL_FALSE, 0, count * sizeof(unsigned int), &a->hashes[first], 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	*state = st;
+}
+
+void md_hash_complete(struct md_device *dev, size_t first, size_t count, void *arg, void *state)
+{
+	struct md_hash_state *st = (struct md_hash_state *) state;
+	cl_int err;
+
+	err = clReleaseMemObject(st->keys_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(st->hashes_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(st->kernel); CL_CHECK_ERR(err);
+	free(st);
+}
+
+/* minp runs with a fixed NDRange on every device, so each device's share
+ * must be a whole number of uint4s per work-item.
+ */
+#define MD_MINP_GLOBAL_SIZE 4096
+#define MD_MINP_LOCAL_SIZE 64
+#define MD_MINP_ALIGN (4 * MD_MINP_GLOBAL_SIZE)
+
+struct md_min_arg
+{
+	cl_uint *src;
+	cl_uint min;
+};
+
+struct md_min_state
+{
+	cl_kernel minp;
+	cl_kernel reduce;
+	cl_mem src_buf;
+	cl_mem dst_buf;
+	cl_mem dbg_buf;
+	cl_uint min;
+};
+
+void md_min_enqueue(struct md_device *dev, size_t first, size_t count, void *arg, void **state)
+{
+	struct md_min_arg *a = (struct md_min_arg *) arg;
+	struct md_min_state *st;
+	size_t global_size = MD_MINP_GLOBAL_SIZE;
+	size_t local_size = MD_MINP_LOCAL_SIZE;
+	size_t num_groups = MD_MINP_GLOBAL_SIZE / MD_MINP_LOCAL_SIZE;
+	cl_uint nitems = (cl_uint) count;
+	cl_uint dev_flag;
+	cl_device_type device_type;
+	cl_int err;
+
+	st = (struct md_min_state *) malloc(sizeof(struct md_min_state));
+	if (st == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	clGetDeviceInfo(dev->device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
+	dev_flag = (device_type == CL_DEVICE_TYPE_CPU) ? 0 : 1;
+
+	st->src_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, count * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->dst_buf = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, num_groups * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->dbg_buf = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, 4 * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->minp = clCreateKernel(dev->program, "minp", &err);
+	CL_CHECK_ERR(err);
+	st->reduce = clCreateKernel(dev->program, "reduce", &err);
+	CL_CHECK_ERR(err);
+
+	err = clSetKernelArg(st->minp, 0, sizeof(cl_mem), &st->src_buf);
+	err |= clSetKernelArg(st->minp, 1, sizeof(cl_mem), &st->dst_buf);
+	err |= clSetKernelArg(st->minp, 2, sizeof(cl_uint), NULL);
+	err |= clSetKernelArg(st->minp, 3, sizeof(cl_mem), &st->dbg_buf);
+	err |= clSetKernelArg(st->minp, 4, sizeof(cl_uint), &nitems);
+	err |= clSetKernelArg(st->minp, 5, sizeof(cl_uint), &dev_flag);
+	err |= clSetKernelArg(st->reduce, 0, sizeof(cl_mem), &st->src_buf);
+	err |= clSetKernelArg(st->reduce, 1, sizeof(cl_mem), &st->dst_buf);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueWriteBuffer(dev->queue, st->src_buf, CL_FALSE, 0, count * sizeof(cl_uint), &a->src[first], 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueNDRangeKernel(dev->queue, st->minp, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueNDRangeKernel(dev->queue, st->reduce, 1, NULL, &num_groups, NULL, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(dev->queue, st->dst_buf, CL_FALSE, 0, sizeof(cl_uint), &st->min, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	*state = st;
+}
+
+void md_min_complete(struct md_device *dev, size_t first, size_t count, void *arg, void *state)
+{
+	struct md_min_arg *a = (struct md_min_arg *) arg;
+	struct md_min_state *st = (struct md_min_state *) state;
+	cl_int err;
+
+	if (st->min < a->min)
+		a->min = st->min;
+
+	err = clReleaseMemObject(st->src_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(st->dst_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(st->dbg_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(st->minp); CL_CHECK_ERR(err);
+	err = clReleaseKernel(st->reduce); CL_CHECK_ERR(err);
+	free(st);
+}
+
+struct md_sgemv_arg
+{
+	float *a;
+	float *x;
+	float *y;
+	cl_uint n;
+};
+
+struct md_sgemv_state
+{
+	cl_kernel kernel;
+	cl_mem a_buf;
+	cl_mem x_buf;
+	cl_mem y_buf;
+};
+
+/* Rows are split between devices; each one needs all of x. */
+void md_sgemv_enqueue(struct md_device *dev, size_t first, size_t count, void *arg, void **state)
+{
+	struct md_sgemv_arg *a = (struct md_sgemv_arg *) arg;
+	struct md_sgemv_state *st;
+	size_t local_size = SGEMV_LOCAL_SIZE;
+	size_t max_local_size;
+	size_t global_size;
+	cl_uint m = (cl_uint) count;
+	cl_int err;
+
+	st = (struct md_sgemv_state *) malloc(sizeof(struct md_sgemv_state));
+	if (st == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	st->a_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, count * a->n * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->x_buf = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, a->n * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->y_buf = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, count * sizeof(float), NULL, &err);
+	CL_CHECK_ERR(err);
+	st->kernel = clCreateKernel(dev->program, "sgemv", &err);
+	CL_CHECK_ERR(err);
+
+	err = clGetKernelWorkGroupInfo(st->kernel, dev->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local_size, NULL);
+	CL_CHECK_ERR(err);
+	while (local_size > max_local_size)
+		local_size /= 2;
+	global_size = count * local_size;
+
+	err = clSetKernelArg(st->kernel, 0, sizeof(cl_uint), &m);
+	err |= clSetKernelArg(st->kernel, 1, sizeof(cl_uint), &a->n);
+	err |= clSetKernelArg(st->kernel, 2, sizeof(cl_mem), &st->a_buf);
+	err |= clSetKernelArg(st->kernel, 3, sizeof(cl_mem), &st->x_buf);
+	err |= clSetKernelArg(st->kernel, 4, sizeof(cl_mem), &st->y_buf);
+	err |= clSetKernelArg(st->kernel, 5, local_size * sizeof(float), NULL);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueWriteBuffer(dev->queue, st->a_buf, CL_FALSE, 0, count * a->n * sizeof(float), &a->a[first * a->n], 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueWriteBuffer(dev->queue, st->x_buf, CL_FALSE, 0, a->n * sizeof(float), a->x, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueNDRangeKernel(dev->queue, st->kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(dev->queue, st->y_buf, CL_FALSE, 0, count * sizeof(float), &a->y[first], 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	*state = st;
+}
+
+void md_sgemv_complete(struct md_device *dev, size_t first, size_t count, void *arg, void *state)
+{
+	struct md_sgemv_state *st = (struct md_sgemv_state *) state;
+	cl_int err;
+
+	err = clReleaseMemObject(st->a_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(st->x_buf); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(st->y_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(st->kernel); CL_CHECK_ERR(err);
+	free(st);
+}
+
+/* Calibrate, partition, then run the workload bench_get_reps() times and
+ * record it with the other benchmark results.
+ */
+void run_multi_device_workload(struct md_set *set, const char *name, size_t total, size_t align,
+	md_enqueue_fn enqueue, md_complete_fn complete, void *arg, double bytes_per_item)
+{
+	size_t *counts;
+	double *samples;
+	double best_single = 0.0;
+	int reps = bench_get_reps();
+	int i;
+
+	counts = (size_t *) malloc(set->num * sizeof(size_t));
+	samples = (double *) malloc(reps * sizeof(double));
+	if (counts == NULL || samples == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	printf("%s calibration:\n", name);
+	md_calibrate(set, round_up(total / 16, align), enqueue, complete, arg);
+
+	md_partition(set, total, align, counts);
+	for (i = 0; i < set->num; i++)
+	{
+		printf("    [%d] %s: %u items\n", i, set->devices[i].name, (unsigned int) counts[i]);
+		if (set->devices[i].weight > best_single)
+			best_single = set->devices[i].weight;
+	}
+
+	for (i = 0; i < reps; i++)
+		samples[i] = md_run(set, counts, enqueue, complete, arg);
+
+	bench_set_label("all devices");
+	bench_print(bench_record(name, samples, reps, (double) total * bytes_per_item, (double) total));
+	printf("%s: best single device %.2f M items/sec, combined %.2f M items/sec\n", name,
+		best_single / 1e6, (double) total / samples[reps / 2] / 1e6);
+
+	free(counts);
+	free(samples);
+}
+
+void run_multi_device(cl_device_type device_type, size_t num_keys, size_t num_items, unsigned int rows, unsigned int cols)
+{
+	struct md_set set;
+	struct md_hash_arg hash_arg;
+	struct md_min_arg min_arg;
+	struct md_sgemv_arg sgemv_arg;
+	char *charset = "abcdefghijklmnopqrstuvwxyz";
+	float *ref;
+	cl_uint a, b, min;
+	size_t i, l;
+	int errors;
+
+	if (md_init(&set, device_type, "test.cl") < 1)
+	{
+		printf("run_multi_device(): no devices\n");
+		return;
+	}
+
+	printf("run_multi_device(): %d devices\n", set.num);
+
+	/* Hash a batch of fixed length keys. */
+	hash_arg.len = KEY_LEN;
+	hash_arg.seed = 0;
+	hash_arg.keys = (char *) malloc(num_keys * KEY_LEN);
+	hash_arg.hashes = (unsigned int *) malloc(num_keys * sizeof(unsigned int));
+	if (hash_arg.keys == NULL || hash_arg.hashes == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	l = strlen(charset);
+	for (i = 0; i < num_keys * KEY_LEN; i++)
+		hash_arg.keys[i] = charset[i % l];
+
+	run_multi_device_workload(&set, "multi_device_hash", num_keys, 1, md_hash_enqueue, md_hash_complete, &hash_arg, KEY_LEN);
+
+	errors = 0;
+	for (i = 0; i < num_keys; i++)
+		if (hash_arg.hashes[i] != lookup3(&hash_arg.keys[i * KEY_LEN], KEY_LEN, 0))
+			errors++;
+	printf(bench_check(errors == 0) ? "result correct\n" : "result incorrect\n");
+
+	free(hash_arg.keys);
+	free(hash_arg.hashes);
+
+	/* Min reduction, merged on the host. */
+	num_items -= num_items % MD_MINP_ALIGN;
+	min_arg.src = (cl_uint *) malloc(num_items * sizeof(cl_uint));
+	if (min_arg.src == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	a = b = 12345;
+	min = (cl_uint) -1;
+	for (i = 0; i < num_items; i++)
+	{
+		min_arg.src[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
+		min = min_arg.src[i] < min ? min_arg.src[i] : min;
+	}
+
+	min_arg.min = (cl_uint) -1;
+	run_multi_device_workload(&set, "multi_device_min", num_items, MD_MINP_ALIGN, md_min_enqueue, md_min_complete, &min_arg, sizeof(cl_uint));
+	printf(bench_check(min_arg.min == min) ? "result correct\n" : "result incorrect\n");
+
+	free(min_arg.src);
+
+	/* SGEMV split by rows. */
+	sgemv_arg.n = cols;
+	sgemv_arg.a = (float *) malloc((size_t) rows * cols * sizeof(float));
+	sgemv_arg.x = (float *) malloc(cols * sizeof(float));
+	sgemv_arg.y = (float *) malloc(rows * sizeof(float));
+	ref = (float *) malloc(rows * sizeof(float));
+	if (sgemv_arg.a == NULL || sgemv_arg.x == NULL || sgemv_arg.y == NULL || ref == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	fill_floats(sgemv_arg.a, (size_t) rows * cols, 1);
+	fill_floats(sgemv_arg.x, cols, 2);
+
+	run_multi_device_workload(&set, "multi_device_sgemv", rows, 1, md_sgemv_enqueue, md_sgemv_complete, &sgemv_arg, (double) cols * sizeof(float));
+
+	sgemv_reference(rows, cols, sgemv_arg.a, sgemv_arg.x, ref);
+	printf(bench_check(floats_match(sgemv_arg.y, ref, rows)) ? "result correct\n" : "result incorrect\n");
+
+	free(sgemv_arg.a);
+	free(sgemv_arg.x);
+	free(sgemv_arg.y);
+	free(ref);
+
+	md_release(&set);
+}
+
+/* NUMA comparison for minp. The same data is reduced once on the whole
+ * CPU device and once split across one sub-device per NUMA node. In both
+ * cases each slice's buffer is first written by a copy kernel running on
+ * the (sub-)device that will read it, so with sub-devices the pages land
+ * on the node whose cores scan them.
+ */
+struct numa_slice
+{
+	cl_kernel minp;
+	cl_kernel reduce;
+	cl_mem src_buf;
+	cl_mem dst_buf;
+	cl_mem dbg_buf;
+};
+
+struct numa_minp
+{
+	struct md_set *set;
+	struct numa_slice *slices;
+};
+
+void numa_minp_setup(struct numa_minp *run, struct md_set *set, cl_uint *src, size_t num_items)
+{
+	struct numa_slice *sl;
+	struct md_device *dev;
+	size_t *counts;
+	size_t first, copy_size;
+	cl_kernel copy;
+	cl_mem staging;
+	cl_uint nitems;
+	cl_uint dev_flag = 0;
+	cl_int err;
+	int i;
+
+	run->set = set;
+	run->slices = (struct numa_slice *) malloc(set->num * sizeof(struct numa_slice));
+	counts = (size_t *) malloc(set->num * sizeof(size_t));
+	if (run->slices == NULL || counts == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	md_partition(set, num_items, MD_MINP_ALIGN, counts);
+
+	first = 0;
+	for (i = 0; i < set->num; i++)
+	{
+		dev = &set->devices[i];
+		sl = &run->slices[i];
+		nitems = (cl_uint) counts[i];
+
+		staging = clCreateBuffer(dev->context, CL_MEM_READ_ONLY|CL_MEM_USE_HOST_PTR, counts[i] * sizeof(cl_uint), &src[first], &err);
+		CL_CHECK_ERR(err);
+		sl->src_buf = clCreateBuffer(dev->context, CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, counts[i] * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+		sl->dst_buf = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, (MD_MINP_GLOBAL_SIZE / MD_MINP_LOCAL_SIZE) * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+		sl->dbg_buf = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, 4 * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+
+		/* First touch from the device that owns the slice. */
+		copy = clCreateKernel(dev->program, "copy_uint4", &err);
+		CL_CHECK_ERR(err);
+		err = clSetKernelArg(copy, 0, sizeof(cl_mem), &staging);
+		err |= clSetKernelArg(copy, 1, sizeof(cl_mem), &sl->src_buf);
+		CL_CHECK_ERR(err);
+		copy_size = counts[i] / 4;
+		err = clEnqueueNDRangeKernel(dev->queue, copy, 1, NULL, &copy_size, NULL, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clFinish(dev->queue);
+		CL_CHECK_ERR(err);
+		err = clReleaseKernel(copy); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(staging); CL_CHECK_ERR(err);
+
+		sl->minp = clCreateKernel(dev->program, "minp", &err);
+		CL_CHECK_ERR(err);
+		sl->reduce = clCreateKernel(dev->program, "reduce", &err);
+		CL_CHECK_ERR(err);
+
+		err = clSetKernelArg(sl->minp, 0, sizeof(cl_mem), &sl->src_buf);
+		err |= clSetKernelArg(sl->minp, 1, sizeof(cl_mem), &sl->dst_buf);
+		err |= clSetKernelArg(sl->minp, 2, sizeof(cl_uint), NULL);
+		err |= clSetKernelArg(sl->minp, 3, sizeof(cl_mem), &sl->dbg_buf);
+		err |= clSetKernelArg(sl->minp, 4, sizeof(cl_uint), &nitems);
+		err |= clSetKernelArg(sl->minp, 5, sizeof(cl_uint), &dev_flag);
+		err |= clSetKernelArg(sl->reduce, 0, sizeof(cl_mem), &sl->src_buf);
+		err |= clSetKernelArg(sl->reduce, 1, sizeof(cl_mem), &sl->dst_buf);
+		CL_CHECK_ERR(err);
+
+		first += counts[i];
+	}
+
+	free(counts);
+}
+
+void run_numa_minp_launch(void *arg)
+{
+	struct numa_minp *run = (struct numa_minp *) arg;
+	struct numa_slice *sl;
+	cl_command_queue queue;
+	size_t global_size = MD_MINP_GLOBAL_SIZE;
+	size_t local_size = MD_MINP_LOCAL_SIZE;
+	size_t num_groups = MD_MINP_GLOBAL_SIZE / MD_MINP_LOCAL_SIZE;
+	cl_int err;
+	int i;
+
+	for (i = 0; i < run->set->num; i++)
+	{
+		sl = &run->slices[i];
+		queue = run->set->devices[i].queue;
+
+		err = clEnqueueNDRangeKernel(queue, sl->minp, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clEnqueueNDRangeKernel(queue, sl->reduce, 1, NULL, &num_groups, NULL, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clFlush(queue);
+		CL_CHECK_ERR(err);
+	}
+
+	for (i = 0; i < run->set->num; i++)
+	{
+		err = clFinish(run->set->devices[i].queue);
+		CL_CHECK_ERR(err);
+	}
+}
+
+cl_uint numa_minp_result(struct numa_minp *run)
+{
+	cl_uint min = (cl_uint) -1;
+	cl_uint slice_min;
+	cl_int err;
+	int i;
+
+	for (i = 0; i < run->set->num; i++)
+	{
+		err = clEnqueueReadBuffer(run->set->devices[i].queue, run->slices[i].dst_buf, CL_TRUE, 0, sizeof(cl_uint), &slice_min, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		if (slice_min < min)
+			min = slice_min;
+	}
+
+	return min;
+}
+
+void numa_minp_release(struct numa_minp *run)
+{
+	struct numa_slice *sl;
+	cl_int err;
+	int i;
+
+	for (i = 0; i < run->set->num; i++)
+	{
+		sl = &run->slices[i];
+		err = clReleaseMemObject(sl->src_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(sl->dst_buf); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(sl->dbg_buf); CL_CHECK_ERR(err);
+		err = clReleaseKernel(sl->minp); CL_CHECK_ERR(err);
+		err = clReleaseKernel(sl->reduce); CL_CHECK_ERR(err);
+	}
+
+	free(run->slices);
+}
+
+void run_minp_numa(cl_device_id device, size_t num_items)
+{
+	cl_device_id *sub_devices;
+	int num_sub_devices;
+	struct md_set whole, nodes;
+	struct numa_minp run;
+	cl_uint *src;
+	cl_uint a, b, min;
+	size_t i;
+
+	num_sub_devices = get_sub_devices(device, CL_DEVICE_AFFINITY_DOMAIN_NUMA, &sub_devices);
+	if (num_sub_devices < 1)
+	{
+		printf("run_minp_numa(): device cannot be partitioned by NUMA node\n");
+		return;
+	}
+
+	printf("run_minp_numa(): %d NUMA nodes\n", num_sub_devices);
+
+	num_items -= num_items % (MD_MINP_ALIGN * num_sub_devices);
+	src = (cl_uint *) malloc(num_items * sizeof(cl_uint));
+	if (src == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	a = b = 12345;
+	min = (cl_uint) -1;
+	for (i = 0; i < num_items; i++)
+	{
+		src[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
+		min = src[i] < min ? src[i] : min;
+	}
+
+	/* Whole device. */
+	whole.devices = NULL;
+	whole.num = 0;
+	md_init_devices(&whole, &device, 1, "test.cl");
+	numa_minp_setup(&run, &whole, src, num_items);
+	bench_run("minp whole device", run_numa_minp_launch, &run, (double) num_items * sizeof(cl_uint), (double) num_items);
+	printf(bench_check(numa_minp_result(&run) == min) ? "result correct\n" : "result incorrect\n");
+	numa_minp_release(&run);
+	md_release(&whole);
+
+	/* One sub-device per NUMA node, each reducing its own slice. */
+	nodes.devices = NULL;
+	nodes.num = 0;
+	md_init_devices(&nodes, sub_devices, num_sub_devices, "test.cl");
+	numa_minp_setup(&run, &nodes, src, num_items);
+	bench_run("minp per NUMA node", run_numa_minp_launch, &run, (double) num_items * sizeof(cl_uint), (double) num_items);
+	printf(bench_check(numa_minp_result(&run) == min) ? "result correct\n" : "result incorrect\n");
+	numa_minp_release(&run);
+	md_release(&nodes);
+
+	release_sub_devices(sub_devices, num_sub_devices);
+	free(src);
+}
+
+/* Streaming drivers. The input is read chunk by chunk from a file or from
+ * memory and pushed through a ring of device buffers, so it can be larger
+ * than CL_DEVICE_MAX_MEM_ALLOC_SIZE and transfers overlap with compute.
+ */
+#define STREAM_CHUNK_SIZE (16 << 20)
+#define STREAM_NUM_BUFFERS 3
+
+/* Input source with rewind support so the benchmark can repeat a run.
+ * Files are mapped rather than read, so each chunk is copied once, from
+ * the page cache straight into the pinned staging buffer. Pipes and other
+ * unmappable inputs are read into memory once by mapfile_open.
+ */
+struct stream_source
+{
+	const char *filename;
+	struct mapped_file file;
+	struct stream_memory mem;
+	size_t pad_to;
+	int pad_byte;
+};
+
+size_t stream_source_read(void *src, void *buf, size_t max)
+{
+	struct stream_source *ss = (struct stream_source *) src;
+	size_t n, padded;
+
+	n = stream_read_memory(&ss->mem, buf, max);
+
+	/* Pad a short final chunk to whole records. */
+	if (n % ss->pad_to != 0)
+	{
+		padded = round_up(n, ss->pad_to);
+		memset((char *) buf + n, ss->pad_byte, padded - n);
+		n = padded;
+	}
+
+	return n;
+}
+
+void stream_source_rewind(struct stream_source *ss)
+{
+	ss->mem.pos = 0;
+}
+
+/* Open filename, or fall back to the given synthetic data if it is NULL. */
+void stream_source_open(struct stream_source *ss, const char *filename, const char *data, size_t size, size_t pad_to, int pad_byte)
+{
+	ss->filename = filename;
+	ss->mem.data = data;
+	ss->mem.size = size;
+	ss->mem.pos = 0;
+	ss->pad_to = pad_to;
+	ss->pad_byte = pad_byte;
+
+	if (filename != NULL)
+	{
+		mapfile_open(&ss->file, filename);
+		ss->mem.data = (const char *) ss->file.data;
+		ss->mem.size = ss->file.size;
+	}
+}
+
+void stream_source_close(struct stream_source *ss)
+{
+	if (ss->filename != NULL)
+		mapfile_close(&ss->file);
+}
+
+struct stream_hash_arg
+{
+	struct stream *stream;
+	struct stream_source *source;
+	cl_kernel kernel;
+	unsigned int len;
+	unsigned int seed;
+	int verify;
+	size_t keys;
+	size_t errors;
+};
+
+size_t stream_hash_kernel(cl_command_queue queue, cl_mem in, cl_mem out, size_t in_bytes, void *arg,
+	cl_uint num_wait, const cl_event *wait, cl_event *done)
+{
+	struct stream_hash_arg *a = (struct stream_hash_arg *) arg;
+	size_t num_keys = in_bytes / a->len;
+	cl_int err;
+
+	err = clSetKernelArg(a->kernel, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(a->kernel, 1, sizeof(unsigned int), &a->len);
+	err |= clSetKernelArg(a->kernel, 2, sizeof(unsigned int), &a->seed);
+	err |= clSetKernelArg(a->kernel, 3, sizeof(cl_mem), &out);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueNDRangeKernel(queue, a->kernel, 1, NULL, &num_keys, NULL, num_wait, wait, done);
+	CL_CHECK_ERR(err);
+
+	return num_keys * sizeof(unsigned int);
+}
+
+void stream_hash_output(const void *in, size_t in_bytes, const void *out, size_t out_bytes, void *arg)
+{
+	struct stream_hash_arg *a = (struct stream_hash_arg *) arg;
+	const unsigned int *hashes = (const unsigned int *) out;
+	size_t num_keys = in_bytes / a->len;
+	size_t i;
+
+	a->keys += num_keys;
+
+	if (!a->verify)
+		return;
+
+	for (i = 0; i < num_keys; i++)
+		if (hashes[i] != lookup3((char *) in + i * a->len, a->len, a->seed))
+			a->errors++;
+}
+
+void run_stream_hash_once(void *arg)
+{
+	struct stream_hash_arg *a = (struct stream_hash_arg *) arg;
+
+	stream_source_rewind(a->source);
+	a->keys = 0;
+	stream_run(a->stream, stream_source_read, a->source, stream_hash_kernel, stream_hash_output, a);
+}
+
+/* Hash fixed length keys from filename, or num_keys synthetic keys. */
+void run_stream_hash(cl_context context, cl_device_id device, cl_program program, const char *filename, size_t num_keys)
+{
+	struct stream s;
+	struct stream_source source;
+	struct stream_hash_arg arg;
+	char *charset = "abcdefghijklmnopqrstuvwxyz";
+	char *keys = NULL;
+	size_t chunk_size, i, l;
+	cl_int err;
+
+	if (filename == NULL)
+	{
+		keys = (char *) malloc(num_keys * KEY_LEN);
+		if (keys == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+
+		l = strlen(charset);
+		for (i = 0; i < num_keys * KEY_LEN; i++)
+			keys[i] = charset[i % l];
+	}
+
+	stream_source_open(&source, filename, keys, num_keys * KEY_LEN, KEY_LEN, 0);
+
+	chunk_size = STREAM_CHUNK_SIZE - STREAM_CHUNK_SIZE % KEY_LEN;
+	stream_init(&s, context, device, chunk_size, (chunk_size / KEY_LEN) * sizeof(unsigned int), STREAM_NUM_BUFFERS);
+
+	arg.stream = &s;
+	arg.source = &source;
+	arg.len = KEY_LEN;
+	arg.seed = 0;
+	arg.errors = 0;
+	arg.kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+	CL_CHECK_ERR(err);
+
+	/* Checked pass first, then timed passes without the CPU comparison. */
+	arg.verify = 1;
+	run_stream_hash_once(&arg);
+	printf("run_stream_hash(): %u keys, %s\n", (unsigned int) arg.keys, bench_check(arg.errors == 0) ? "result correct" : "result incorrect");
+
+	arg.verify = 0;
+	bench_run("stream lookup3_hash_keys", run_stream_hash_once, &arg, (double) arg.keys * KEY_LEN, (double) arg.keys);
+
+	err = clReleaseKernel(arg.kernel); CL_CHECK_ERR(err);
+	stream_release(&s);
+	stream_source_close(&source);
+
+	if (keys != NULL)
+		free(keys);
+}
+
+/* minp over each chunk with the same fixed NDRange as the multi-device
+ * driver; chunks are padded with 0xffffffff, which cannot lower the min.
+ */
+struct stream_min_arg
+{
+	struct stream *stream;
+	struct stream_source *source;
+	cl_kernel minp;
+	cl_kernel reduce;
+	cl_mem dbg_buf;
+	cl_uint dev_flag;
+	int verify;
+	size_t items;
+	size_t errors;
+	cl_uint min;
+};
+
+size_t stream_min_kernel(cl_command_queue queue, cl_mem in, cl_mem out, size_t in_bytes, void *arg,
+	cl_uint num_wait, const cl_event *wait, cl_event *done)
+{
+	struct stream_min_arg *a = (struct stream_min_arg *) arg;
+	size_t global_size = MD_MINP_GLOBAL_SIZE;
+	size_t local_size = MD_MINP_LOCAL_SIZE;
+	size_t num_groups = MD_MINP_GLOBAL_SIZE / MD_MINP_LOCAL_SIZE;
+	cl_uint nitems = (cl_uint) (in_bytes / sizeof(cl_uint));
+	cl_int err;
+
+	err = clSetKernelArg(a->minp, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(a->minp, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(a->minp, 2, sizeof(cl_uint), NULL);
+	err |= clSetKernelArg(a->minp, 3, sizeof(cl_mem), &a->dbg_buf);
+	err |= clSetKernelArg(a->minp, 4, sizeof(cl_uint), &nitems);
+	err |= clSetKernelArg(a->minp, 5, sizeof(cl_uint), &a->dev_flag);
+	err |= clSetKernelArg(a->reduce, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(a->reduce, 1, sizeof(cl_mem), &out);
 	CL_CHECK_ERR(err);
-	
-	/* Enqueue kernel. */
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, &ev[0]); 
+
+	err = clEnqueueNDRangeKernel(queue, a->minp, 1, NULL, &global_size, &local_size, num_wait, wait, NULL);
 	CL_CHECK_ERR(err);
-	
-	/* Copy the output. */
-	err = clEnqueueReadBuffer(queue, hashes_buf, CL_FALSE, 0, global_size * sizeof(unsigned int), hashes, 0, NULL, &ev[1]);
+	err = clEnqueueNDRangeKernel(queue, a->reduce, 1, NULL, &num_groups, NULL, 0, NULL, done);
 	CL_CHECK_ERR(err);
 
-	err = clWaitForEvents(2, ev);
-	CL_CHECK_ERR(err);
+	return sizeof(cl_uint);
+}
 
-	err = clReleaseEvent(ev[0]);
-	err = clReleaseEvent(ev[1]);
-	CL_CHECK_ERR(err);
-	
-	clFinish(queue); // should be unnecessary since we're waiting for events above
-	
-	/* Print result. */
-	printf("run_hash_test():\n");
+void stream_min_output(const void *in, size_t in_bytes, const void *out, size_t out_bytes, void *arg)
+{
+	struct stream_min_arg *a = (struct stream_min_arg *) arg;
+	const cl_uint *src = (const cl_uint *) in;
+	cl_uint chunk_min = *(const cl_uint *) out;
+	cl_uint min;
+	size_t i, n = in_bytes / sizeof(cl_uint);
+
+	a->items += n;
+	if (chunk_min < a->min)
+		a->min = chunk_min;
+
+	if (!a->verify)
+		return;
+
+	min = (cl_uint) -1;
+	for (i = 0; i < n; i++)
+		min = src[i] < min ? src[i] : min;
+	if (min != chunk_min)
+		a->errors++;
+}
+
+void run_stream_min_once(void *arg)
+{
+	struct stream_min_arg *a = (struct stream_min_arg *) arg;
+
+	stream_source_rewind(a->source);
+	a->items = 0;
+	a->min = (cl_uint) -1;
+	stream_run(a->stream, stream_source_read, a->source, stream_min_kernel, stream_min_output, a);
+}
+
+/* Min of the uints in filename, or of num_items synthetic values. */
+void run_stream_min(cl_context context, cl_device_id device, cl_program program, const char *filename, size_t num_items)
+{
+	struct stream s;
+	struct stream_source source;
+	struct stream_min_arg arg;
+	cl_uint *src = NULL;
+	cl_uint a, b;
+	cl_device_type device_type;
+	size_t chunk_size, i;
+	cl_int err;
 
-	for (i = 0; i < global_size; i++)
+	if (filename == NULL)
 	{
-		l = lookup3(&keys[i*len], len, seed);
-		printf("%d: %d %d\n", i, hashes[i], l);
+		src = (cl_uint *) malloc(num_items * sizeof(cl_uint));
+		if (src == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+
+		a = b = 12345;
+		for (i = 0; i < num_items; i++)
+			src[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
 	}
 
-	/* Clean up. */
-	err = clReleaseMemObject(keys_buf); CL_CHECK_ERR(err);
-	err = clReleaseMemObject(hashes_buf); CL_CHECK_ERR(err);
-	err = clReleaseKernel(kernel); CL_CHECK_ERR(err);
-	
-	free(keys);
-	free(hashes);
+	stream_source_open(&source, filename, (char *) src, num_items * sizeof(cl_uint), MD_MINP_ALIGN * sizeof(cl_uint), 0xff);
+
+	chunk_size = STREAM_CHUNK_SIZE - STREAM_CHUNK_SIZE % (MD_MINP_ALIGN * sizeof(cl_uint));
+	stream_init(&s, context, device, chunk_size, (MD_MINP_GLOBAL_SIZE / MD_MINP_LOCAL_SIZE) * sizeof(cl_uint), STREAM_NUM_BUFFERS);
+
+	clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
+
+	arg.stream = &s;
+	arg.source = &source;
+	arg.dev_flag = (device_type == CL_DEVICE_TYPE_CPU) ? 0 : 1;
+	arg.errors = 0;
+	arg.minp = clCreateKernel(program, "minp", &err);
+	CL_CHECK_ERR(err);
+	arg.reduce = clCreateKernel(program, "reduce", &err);
+	CL_CHECK_ERR(err);
+	arg.dbg_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 4 * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	arg.verify = 1;
+	run_stream_min_once(&arg);
+	printf("run_stream_min(): %u items, min %u, %s\n", (unsigned int) arg.items, arg.min, bench_check(arg.errors == 0) ? "result correct" : "result incorrect");
+
+	arg.verify = 0;
+	bench_run("stream minp", run_stream_min_once, &arg, (double) arg.items * sizeof(cl_uint), (double) arg.items);
+
+	err = clReleaseMemObject(arg.dbg_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(arg.minp); CL_CHECK_ERR(err);
+	err = clReleaseKernel(arg.reduce); CL_CHECK_ERR(err);
+	stream_release(&s);
+	stream_source_close(&source);
+
+	if (src != NULL)
+		free(src);
 }
 
-#define NLOOPS 500
+/* Drivers over a memory-mapped input file. The mapping is wrapped in
+ * CL_MEM_USE_HOST_PTR buffers a slice at a time, so files larger than
+ * CL_DEVICE_MAX_MEM_ALLOC_SIZE work and CPU runtimes read the page cache
+ * directly. Slices start on page boundaries to keep that possible.
+ */
+#define MAPPED_PAGE_SIZE 4096
 
-void run_minp_test(cl_context context, cl_command_queue queue, cl_program program)
+size_t mapped_slice_size(cl_device_id device, size_t record_size)
 {
-	cl_kernel minp;
-	cl_kernel reduce;
-	cl_event ev;
-	unsigned int num_src_items = 4096*4096;
-	cl_uint i;
-	INT64 c0, c1, freq;
-	double elapsed;
-	int nloops = NLOOPS;
-	int dev, nw;
-	cl_uint ws = 64;
-	time_t ltime;
-	cl_uint *src_ptr;
-	cl_uint a, b, min;
-	cl_mem src_buf, dst_buf, dbg_buf;
-	cl_uint *dst_ptr, *dbg_ptr;
-	cl_uint compute_units;
-	size_t global_work_size, local_work_size, num_groups;
-	cl_device_id device;
-	cl_device_type device_type;
+	cl_ulong max_alloc;
+	size_t unit = record_size * MAPPED_PAGE_SIZE;
+	cl_int err;
 
-	time(&ltime);
-	src_ptr = (cl_uint *) malloc(num_src_items * sizeof(cl_uint));
-	a = (cl_uint) ltime,
-	b = (cl_uint) ltime;
-	min = (cl_uint) -1;
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	CL_CHECK_ERR(err);
+
+	return (size_t) (max_alloc - max_alloc % unit);
+}
+
+struct mapped_hash_arg
+{
+	struct mapped_file *file;
+	cl_context context;
+	cl_command_queue queue;
+	cl_kernel kernel;
+	size_t slice_size;
+	size_t num_keys;
+	unsigned int *hashes;
+	cl_mem hashes_buf;
+	int zero_copy;
+};
+
+/* Hash every KEY_LEN byte record in the file; a partial last record is
+ * ignored.
+ */
+void run_mapped_hash_once(void *arg)
+{
+	struct mapped_hash_arg *a = (struct mapped_hash_arg *) arg;
+	cl_uint len = KEY_LEN;
+	cl_uint seed = 0;
+	size_t offset, bytes, n;
+	cl_mem keys_buf;
+	cl_int err;
 
-	for (i = 0; i < num_src_items; i++)
+	for (offset = 0; offset < a->num_keys * KEY_LEN; offset += bytes)
 	{
-		src_ptr[i] = (cl_uint) (b = ( a * (b & 65535)) + (b >> 16));
-		min	= src_ptr[i] < min ? src_ptr[i] : min;
+		bytes = a->num_keys * KEY_LEN - offset;
+		if (bytes > a->slice_size)
+			bytes = a->slice_size;
+		n = bytes / KEY_LEN;
+
+		keys_buf = mapfile_buffer(a->file, a->context, offset, bytes, &a->zero_copy);
+
+		err = clSetKernelArg(a->kernel, 0, sizeof(cl_mem), &keys_buf);
+		err |= clSetKernelArg(a->kernel, 1, sizeof(cl_uint), &len);
+		err |= clSetKernelArg(a->kernel, 2, sizeof(cl_uint), &seed);
+		err |= clSetKernelArg(a->kernel, 3, sizeof(cl_mem), &a->hashes_buf);
+		CL_CHECK_ERR(err);
+
+		err = clEnqueueNDRangeKernel(a->queue, a->kernel, 1, NULL, &n, NULL, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clEnqueueReadBuffer(a->queue, a->hashes_buf, CL_TRUE, 0, n * sizeof(cl_uint), a->hashes + offset / KEY_LEN, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		err = clReleaseMemObject(keys_buf); CL_CHECK_ERR(err);
 	}
-	
-	clGetContextInfo(context, CL_CONTEXT_DEVICES, 1, &device, NULL);
-	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
-	clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(cl_uint), &device_type, NULL);
+}
 
-	if (device_type == CL_DEVICE_TYPE_CPU)
+void run_mapped_hash(cl_context context, cl_device_id device, cl_command_queue queue, cl_program program, const char *filename)
+{
+	struct mapped_file file;
+	struct mapped_hash_arg arg;
+	size_t i, errors;
+	cl_int err;
+
+	mapfile_open(&file, filename);
+
+	arg.file = &file;
+	arg.context = context;
+	arg.queue = queue;
+	arg.num_keys = file.size / KEY_LEN;
+	arg.slice_size = mapped_slice_size(device, KEY_LEN);
+	arg.zero_copy = 0;
+
+	printf("run_mapped_hash(%s): %lu keys\n", filename, (unsigned long) arg.num_keys);
+	if (arg.num_keys == 0)
 	{
-		global_work_size = compute_units * 1; // 1 thread per core
-		local_work_size = 1;
+		mapfile_close(&file);
+		return;
 	}
-	else
+
+	arg.hashes = (unsigned int *) malloc(arg.num_keys * sizeof(unsigned int));
+	if (arg.hashes == NULL)
 	{
-		global_work_size = compute_units * 7 * ws; // 7 wavefronts per SIMD
-		while ((num_src_items / 4) % global_work_size != 0)
-			global_work_size += ws;
-		local_work_size = ws;
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
 	}
-		
-	num_groups = global_work_size / local_work_size;
 
-	minp = clCreateKernel(program, "minp", NULL);
-	reduce = clCreateKernel(program, "reduce", NULL);
+	arg.hashes_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, (arg.num_keys < arg.slice_size / KEY_LEN ? arg.num_keys : arg.slice_size / KEY_LEN) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	arg.kernel = clCreateKernel(program, "lookup3_hash_keys", &err);
+	CL_CHECK_ERR(err);
 
-	src_buf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, num_src_items * sizeof(cl_uint), src_ptr, NULL);
-	dst_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, num_groups * sizeof(cl_uint), NULL, NULL); 
-	dbg_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, global_work_size * sizeof(cl_uint), NULL, NULL);
-		
-	clSetKernelArg(minp, 0, sizeof(void *), (void*) &src_buf);
-	clSetKernelArg(minp, 1, sizeof(void *), (void*) &dst_buf);
-	clSetKernelArg(minp, 2, sizeof(cl_uint), (void*) NULL);
-	clSetKernelArg(minp, 3, sizeof(void *), (void*) &dbg_buf);
-	clSetKernelArg(minp, 4, sizeof(num_src_items), (void*) &num_src_items);
-	clSetKernelArg(minp, 5, sizeof(dev), (void*) &dev);
-	clSetKernelArg(reduce, 0, sizeof(void *), (void*) &src_buf);
-	clSetKernelArg(reduce, 1, sizeof(void *), (void*) &dst_buf);
-		
-	QueryPerformanceCounter(&c0);
+	run_mapped_hash_once(&arg);
+
+	errors = 0;
+	for (i = 0; i < arg.num_keys; i++)
+		if (arg.hashes[i] != lookup3((const char *) file.data + i * KEY_LEN, KEY_LEN, 0))
+			errors++;
+
+	printf("%s, %s\n", arg.zero_copy ? "zero copy" : "copied", bench_check(errors == 0) ? "result correct" : "result incorrect");
+
+	bench_run("mapped lookup3_hash_keys", run_mapped_hash_once, &arg, (double) arg.num_keys * KEY_LEN, (double) arg.num_keys);
+
+	err = clReleaseMemObject(arg.hashes_buf); CL_CHECK_ERR(err);
+	err = clReleaseKernel(arg.kernel); CL_CHECK_ERR(err);
+	free(arg.hashes);
+	mapfile_close(&file);
+}
+
+struct mapped_reduce_arg
+{
+	struct mapped_file *file;
+	struct reducer *r;
+	cl_context context;
+	size_t slice_size;
+	size_t n;
+	int op;
+	struct reduce_result result;
+	int zero_copy;
+};
+
+/* Reduce the file as an array of cl_uint, combining the slices on the
+ * host.
+ */
+void run_mapped_reduce_once(void *arg)
+{
+	struct mapped_reduce_arg *a = (struct mapped_reduce_arg *) arg;
+	struct reduce_result part;
+	size_t offset, bytes;
+	cl_mem src;
+	cl_int err;
 
-	while(nloops--) 
+	for (offset = 0; offset < a->n * sizeof(cl_uint); offset += bytes)
 	{
-		clEnqueueNDRangeKernel( queue, minp, 1, NULL, &global_work_size, &local_work_size, 0, NULL, &ev);
-		clEnqueueNDRangeKernel( queue, reduce, 1, NULL, &num_groups, NULL, 1, &ev, NULL);
+		bytes = a->n * sizeof(cl_uint) - offset;
+		if (bytes > a->slice_size)
+			bytes = a->slice_size;
+
+		src = mapfile_buffer(a->file, a->context, offset, bytes, &a->zero_copy);
+		reducer_run(a->r, src, bytes / sizeof(cl_uint), &part);
+		err = clReleaseMemObject(src); CL_CHECK_ERR(err);
+
+		if (offset == 0)
+			a->result = part;
+		else if (a->op == REDUCE_SUM)
+			a->result.value.u += part.value.u;
+		else if (part.value.u < a->result.value.u)
+			a->result.value.u = part.value.u;
 	}
+}
 
-	clFinish(queue);
-	
-	QueryPerformanceCounter(&c1);
-	QueryPerformanceFrequency(&freq);
-	elapsed = (c1 - c0) / freq;
+void run_mapped_reduce(cl_context context, cl_device_id device, cl_command_queue queue, const char *filename)
+{
+	static const int ops[] = { REDUCE_SUM, REDUCE_MIN };
+	struct mapped_file file;
+	struct reducer r;
+	struct mapped_reduce_arg arg;
+	struct reduce_result ref;
+	char name[64];
+	int i;
 
-	printf("B/W %.2f GB/sec, ", ((float) num_src_items * sizeof(cl_uint) * NLOOPS) / elapsed / 1e9);
+	mapfile_open(&file, filename);
 
-	dst_ptr = (cl_uint *) clEnqueueMapBuffer(queue, dst_buf, CL_TRUE, CL_MAP_READ, 0,  num_groups * sizeof(cl_uint), 0, NULL, NULL, NULL);
-	dbg_ptr = (cl_uint *) clEnqueueMapBuffer(queue, dbg_buf, CL_TRUE, CL_MAP_READ, 0,  global_work_size * sizeof(cl_uint), 0, NULL, NULL, NULL);
-		
-	printf("%d groups, %d threads, count %d, stride %d\n", dbg_ptr[0], dbg_ptr[1], dbg_ptr[2], dbg_ptr[3]);
-	if (dst_ptr[0] == min)
-		printf("result correct\n");
-	else
-		printf("result incorrect\n");
-	printf("\n");
+	arg.file = &file;
+	arg.r = &r;
+	arg.context = context;
+	arg.n = file.size / sizeof(cl_uint);
+	arg.slice_size = mapped_slice_size(device, sizeof(cl_uint));
+	arg.zero_copy = 0;
+
+	printf("run_mapped_reduce(%s): %lu uints\n", filename, (unsigned long) arg.n);
+
+	for (i = 0; i < (int) (sizeof(ops) / sizeof(ops[0])) && arg.n > 0; i++)
+	{
+		arg.op = ops[i];
+		reducer_init(&r, context, device, queue, REDUCE_UINT, ops[i], REDUCE_ON_DEVICE);
+
+		run_mapped_reduce_once(&arg);
+		reduce_host(file.data, arg.n, REDUCE_UINT, ops[i], &ref);
+
+		snprintf(name, sizeof(name), "mapped reduce uint %s", reduce_op_name(ops[i]));
+		printf("%s: %s, %s\n", name, arg.zero_copy ? "zero copy" : "copied", bench_check(arg.result.value.u == ref.value.u) ? "result correct" : "result incorrect");
+		bench_run(name, run_mapped_reduce_once, &arg, (double) arg.n * sizeof(cl_uint), (double) arg.n);
+
+		reducer_release(&r);
+	}
+
+	mapfile_close(&file);
+}
+
+/* Command line driver. Each test wraps one run_* function with a default
+ * problem size that --size or name=size in --tests overrides, so sweeps
+ * can be scripted without recompiling.
+ */
+struct test_args
+{
+	cl_context context;
+	cl_device_id device;
+	cl_command_queue queue;
+	cl_program program;
+	struct rt_device *dev;
+	size_t size;
+	unsigned int key_len;
+	const char *input_file;
+};
+
+typedef void (*test_fn)(const struct test_args *a);
+
+/* per_mode tests run once per --buffers mode, the rest once per device. */
+struct test_entry
+{
+	const char *name;
+	test_fn fn;
+	size_t default_size;
+	int in_default;
+	int per_mode;
+	const char *description;
+};
+
+void test_get_ids(const struct test_args *a) { run_get_ids(a->context, a->queue, a->program); }
+void test_sum_numbers(const struct test_args *a) { run_sum_numbers(a->context, a->queue, a->program, a->size); }
+void test_matrix_multiply(const struct test_args *a) { run_matrix_multiply(a->context, a->queue, a->program, (unsigned int) a->size); }
+void test_sgemv(const struct test_args *a) { run_sgemv(a->context, a->queue, a->program, (unsigned int) a->size, (unsigned int) a->size); }
+void test_sgemm(const struct test_args *a) { run_sgemm(a->context, a->queue, a->program, (unsigned int) a->size, (unsigned int) a->size, (unsigned int) a->size); }
+void test_hash(const struct test_args *a) { run_hash_test(a->context, a->queue, a->program, a->size, a->key_len); }
+void test_hash_soa(const struct test_args *a) { run_hash_soa_test(a->context, a->queue, a->program, a->size); }
+void test_hash_batch(const struct test_args *a) { run_hash_batch(a->context, a->queue, a->program, a->size); }
+void test_reduce(const struct test_args *a) { run_reduce_test(a->context, a->device, a->queue, a->size); }
+void test_scan(const struct test_args *a) { run_scan_test(a->context, a->device, a->queue, a->program, a->size); }
+void test_hash_table(const struct test_args *a) { run_hash_table_test(a->context, a->queue, a->program, a->size); }
+void test_service(const struct test_args *a) { run_service_test(a->dev, a->size); }
+void test_batch(const struct test_args *a) { run_batch_test(a->context, a->device, a->queue, a->program, a->size); }
+void test_host_threads(const struct test_args *a) { run_host_scaling(a->context, a->device, a->program, a->size, a->key_len); }
+void test_spec(const struct test_args *a) { run_spec_test(a->context, a->device, a->queue); }
+void test_minp(const struct test_args *a) { run_minp_test(a->context, a->queue, a->program, (unsigned int) a->size); }
+
+void test_stream(const struct test_args *a)
+{
+	run_stream_hash(a->context, a->device, a->program, a->input_file, a->size);
+	run_stream_min(a->context, a->device, a->program, a->input_file, a->size * 128);
+}
+
+void test_mapped(const struct test_args *a)
+{
+	if (a->input_file == NULL)
+	{
+		printf("mapped: needs --input FILE, skipped\n");
+		return;
+	}
+
+	run_mapped_hash(a->context, a->device, a->queue, a->program, a->input_file);
+	run_mapped_reduce(a->context, a->device, a->queue, a->input_file);
+}
+
+void test_numa(const struct test_args *a) { run_minp_numa(a->device, a->size); }
+void test_membench(const struct test_args *a) { membench_run(a->context, a->device, a->queue, a->size); }
+
+static const struct test_entry tests[] =
+{
+	{ "get_ids", test_get_ids, GLOBAL_SIZE, 1, 1, "work-item ids (fixed size)" },
+	{ "sum_numbers", test_sum_numbers, GLOBAL_SIZE, 1, 1, "sum of an n x n matrix" },
+	{ "matrix_multiply", test_matrix_multiply, GLOBAL_SIZE, 1, 1, "naive n x n matrix-vector product" },
+	{ "sgemv", test_sgemv, 4096, 0, 1, "n x n matrix-vector product" },
+	{ "sgemm", test_sgemm, 512, 0, 1, "tiled n x n x n matrix product" },
+	{ "hash", test_hash, GLOBAL_SIZE, 1, 1, "lookup3 and the 64-bit hashes over n fixed length keys" },
+	{ "hash_soa", test_hash_soa, 1 << 18, 0, 0, "lookup3 over n packed and interleaved keys per key length" },
+	{ "hash_batch", test_hash_batch, 1 << 22, 0, 1, "lookup3 over n variable length keys" },
+	{ "reduce", test_reduce, 10000019, 0, 1, "every reduction type and operator over n items" },
+	{ "scan", test_scan, 10000019, 0, 1, "scan, compaction and histogram over n items" },
+	{ "hash_table", test_hash_table, 1 << 22, 0, 1, "hash table build and probe with n slots" },
+	{ "service", test_service, 4096, 0, 1, "repeated batches of n keys, cold and pooled" },
+	{ "batch", test_batch, 4096, 0, 1, "n small hash and min requests, batched and persistent" },
+	{ "host_threads", test_host_threads, 1 << 22, 0, 0, "n keys hashed end to end, one queue per host thread" },
+	{ "spec", test_spec, 0, 0, 1, "specialized kernel variants (fixed size)" },
+	{ "minp", test_minp, 4096 * 4096, 1, 1, "min of n items" },
+	{ "stream", test_stream, 1 << 20, 0, 0, "n keys and 128n items streamed, or --input" },
+	{ "mapped", test_mapped, 0, 0, 0, "hash and reduce the --input file" },
+	{ "numa", test_numa, 1 << 26, 0, 0, "min of n items per NUMA node" },
+	{ "membench", test_membench, 256 << 20, 0, 0, "bandwidth, launch and FMA ceilings over n bytes" },
+};
+
+#define NUM_TESTS ((int) (sizeof(tests) / sizeof(tests[0])))
+
+void print_usage(const char *prog)
+{
+	int i;
+
+	printf("Usage: %s [options]\n\n", prog);
+	printf("  --list                     list the tests\n");
+	printf("  --tests t1[=n],t2[=n],...  tests to run, \"all\" or \"default\"\n");
+	printf("  --size n                   problem size for every test\n");
+	printf("  --key-len n                fixed key length for the hash test (%d)\n", KEY_LEN);
+	printf("  --platform str             only platforms whose name contains str\n");
+	printf("  --device str               only devices whose name contains str\n");
+	printf("  --type cpu|gpu|accelerator|all\n");
+	printf("  --host-threads n           host threads for inputs, checks and submission (%d)\n", get_num_cpus());
+	printf("  --reps n                   timed repetitions (%d)\n", BENCH_DEFAULT_REPS);
+	printf("  --warmup n                 warmup repetitions (%d)\n", BENCH_DEFAULT_WARMUP);
+	printf("  --format table|csv         summary format\n");
+	printf("  --csv file                 append results to file\n");
+	printf("  --verbose                  print per-element results\n");
+	printf("  --verify                   check every test once, exit 1 on a mismatch\n");
+	printf("  --buffers copy|zero-copy|both\n");
+	printf("  --input file               input for the stream and mapped tests\n");
+	printf("  --multi-device             split workloads across every device\n");
+	printf("  --profile, --trace file, --profile-csv file\n");
+	printf("  --autotune, --retune\n");
+	printf("\nTests:\n");
+	for (i = 0; i < NUM_TESTS; i++)
+		printf("  %-16s %-8s %s\n", tests[i].name, tests[i].in_default ? "default" : "", tests[i].description);
+}
+
+int find_test(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < NUM_TESTS; i++)
+		if (strlen(tests[i].name) == len && strncmp(tests[i].name, name, len) == 0)
+			return i;
+
+	return -1;
+}
+
+/* Parse "name[=size],..." into selected[] and sizes[]. Returns 0 on an
+ * unknown test name.
+ */
+int parse_tests(const char *list, int *selected, size_t *sizes)
+{
+	const char *p, *end, *eq;
+	int i, t;
+
+	for (p = list; *p != '\0'; p = *end ? end + 1 : end)
+	{
+		end = strchr(p, ',');
+		if (end == NULL)
+			end = p + strlen(p);
+
+		eq = memchr(p, '=', end - p);
+
+		if ((size_t) ((eq ? eq : end) - p) == strlen("all") && strncmp(p, "all", 3) == 0)
+		{
+			for (i = 0; i < NUM_TESTS; i++)
+				selected[i] = 1;
+			continue;
+		}
+
+		if ((size_t) ((eq ? eq : end) - p) == strlen("default") && strncmp(p, "default", 7) == 0)
+		{
+			for (i = 0; i < NUM_TESTS; i++)
+				selected[i] |= tests[i].in_default;
+			continue;
+		}
+
+		t = find_test(p, (eq ? eq : end) - p);
+		if (t < 0)
+		{
+			fprintf(stderr, "Unknown test: %.*s\n", (int) ((eq ? eq : end) - p), p);
+			return 0;
+		}
+
+		selected[t] = 1;
+		if (eq != NULL)
+			sizes[t] = (size_t) strtoull(eq + 1, NULL, 0);
+	}
+
+	return 1;
+}
+
+int name_matches(const char *name, const char *filter)
+{
+	return filter == NULL || strstr(name, filter) != NULL;
 }
 
 int main(int argc, char **argv)
 {
-	cl_int err;
 	cl_platform_id *platforms = NULL;
 	cl_int num_platforms;
 	cl_device_id *devices = NULL;
 	cl_int num_devices;
+	cl_uint num;
 	
-	cl_context context;
-	cl_command_queue queue;
-	cl_program program;
+	struct runtime rt;
+	struct test_args args;
+	int selected[NUM_TESTS];
+	size_t sizes[NUM_TESTS];
+	int any_selected;
+
+	int i, j, t;
+	int hits, misses, rejects;
+	int multi_device = 0;
+	int verify = 0;
+	size_t size = 0;
+	const char *platform_filter = NULL;
+	const char *device_filter = NULL;
+	cl_device_type device_type = CL_DEVICE_TYPE_ALL;
+	int warmup = BENCH_DEFAULT_WARMUP;
+	int reps = BENCH_DEFAULT_REPS;
+	int csv_format = 0;
+	char *name = NULL;
+	int name_len = 0;
+	const char *csv;
+	const char *csv_file = NULL;
+	const char *trace = NULL;
+	const char *prof_csv = NULL;
+	int first_mode = BUFFER_COPY;
+	int last_mode = BUFFER_COPY;
+	int mode;
+	char label[64];
+
+	memset(selected, 0, sizeof(selected));
+	memset(sizes, 0, sizeof(sizes));
+	memset(&args, 0, sizeof(args));
+	args.key_len = KEY_LEN;
+	host_threads = get_num_cpus();
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		else if (strcmp(argv[i], "--list") == 0)
+		{
+			for (t = 0; t < NUM_TESTS; t++)
+				printf("%s\n", tests[t].name);
+			return 0;
+		}
+		else if (strcmp(argv[i], "--tests") == 0 && i + 1 < argc)
+		{
+			if (!parse_tests(argv[++i], selected, sizes))
+				return 1;
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+			size = (size_t) strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--key-len") == 0 && i + 1 < argc)
+			args.key_len = (unsigned int) atoi(argv[++i]);
+		else if (strcmp(argv[i], "--platform") == 0 && i + 1 < argc)
+			platform_filter = argv[++i];
+		else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+			device_filter = argv[++i];
+		else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "cpu") == 0)
+				device_type = CL_DEVICE_TYPE_CPU;
+			else if (strcmp(argv[i], "gpu") == 0)
+				device_type = CL_DEVICE_TYPE_GPU;
+			else if (strcmp(argv[i], "accelerator") == 0)
+				device_type = CL_DEVICE_TYPE_ACCELERATOR;
+			else
+				device_type = CL_DEVICE_TYPE_ALL;
+		}
+		else if (strcmp(argv[i], "--host-threads") == 0 && i + 1 < argc)
+			host_threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+			reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+			warmup = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+			csv_format = strcmp(argv[++i], "csv") == 0;
+		else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+			csv_file = argv[++i];
+		else if (strcmp(argv[i], "--verbose") == 0)
+			verbose = 1;
+		else if (strcmp(argv[i], "--verify") == 0)
+			verify = 1;
+		else if (strcmp(argv[i], "--profile") == 0)
+			prof_enable(1);
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			prof_enable(1);
+			trace = argv[++i];
+		}
+		else if (strcmp(argv[i], "--multi-device") == 0)
+			multi_device = 1;
+		else if ((strcmp(argv[i], "--input") == 0 || strcmp(argv[i], "--stream-file") == 0) && i + 1 < argc)
+			args.input_file = argv[++i];
+		else if (strcmp(argv[i], "--autotune") == 0)
+			autotune_enable(1, 0);
+		else if (strcmp(argv[i], "--retune") == 0)
+			autotune_enable(1, 1);
+		else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc)
+		{
+			prof_enable(1);
+			prof_csv = argv[++i];
+		}
+		else if (strcmp(argv[i], "--buffers") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "zero-copy") == 0)
+				first_mode = last_mode = BUFFER_ZERO_COPY;
+			else if (strcmp(argv[i], "both") == 0)
+				last_mode = BUFFER_ZERO_COPY;
+			else
+				first_mode = last_mode = BUFFER_COPY;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* Default tests and sizes. */
+	any_selected = 0;
+	for (t = 0; t < NUM_TESTS; t++)
+		any_selected |= selected[t];
+
+	/* Verification runs everything once, untimed apart from one rep. */
+	if (verify)
+	{
+		warmup = 0;
+		reps = 1;
+	}
 
-	int i, j;
+	for (t = 0; t < NUM_TESTS; t++)
+	{
+		if (!any_selected)
+			selected[t] = verify || tests[t].in_default;
+		if (sizes[t] == 0)
+			sizes[t] = size ? size : tests[t].default_size;
+	}
 
-	//cl_platform_id p;
-	//cl_device_id d;
-	//p = get_platform("Intel");
-	//d = get_device(p, CL_DEVICE_TYPE_ALL, "Intel");
+	bench_set_reps(warmup, reps);
 
-	/* Iterate over the platforms and devices running the kernels.
+	if (host_threads < 1)
+		host_threads = 1;
+	if (host_threads > PARALLEL_MAX_THREADS)
+		host_threads = PARALLEL_MAX_THREADS;
+	pool_init(&host_pool, host_threads);
+
+	/* Iterate over the matching platforms and devices running the tests.
 	 */
 	num_platforms = get_platforms(&platforms);
 	print_platform_names(platforms, num_platforms);
+	runtime_init(&rt, "test.cl");
 
 	for (i = 0; i < num_platforms; i++)
 	{
-		num_devices = get_devices(platforms[i], CL_DEVICE_TYPE_ALL, &devices);
+		if (!name_matches(get_platform_info(platforms[i], CL_PLATFORM_NAME, &name, &name_len), platform_filter))
+			continue;
+
+		/* get_devices() exits on CL_DEVICE_NOT_FOUND, so check first. */
+		if (clGetDeviceIDs(platforms[i], device_type, 0, NULL, &num) != CL_SUCCESS)
+			continue;
+
+		if (devices != NULL)
+			free(devices);
+		num_devices = get_devices(platforms[i], device_type, &devices);
 		print_device_names(devices, num_devices);
 		
 		for (j = 0; j < num_devices; j++)
 		{
+			if (!name_matches(get_device_info(devices[j], CL_DEVICE_NAME, &name, &name_len), device_filter))
+				continue;
+
 			print_device_info(devices[j]);
+			bench_set_label(name);
+			prof_set_label(name);
 
-			/* Get context. */
-			context = clCreateContext(NULL, 1, &devices[j], NULL, NULL, &err); // TODO: should bother to specify platform in properties?
-			CL_CHECK_ERR(err);
-	
-			/* Create a command queue. */
-			queue = clCreateCommandQueue(context, devices[j], 0, &err);
-			CL_CHECK_ERR(err);
-
-			/* Build program from source file. */
-			program = get_program_from_file(context, devices[j], "test.cl");
-
-			/* Run some kernels. */
-			//run_get_ids(context, queue, program);
-			//run_sum_numbers(context, queue, program);
-			//run_matrix_multiply(context, queue, program);
-			//run_hash_test(context, queue, program);
-			//run_minp_test();
-			
-			/* Clean up. */
-			err = clReleaseProgram(program); CL_CHECK_ERR(err);
-			err = clReleaseCommandQueue(queue); CL_CHECK_ERR(err);
-			err = clReleaseContext(context); CL_CHECK_ERR(err);	
+			/* Context, queue and program live in the runtime until exit. */
+			args.dev = runtime_add_device(&rt, devices[j]);
+			args.device = devices[j];
+			args.context = args.dev->context;
+			args.queue = args.dev->queue;
+			args.program = args.dev->program;
+
+			/* Run the tests, once per host buffer strategy. */
+			for (mode = first_mode; mode <= last_mode; mode++)
+			{
+				buffer_set_mode(mode);
+				if (first_mode != last_mode)
+				{
+					snprintf(label, sizeof(label), "%s (%s)", name, buffer_mode_name(mode));
+					bench_set_label(label);
+				}
+
+				for (t = 0; t < NUM_TESTS; t++)
+				{
+					if (!selected[t] || !tests[t].per_mode)
+						continue;
+					args.size = sizes[t];
+					tests[t].fn(&args);
+				}
+			}
+
+			bench_set_label(name);
+
+			for (t = 0; t < NUM_TESTS; t++)
+			{
+				if (!selected[t] || tests[t].per_mode)
+					continue;
+				args.size = sizes[t];
+				tests[t].fn(&args);
+			}
 		}
 	}
 
-	/* Not the best strategy. */
-	if (num_platforms)
+	runtime_release(&rt);
+	pool_release(&host_pool);
+
+	/* Split single workloads across every device at once. */
+	if (multi_device)
+		run_multi_device(device_type, 1 << 20, 1 << 26, 8192, 4096);
+
+	if (csv_format)
+		bench_write_csv("-");
+	else
+		bench_print_summary();
+	membench_print_roofline();
+	prof_print_summary();
+
+	if (trace != NULL)
+		prof_write_trace(trace);
+
+	if (prof_csv != NULL)
+		prof_write_csv(prof_csv);
+
+	/* Append to a CSV file to track results run over run. */
+	if (csv_file != NULL)
+		bench_write_csv(csv_file);
+
+	csv = getenv("OPENCL_TEST_BENCH_CSV");
+	if (csv != NULL)
+		bench_write_csv(csv);
+
+	get_program_cache_stats(&hits, &misses, &rejects);
+	printf("Program cache: %d hits, %d misses, %d rejected binaries\n", hits, misses, rejects);
+
+	if (platforms != NULL)
 		free(platforms);
 
-	if (num_devices)
+	if (devices != NULL)
 		free(devices);
 
+	if (name != NULL)
+		free(name);
+
+	if (bench_failures() > 0)
+	{
+		printf("%d checks failed\n", bench_failures());
+		return 1;
+	}
+
 	return 0;
 }
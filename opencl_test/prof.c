@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+
+#define PROF_MAX_LABELS 64
+
+/* One completed command. Timestamps are device nanoseconds as returned by
+ * clGetEventProfilingInfo.
+ */
+struct prof_record
+{
+	char name[48];
+	int kind;
+	int label;
+	cl_ulong queued;
+	cl_ulong submit;
+	cl_ulong start;
+	cl_ulong end;
+};
+
+static const char *kind_names[PROF_NUM_KINDS] = { "kernel", "write", "read", "map" };
+
+static int enabled = 0;
+static struct prof_record *records = NULL;
+static int num_records = 0;
+static int max_records = 0;
+static char labels[PROF_MAX_LABELS][64];
+static cl_ulong label_base[PROF_MAX_LABELS];
+static int num_labels = 0;
+static int current_label = -1;
+
+void prof_enable(int enable)
+{
+	enabled = enable;
+}
+
+int prof_enabled(void)
+{
+	return enabled;
+}
+
+/* Properties for clCreateCommandQueue. Profiling has a cost on some
+ * runtimes so it is only switched on when asked for.
+ */
+cl_command_queue_properties prof_queue_properties(void)
+{
+	return enabled ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+/* Label attached to every following record, usually the device name. Each
+ * label becomes one process in the trace since device clocks are not
+ * comparable with each other.
+ */
+void prof_set_label(const char *label)
+{
+	int i;
+
+	for (i = 0; i < num_labels; i++)
+	{
+		if (strcmp(labels[i], label) == 0)
+		{
+			current_label = i;
+			return;
+		}
+	}
+
+	if (num_labels == PROF_MAX_LABELS)
+		return;
+
+	strncpy(labels[num_labels], label, sizeof(labels[0]) - 1);
+	labels[num_labels][sizeof(labels[0]) - 1] = '\0';
+	label_base[num_labels] = 0;
+	current_label = num_labels++;
+}
+
+/* Record the timestamps of a completed command. Does nothing unless
+ * profiling is enabled, so callers can use it unconditionally.
+ */
+void prof_event(cl_event ev, const char *name, int kind)
+{
+	struct prof_record *r;
+	cl_int err;
+
+	if (!enabled || ev == NULL)
+		return;
+
+	if (current_label < 0)
+		prof_set_label("");
+
+	if (num_records == max_records)
+	{
+		max_records = max_records ? max_records * 2 : 1024;
+		records = (struct prof_record *) realloc(records, max_records * sizeof(struct prof_record));
+		if (records == NULL)
+		{
+			fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+
+	r = &records[num_records];
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->name[sizeof(r->name) - 1] = '\0';
+	r->kind = kind;
+	r->label = current_label;
+
+	err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &r->queued, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &r->submit, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &r->start, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &r->end, NULL);
+	CL_CHECK_ERR(err);
+
+	if (label_base[current_label] == 0 || r->queued < label_base[current_label])
+		label_base[current_label] = r->queued;
+
+	num_records++;
+}
+
+/* Per label and command name: count, time from queued to start (queue
+ * latency, split into host-side queued->submit and device-side
+ * submit->start) and start->end (execution), then totals by kind so
+ * kernel time can be compared with transfer time.
+ */
+void prof_print_summary(void)
+{
+	struct prof_record *r, *s;
+	double queued, submitted, exec;
+	double kind_total[PROF_NUM_KINDS];
+	int count;
+	char *done;
+	int i, j, k, l;
+
+	if (num_records == 0)
+		return;
+
+	done = (char *) calloc(num_records, 1);
+	if (done == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	for (l = 0; l < num_labels; l++)
+	{
+		printf("\nProfile: %s\n", labels[l]);
+		printf("%-32s %-7s %7s %14s %14s %14s %14s\n", "command", "kind", "count", "queued ms", "submit ms", "exec ms", "avg exec us");
+
+		for (k = 0; k < PROF_NUM_KINDS; k++)
+			kind_total[k] = 0.0;
+
+		for (i = 0; i < num_records; i++)
+		{
+			r = &records[i];
+			if (done[i] || r->label != l)
+				continue;
+
+			count = 0;
+			queued = submitted = exec = 0.0;
+
+			for (j = i; j < num_records; j++)
+			{
+				s = &records[j];
+				if (done[j] || s->label != l || s->kind != r->kind || strcmp(s->name, r->name) != 0)
+					continue;
+
+				queued += (double) (s->submit - s->queued);
+				submitted += (double) (s->start - s->submit);
+				exec += (double) (s->end - s->start);
+				count++;
+				done[j] = 1;
+			}
+
+			kind_total[r->kind] += exec;
+			printf("%-32.32s %-7s %7d %14.3f %14.3f %14.3f %14.3f\n", r->name, kind_names[r->kind], count, queued / 1e6, submitted / 1e6, exec / 1e6, exec / count / 1e3);
+		}
+
+		printf("Execution by kind:");
+		for (k = 0; k < PROF_NUM_KINDS; k++)
+			printf(" %s %.3f ms", kind_names[k], kind_total[k] / 1e6);
+		printf("\n");
+	}
+
+	free(done);
+}
+
+int prof_write_csv(const char *filename)
+{
+	FILE *fp;
+	struct prof_record *r;
+	int i;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Failed to open file: %s\n", filename);
+		return -1;
+	}
+
+	fprintf(fp, "device,command,kind,queued_ns,submit_ns,start_ns,end_ns\n");
+	for (i = 0; i < num_records; i++)
+	{
+		r = &records[i];
+		fprintf(fp, "\"%s\",\"%s\",%s,%llu,%llu,%llu,%llu\n", labels[r->label], r->name, kind_names[r->kind],
+			(unsigned long long) (r->queued - label_base[r->label]),
+			(unsigned long long) (r->submit - label_base[r->label]),
+			(unsigned long long) (r->start - label_base[r->label]),
+			(unsigned long long) (r->end - label_base[r->label]));
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+/* Write the records in Chrome trace event format (load in chrome://tracing
+ * or Perfetto). Each label is a process, each command kind a thread, and
+ * the queue latency is kept in the event args.
+ */
+int prof_write_trace(const char *filename)
+{
+	FILE *fp;
+	struct prof_record *r;
+	int i;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Failed to open file: %s\n", filename);
+		return -1;
+	}
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+
+	for (i = 0; i < num_labels; i++)
+		fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", i, labels[i]);
+
+	for (i = 0; i < num_records; i++)
+	{
+		r = &records[i];
+		fprintf(fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f}},\n",
+			r->name, kind_names[r->kind], r->label, r->kind,
+			(double) (r->start - label_base[r->label]) / 1e3,
+			(double) (r->end - r->start) / 1e3,
+			(double) (r->submit - r->queued) / 1e3,
+			(double) (r->start - r->submit) / 1e3);
+	}
+
+	/* Trailing metadata event avoids having to special-case the last comma. */
+	fprintf(fp, "{\"name\":\"trace_end\",\"ph\":\"M\",\"pid\":0,\"args\":{}}\n]}\n");
+	fclose(fp);
+
+	return 0;
+}
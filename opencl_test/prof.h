@@ -0,0 +1,22 @@
+#ifndef TEST_PROF_H
+#define TEST_PROF_H
+
+/* Kinds of profiled commands. */
+#define PROF_KERNEL 0
+#define PROF_WRITE 1
+#define PROF_READ 2
+#define PROF_MAP 3
+#define PROF_NUM_KINDS 4
+
+void prof_enable(int enable);
+int prof_enabled(void);
+cl_command_queue_properties prof_queue_properties(void);
+
+void prof_set_label(const char *label);
+void prof_event(cl_event ev, const char *name, int kind);
+
+void prof_print_summary(void);
+int prof_write_csv(const char *filename);
+int prof_write_trace(const char *filename);
+
+#endif
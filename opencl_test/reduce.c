@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "reduce.h"
+
+static const size_t elem_sizes[] = { sizeof(cl_int), sizeof(cl_uint), sizeof(cl_float), sizeof(cl_double) };
+
+const char *reduce_type_name(int type)
+{
+	static const char *names[] = { "int", "uint", "float", "double" };
+	return names[type];
+}
+
+const char *reduce_op_name(int op)
+{
+	static const char *names[] = { "sum", "min", "max", "argmin" };
+	return names[op];
+}
+
+/* Host reduction of values, with their indices in idx or their positions
+ * when idx is NULL. Used as the reference and to finish on the host.
+ * Accumulates in the wider type A; integer sums wrap on the way back.
+ */
+#define DEFINE_REDUCE_HOST(name, T, A, field, lowest, highest) \
+static void name(const T *v, const cl_uint *idx, size_t n, int op, struct reduce_result *result) \
+{ \
+	A acc = op == REDUCE_SUM ? (A) 0 : op == REDUCE_MAX ? (lowest) : (highest); \
+	cl_uint acc_idx = UINT_MAX; \
+	cl_uint j; \
+	size_t i; \
+\
+	for (i = 0; i < n; i++) \
+	{ \
+		j = idx != NULL ? idx[i] : (cl_uint) i; \
+		switch (op) \
+		{ \
+			case REDUCE_SUM: acc += v[i]; break; \
+			case REDUCE_MIN: acc = v[i] < acc ? v[i] : acc; break; \
+			case REDUCE_MAX: acc = v[i] > acc ? v[i] : acc; break; \
+			case REDUCE_ARGMIN: \
+				if (v[i] < acc || (v[i] == acc && j < acc_idx)) \
+				{ \
+					acc = v[i]; \
+					acc_idx = j; \
+				} \
+				break; \
+		} \
+	} \
+\
+	result->value.field = (T) acc; \
+	result->index = acc_idx; \
+}
+
+DEFINE_REDUCE_HOST(reduce_host_int, cl_int, cl_long, i, INT_MIN, INT_MAX)
+DEFINE_REDUCE_HOST(reduce_host_uint, cl_uint, cl_ulong, u, 0, UINT_MAX)
+DEFINE_REDUCE_HOST(reduce_host_float, cl_float, cl_double, f, -HUGE_VAL, HUGE_VAL)
+DEFINE_REDUCE_HOST(reduce_host_double, cl_double, cl_double, d, -HUGE_VAL, HUGE_VAL)
+
+static void reduce_host_indexed(const void *src, const cl_uint *idx, size_t n, int type, int op, struct reduce_result *result)
+{
+	memset(result, 0, sizeof(*result));
+
+	switch (type)
+	{
+		case REDUCE_INT: reduce_host_int((const cl_int *) src, idx, n, op, result); break;
+		case REDUCE_UINT: reduce_host_uint((const cl_uint *) src, idx, n, op, result); break;
+		case REDUCE_FLOAT: reduce_host_float((const cl_float *) src, idx, n, op, result); break;
+		case REDUCE_DOUBLE: reduce_host_double((const cl_double *) src, idx, n, op, result); break;
+	}
+}
+
+void reduce_host(const void *src, size_t n, int type, int op, struct reduce_result *result)
+{
+	reduce_host_indexed(src, NULL, n, type, op, result);
+}
+
+/* Returns 0 if the device cannot reduce this type, i.e. double without
+ * cl_khr_fp64.
+ */
+int reducer_init(struct reducer *r, cl_context context, cl_device_id device, cl_command_queue queue, int type, int op, int second_pass)
+{
+	cl_device_fp_config fp64;
+	cl_uint compute_units;
+	size_t max_local;
+	char options[64];
+	cl_int err;
+
+	if (type == REDUCE_DOUBLE)
+	{
+		err = clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+		if (err != CL_SUCCESS || fp64 == 0)
+			return 0;
+	}
+
+	memset(r, 0, sizeof(*r));
+	r->queue = queue;
+	r->type = type;
+	r->op = op;
+	r->second_pass = second_pass;
+	r->elem_size = elem_sizes[type];
+
+	snprintf(options, sizeof(options), "-DREDUCE_TYPE=%d -DREDUCE_OP=%d", type, op);
+	r->program = get_program_from_file_with_options(context, device, REDUCE_FILE, options);
+
+	r->kernel = clCreateKernel(r->program, "reduce_pass", &err);
+	CL_CHECK_ERR(err);
+
+	/* The tree needs a power of two. */
+	err = clGetKernelWorkGroupInfo(r->kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+	CL_CHECK_ERR(err);
+
+	r->local_size = REDUCE_LOCAL_SIZE;
+	while (r->local_size > max_local)
+		r->local_size /= 2;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+	CL_CHECK_ERR(err);
+	r->max_groups = compute_units * REDUCE_GROUPS_PER_CU;
+
+	/* The index buffers are always created so every argument is valid. */
+	r->partial = clCreateBuffer(context, CL_MEM_READ_WRITE, r->max_groups * r->elem_size, NULL, &err);
+	CL_CHECK_ERR(err);
+	r->partial_idx = clCreateBuffer(context, CL_MEM_READ_WRITE, r->max_groups * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	r->result = clCreateBuffer(context, CL_MEM_READ_WRITE, r->elem_size, NULL, &err);
+	CL_CHECK_ERR(err);
+	r->result_idx = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+
+	return 1;
+}
+
+static void reducer_pass(struct reducer *r, cl_mem src, cl_mem src_idx, cl_uint has_idx, size_t n, cl_mem dst, cl_mem dst_idx, size_t groups, const char *name)
+{
+	size_t global_size = groups * r->local_size;
+	cl_uint count = (cl_uint) n;
+	cl_event ev;
+	cl_int err;
+
+	err = clSetKernelArg(r->kernel, 0, sizeof(cl_mem), &src);
+	err |= clSetKernelArg(r->kernel, 1, sizeof(cl_mem), &src_idx);
+	err |= clSetKernelArg(r->kernel, 2, sizeof(cl_uint), &has_idx);
+	err |= clSetKernelArg(r->kernel, 3, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(r->kernel, 4, sizeof(cl_mem), &dst);
+	err |= clSetKernelArg(r->kernel, 5, sizeof(cl_mem), &dst_idx);
+	err |= clSetKernelArg(r->kernel, 6, r->local_size * r->elem_size, NULL);
+	err |= clSetKernelArg(r->kernel, 7, r->local_size * sizeof(cl_uint), NULL);
+	CL_CHECK_ERR(err);
+
+	err = clEnqueueNDRangeKernel(r->queue, r->kernel, 1, NULL, &global_size, &r->local_size, 0, NULL, &ev);
+	CL_CHECK_ERR(err);
+
+	if (prof_enabled())
+	{
+		err = clWaitForEvents(1, &ev);
+		CL_CHECK_ERR(err);
+		prof_event(ev, name, PROF_KERNEL);
+	}
+
+	err = clReleaseEvent(ev);
+	CL_CHECK_ERR(err);
+}
+
+/* Reduce the first n elements of src. Any n works; the first pass runs no
+ * more groups than keep the device busy and each work-item loops over
+ * the rest.
+ */
+void reducer_run(struct reducer *r, cl_mem src, size_t n, struct reduce_result *result)
+{
+	void *values;
+	cl_uint *indices;
+	size_t groups;
+	cl_int err;
+
+	if (n == 0)
+	{
+		reduce_host(NULL, 0, r->type, r->op, result);
+		return;
+	}
+
+	groups = (n + r->local_size - 1) / r->local_size;
+	if (groups > r->max_groups)
+		groups = r->max_groups;
+
+	reducer_pass(r, src, r->result_idx, 0, n, r->partial, r->partial_idx, groups, "reduce_pass");
+
+	if (r->second_pass == REDUCE_ON_DEVICE || groups == 1)
+	{
+		if (groups > 1)
+			reducer_pass(r, r->partial, r->partial_idx, 1, groups, r->result, r->result_idx, 1, "reduce_pass final");
+
+		memset(result, 0, sizeof(*result));
+		err = clEnqueueReadBuffer(r->queue, groups > 1 ? r->result : r->partial, CL_FALSE, 0, r->elem_size, &result->value, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+		err = clEnqueueReadBuffer(r->queue, groups > 1 ? r->result_idx : r->partial_idx, CL_TRUE, 0, sizeof(cl_uint), &result->index, 0, NULL, NULL);
+		CL_CHECK_ERR(err);
+
+		if (r->op != REDUCE_ARGMIN)
+			result->index = UINT_MAX;
+		return;
+	}
+
+	values = malloc(groups * r->elem_size);
+	indices = (cl_uint *) malloc(groups * sizeof(cl_uint));
+	if (values == NULL || indices == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	err = clEnqueueReadBuffer(r->queue, r->partial, CL_FALSE, 0, groups * r->elem_size, values, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+	err = clEnqueueReadBuffer(r->queue, r->partial_idx, CL_TRUE, 0, groups * sizeof(cl_uint), indices, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	reduce_host_indexed(values, r->op == REDUCE_ARGMIN ? indices : NULL, groups, r->type, r->op, result);
+	if (r->op != REDUCE_ARGMIN)
+		result->index = UINT_MAX;
+
+	free(values);
+	free(indices);
+}
+
+void reducer_release(struct reducer *r)
+{
+	cl_int err;
+
+	err = clReleaseMemObject(r->partial); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(r->partial_idx); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(r->result); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(r->result_idx); CL_CHECK_ERR(err);
+	err = clReleaseKernel(r->kernel); CL_CHECK_ERR(err);
+	err = clReleaseProgram(r->program); CL_CHECK_ERR(err);
+}
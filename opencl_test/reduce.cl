@@ -0,0 +1,126 @@
+/* Generic reduction, built once per element type and operator:
+ *
+ *   -DREDUCE_TYPE=n  0 int, 1 uint, 2 float, 3 double
+ *   -DREDUCE_OP=n    0 sum, 1 min, 2 max, 3 argmin
+ *
+ * Must match the REDUCE_* values in reduce.h.
+ */
+#ifndef REDUCE_TYPE
+#define REDUCE_TYPE 0
+#endif
+
+#ifndef REDUCE_OP
+#define REDUCE_OP 0
+#endif
+
+#if REDUCE_TYPE == 0
+#define T int
+#define T_MIN INT_MIN
+#define T_MAX INT_MAX
+#elif REDUCE_TYPE == 1
+#define T uint
+#define T_MIN 0
+#define T_MAX UINT_MAX
+#elif REDUCE_TYPE == 2
+#define T float
+#define T_MIN (-INFINITY)
+#define T_MAX INFINITY
+#else
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#define T double
+#define T_MIN (-(double) INFINITY)
+#define T_MAX ((double) INFINITY)
+#endif
+
+#if REDUCE_OP == 0
+#define IDENTITY ((T) 0)
+#define COMBINE(x, y) ((x) + (y))
+#elif REDUCE_OP == 2
+#define IDENTITY T_MIN
+#define COMBINE(x, y) max(x, y)
+#else
+#define IDENTITY T_MAX
+#define COMBINE(x, y) min(x, y)
+#endif
+
+/* argmin keeps the lowest index on ties, so the answer does not depend
+ * on the launch configuration.
+ */
+#define ARGMIN_BETTER(xv, xi, yv, yi) ((yv) < (xv) || ((yv) == (xv) && (yi) < (xi)))
+
+/* One pass: every work-item folds a grid-strided slice of src, the
+ * work-group folds those in local memory with sequential addressing (no
+ * bank conflicts, no divergence within the active half) and work-item 0
+ * writes one partial per group. Run again on the partials with one group
+ * to finish on the device.
+ *
+ * src_idx holds the indices of src when src is itself a set of argmin
+ * partials; has_idx is 0 on the first pass where the index is the
+ * position. The index buffers are unused by the other operators.
+ * The local size must be a power of two.
+ */
+__kernel void reduce_pass(
+	__global const T *src,
+	__global const uint *src_idx,
+	uint has_idx,
+	uint n,
+	__global T *dst,
+	__global uint *dst_idx,
+	__local T *lval,
+	__local uint *lidx)
+{
+	uint lid = get_local_id(0);
+	uint i = get_global_id(0);
+	uint stride = get_global_size(0);
+	uint s;
+	T acc = IDENTITY;
+#if REDUCE_OP == 3
+	uint acc_idx = UINT_MAX;
+	uint j;
+#endif
+
+	for (; i < n; i += stride)
+	{
+#if REDUCE_OP == 3
+		j = has_idx ? src_idx[i] : i;
+		if (ARGMIN_BETTER(acc, acc_idx, src[i], j))
+		{
+			acc = src[i];
+			acc_idx = j;
+		}
+#else
+		acc = COMBINE(acc, src[i]);
+#endif
+	}
+
+	lval[lid] = acc;
+#if REDUCE_OP == 3
+	lidx[lid] = acc_idx;
+#endif
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (s = get_local_size(0) / 2; s > 0; s >>= 1)
+	{
+		if (lid < s)
+		{
+#if REDUCE_OP == 3
+			if (ARGMIN_BETTER(lval[lid], lidx[lid], lval[lid + s], lidx[lid + s]))
+			{
+				lval[lid] = lval[lid + s];
+				lidx[lid] = lidx[lid + s];
+			}
+#else
+			lval[lid] = COMBINE(lval[lid], lval[lid + s]);
+#endif
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+	{
+		dst[get_group_id(0)] = lval[0];
+#if REDUCE_OP == 3
+		dst_idx[get_group_id(0)] = lidx[0];
+#endif
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef TEST_REDUCE_H
+#define TEST_REDUCE_H
+
+/* Element types and operators, passed to reduce.cl as -DREDUCE_TYPE and
+ * -DREDUCE_OP.
+ */
+#define REDUCE_INT 0
+#define REDUCE_UINT 1
+#define REDUCE_FLOAT 2
+#define REDUCE_DOUBLE 3
+
+#define REDUCE_SUM 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+#define REDUCE_ARGMIN 3
+
+/* Where the per-group partials are combined. */
+#define REDUCE_ON_DEVICE 0
+#define REDUCE_ON_HOST 1
+
+#define REDUCE_FILE "reduce.cl"
+#define REDUCE_LOCAL_SIZE 256
+#define REDUCE_GROUPS_PER_CU 8
+
+union reduce_value
+{
+	cl_int i;
+	cl_uint u;
+	cl_float f;
+	cl_double d;
+};
+
+/* index is only set by REDUCE_ARGMIN. */
+struct reduce_result
+{
+	union reduce_value value;
+	cl_uint index;
+};
+
+struct reducer
+{
+	cl_command_queue queue;
+	cl_program program;
+	cl_kernel kernel;
+	int type;
+	int op;
+	int second_pass;
+	size_t elem_size;
+	size_t local_size;
+	size_t max_groups;
+	cl_mem partial;
+	cl_mem partial_idx;
+	cl_mem result;
+	cl_mem result_idx;
+};
+
+int reducer_init(struct reducer *r, cl_context context, cl_device_id device, cl_command_queue queue, int type, int op, int second_pass);
+void reducer_run(struct reducer *r, cl_mem src, size_t n, struct reduce_result *result);
+void reducer_release(struct reducer *r);
+
+const char *reduce_type_name(int type);
+const char *reduce_op_name(int op);
+void reduce_host(const void *src, size_t n, int type, int op, struct reduce_result *result);
+
+#endif
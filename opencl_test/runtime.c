@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "runtime.h"
+
+void runtime_init(struct runtime *rt, const char *filename)
+{
+	rt->devices = NULL;
+	rt->num = 0;
+	rt->filename = filename;
+}
+
+/* Open a context, queue and program on the device, kept until
+ * runtime_release(). The returned pointer is only valid until the next
+ * device is added.
+ */
+struct rt_device *runtime_add_device(struct runtime *rt, cl_device_id device)
+{
+	struct rt_device *dev;
+	char *name = NULL;
+	int name_len = 0;
+	cl_int err;
+
+	rt->devices = (struct rt_device *) realloc(rt->devices, (rt->num + 1) * sizeof(struct rt_device));
+	if (rt->devices == NULL)
+	{
+		fprintf(stderr, "Failed to allocate memory in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+
+	dev = &rt->devices[rt->num++];
+	memset(dev, 0, sizeof(*dev));
+	dev->device = device;
+
+	get_device_info(device, CL_DEVICE_NAME, &name, &name_len);
+	strncpy(dev->name, name, sizeof(dev->name) - 1);
+	free(name);
+
+	dev->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+	CL_CHECK_ERR(err);
+	dev->queue = clCreateCommandQueue(dev->context, device, prof_queue_properties(), &err);
+	CL_CHECK_ERR(err);
+	dev->program = get_program_from_file(dev->context, device, rt->filename);
+
+	return dev;
+}
+
+static void runtime_release_device(struct rt_device *dev)
+{
+	cl_int err;
+	int i, j;
+
+	for (i = 0; i < dev->num_kernels; i++)
+	{
+		err = clReleaseKernel(dev->kernels[i].kernel);
+		CL_CHECK_ERR(err);
+	}
+
+	for (i = 0; i < RUNTIME_NUM_CLASSES; i++)
+		for (j = 0; j < dev->pool_count[i]; j++)
+		{
+			err = clReleaseMemObject(dev->pool[i][j].mem);
+			CL_CHECK_ERR(err);
+		}
+
+	err = clReleaseProgram(dev->program); CL_CHECK_ERR(err);
+	err = clReleaseCommandQueue(dev->queue); CL_CHECK_ERR(err);
+	err = clReleaseContext(dev->context); CL_CHECK_ERR(err);
+}
+
+void runtime_release(struct runtime *rt)
+{
+	int i;
+
+	for (i = 0; i < rt->num; i++)
+		runtime_release_device(&rt->devices[i]);
+
+	free(rt->devices);
+	rt->devices = NULL;
+	rt->num = 0;
+}
+
+/* Create the kernel the first time it is asked for. A linear search is
+ * plenty for the handful of kernels in a program.
+ */
+cl_kernel runtime_kernel(struct rt_device *dev, const char *name)
+{
+	struct rt_kernel *k;
+	cl_int err;
+	int i;
+
+	for (i = 0; i < dev->num_kernels; i++)
+		if (strcmp(dev->kernels[i].name, name) == 0)
+		{
+			dev->kernel_hits++;
+			return dev->kernels[i].kernel;
+		}
+
+	if (dev->num_kernels == RUNTIME_MAX_KERNELS || strlen(name) >= RUNTIME_KERNEL_NAME_LEN)
+	{
+		fprintf(stderr, "Cannot cache kernel %s\n", name);
+		exit(1);
+	}
+
+	k = &dev->kernels[dev->num_kernels];
+	k->kernel = clCreateKernel(dev->program, name, &err);
+	CL_CHECK_ERR(err);
+	strcpy(k->name, name);
+
+	dev->num_kernels++;
+	dev->kernel_misses++;
+	return k->kernel;
+}
+
+/* Smallest class that holds size, or -1 if it is too big to pool. */
+static int runtime_size_class(size_t size)
+{
+	size_t class_size = RUNTIME_MIN_BUFFER;
+	int c;
+
+	for (c = 0; c < RUNTIME_NUM_CLASSES; c++)
+	{
+		if (size <= class_size)
+			return c;
+		class_size <<= 1;
+	}
+
+	return -1;
+}
+
+/* A buffer of at least size bytes. Pooled buffers are rounded up to their
+ * size class so they can be reused for anything in it; flags must match
+ * exactly, and host pointer flags are not supported.
+ */
+cl_mem runtime_buffer(struct rt_device *dev, cl_mem_flags flags, size_t size)
+{
+	struct rt_pool_entry *pool;
+	cl_mem mem;
+	cl_int err;
+	int c, i;
+
+	c = runtime_size_class(size);
+	if (c >= 0)
+	{
+		pool = dev->pool[c];
+		for (i = dev->pool_count[c] - 1; i >= 0; i--)
+			if (pool[i].flags == flags)
+			{
+				mem = pool[i].mem;
+				pool[i] = pool[--dev->pool_count[c]];
+				dev->buffer_hits++;
+				return mem;
+			}
+
+		size = (size_t) RUNTIME_MIN_BUFFER << c;
+	}
+
+	mem = clCreateBuffer(dev->context, flags, size, NULL, &err);
+	CL_CHECK_ERR(err);
+
+	dev->buffer_misses++;
+	return mem;
+}
+
+/* Return a buffer to the pool, releasing it if its class is full. Any
+ * commands still using it are ordered by the queue, so there is no need
+ * to wait first.
+ */
+void runtime_buffer_put(struct rt_device *dev, cl_mem mem)
+{
+	cl_mem_flags flags;
+	size_t size;
+	cl_int err;
+	int c;
+
+	err = clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, NULL);
+	CL_CHECK_ERR(err);
+	err = clGetMemObjectInfo(mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL);
+	CL_CHECK_ERR(err);
+
+	/* Only exact class sizes came from the pool. */
+	c = runtime_size_class(size);
+	if (c >= 0 && size == (size_t) RUNTIME_MIN_BUFFER << c && dev->pool_count[c] < RUNTIME_POOL_DEPTH)
+	{
+		dev->pool[c][dev->pool_count[c]].mem = mem;
+		dev->pool[c][dev->pool_count[c]].flags = flags;
+		dev->pool_count[c]++;
+		return;
+	}
+
+	err = clReleaseMemObject(mem);
+	CL_CHECK_ERR(err);
+}
+
+void runtime_print_stats(const struct rt_device *dev)
+{
+	int c, pooled = 0;
+
+	for (c = 0; c < RUNTIME_NUM_CLASSES; c++)
+		pooled += dev->pool_count[c];
+
+	printf("Runtime %s: kernels %d hits %d created, buffers %d hits %d created, %d pooled\n",
+		dev->name, dev->kernel_hits, dev->kernel_misses, dev->buffer_hits, dev->buffer_misses, pooled);
+}
@@ -0,0 +1,66 @@
+#ifndef TEST_RUNTIME_H
+#define TEST_RUNTIME_H
+
+/* A long-lived runtime for service-style use, where the same kernels run
+ * many times on small inputs and per-call setup would dominate. Each
+ * device keeps its context, queue and program for the life of the
+ * process, kernels are created once per name, and released buffers go
+ * back to a pool of power-of-two size classes to be handed out again.
+ *
+ * Nothing here is thread safe, and a cached kernel's arguments are shared
+ * by every caller, so set all of them before each launch.
+ */
+#define RUNTIME_MAX_KERNELS 32
+#define RUNTIME_KERNEL_NAME_LEN 64
+
+/* Size classes run from RUNTIME_MIN_BUFFER up in powers of two. */
+#define RUNTIME_MIN_BUFFER 4096
+#define RUNTIME_NUM_CLASSES 24
+#define RUNTIME_POOL_DEPTH 8
+
+struct rt_kernel
+{
+	char name[RUNTIME_KERNEL_NAME_LEN];
+	cl_kernel kernel;
+};
+
+struct rt_pool_entry
+{
+	cl_mem mem;
+	cl_mem_flags flags;
+};
+
+struct rt_device
+{
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	char name[64];
+	struct rt_kernel kernels[RUNTIME_MAX_KERNELS];
+	int num_kernels;
+	struct rt_pool_entry pool[RUNTIME_NUM_CLASSES][RUNTIME_POOL_DEPTH];
+	int pool_count[RUNTIME_NUM_CLASSES];
+	int kernel_hits;
+	int kernel_misses;
+	int buffer_hits;
+	int buffer_misses;
+};
+
+struct runtime
+{
+	struct rt_device *devices;
+	int num;
+	const char *filename;
+};
+
+void runtime_init(struct runtime *rt, const char *filename);
+struct rt_device *runtime_add_device(struct runtime *rt, cl_device_id device);
+void runtime_release(struct runtime *rt);
+
+cl_kernel runtime_kernel(struct rt_device *dev, const char *name);
+cl_mem runtime_buffer(struct rt_device *dev, cl_mem_flags flags, size_t size);
+void runtime_buffer_put(struct rt_device *dev, cl_mem mem);
+void runtime_print_stats(const struct rt_device *dev);
+
+#endif
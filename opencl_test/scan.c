@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "scan.h"
+
+#define HISTOGRAM_LOCAL_SIZE 256
+#define HISTOGRAM_GROUPS_PER_CU 4
+
+static cl_kernel create_kernel(cl_program program, const char *name)
+{
+	cl_kernel kernel;
+	cl_int err;
+
+	kernel = clCreateKernel(program, name, &err);
+	CL_CHECK_ERR(err);
+
+	return kernel;
+}
+
+void scanner_init(struct scanner *s, cl_context context, cl_device_id device, cl_command_queue queue, cl_program program, size_t capacity)
+{
+	size_t block, n, max_local;
+	cl_uint compute_units;
+	cl_int err;
+
+	memset(s, 0, sizeof(*s));
+	s->queue = queue;
+	s->capacity = capacity;
+
+	s->scan_blocks = create_kernel(program, "scan_blocks");
+	s->add_carry = create_kernel(program, "scan_add_carry");
+	s->compact_flags = create_kernel(program, "compact_flags");
+	s->compact_scatter = create_kernel(program, "compact_scatter");
+	s->histogram = create_kernel(program, "histogram");
+
+	err = clGetKernelWorkGroupInfo(s->scan_blocks, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+	CL_CHECK_ERR(err);
+
+	s->local_size = SCAN_LOCAL_SIZE;
+	while (s->local_size > max_local)
+		s->local_size /= 2;
+
+	err = clGetKernelWorkGroupInfo(s->histogram, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+	CL_CHECK_ERR(err);
+
+	s->histogram_local_size = HISTOGRAM_LOCAL_SIZE < max_local ? HISTOGRAM_LOCAL_SIZE : max_local;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &compute_units, NULL);
+	CL_CHECK_ERR(err);
+	s->histogram_groups = compute_units * HISTOGRAM_GROUPS_PER_CU;
+
+	/* One block total per block at every level, down to a single block. */
+	block = 2 * s->local_size;
+	n = capacity > 0 ? capacity : 1;
+	do
+	{
+		if (s->levels == SCAN_MAX_LEVELS)
+		{
+			fprintf(stderr, "Scan capacity %lu is too large\n", (unsigned long) capacity);
+			exit(1);
+		}
+
+		n = (n + block - 1) / block;
+		s->sums[s->levels] = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL, &err);
+		CL_CHECK_ERR(err);
+		s->levels++;
+	}
+	while (n > 1);
+
+	s->flags = clCreateBuffer(context, CL_MEM_READ_WRITE, (capacity > 0 ? capacity : 1) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+	s->positions = clCreateBuffer(context, CL_MEM_READ_WRITE, (capacity > 0 ? capacity : 1) * sizeof(cl_uint), NULL, &err);
+	CL_CHECK_ERR(err);
+}
+
+static void enqueue(struct scanner *s, cl_kernel kernel, size_t global_size, size_t local_size, const char *name)
+{
+	cl_event ev;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(s->queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, prof_enabled() ? &ev : NULL);
+	CL_CHECK_ERR(err);
+
+	if (prof_enabled())
+	{
+		err = clWaitForEvents(1, &ev);
+		CL_CHECK_ERR(err);
+		prof_event(ev, name, PROF_KERNEL);
+		err = clReleaseEvent(ev);
+		CL_CHECK_ERR(err);
+	}
+}
+
+static void scan_level(struct scanner *s, cl_mem src, cl_mem dst, size_t n, int inclusive, int level)
+{
+	size_t block = 2 * s->local_size;
+	size_t blocks = (n + block - 1) / block;
+	cl_uint count = (cl_uint) n;
+	cl_uint incl = (cl_uint) inclusive;
+	cl_int err;
+
+	err = clSetKernelArg(s->scan_blocks, 0, sizeof(cl_mem), &src);
+	err |= clSetKernelArg(s->scan_blocks, 1, sizeof(cl_mem), &dst);
+	err |= clSetKernelArg(s->scan_blocks, 2, sizeof(cl_mem), &s->sums[level]);
+	err |= clSetKernelArg(s->scan_blocks, 3, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(s->scan_blocks, 4, sizeof(cl_uint), &incl);
+	err |= clSetKernelArg(s->scan_blocks, 5, SCAN_PAD(block) * sizeof(cl_uint), NULL);
+	CL_CHECK_ERR(err);
+
+	enqueue(s, s->scan_blocks, blocks * s->local_size, s->local_size, "scan_blocks");
+
+	if (blocks == 1)
+		return;
+
+	/* Scan the block totals in place into carries, then add them. */
+	scan_level(s, s->sums[level], s->sums[level], blocks, SCAN_EXCLUSIVE, level + 1);
+
+	err = clSetKernelArg(s->add_carry, 0, sizeof(cl_mem), &dst);
+	err |= clSetKernelArg(s->add_carry, 1, sizeof(cl_mem), &s->sums[level]);
+	err |= clSetKernelArg(s->add_carry, 2, sizeof(cl_uint), &count);
+	CL_CHECK_ERR(err);
+
+	enqueue(s, s->add_carry, blocks * s->local_size, s->local_size, "scan_add_carry");
+}
+
+/* src and dst may be the same buffer. */
+void scan_run(struct scanner *s, cl_mem src, cl_mem dst, size_t n, int inclusive)
+{
+	if (n == 0)
+		return;
+
+	if (n > s->capacity)
+	{
+		fprintf(stderr, "Scan of %lu elements exceeds capacity %lu\n", (unsigned long) n, (unsigned long) s->capacity);
+		exit(1);
+	}
+
+	scan_level(s, src, dst, n, inclusive, 0);
+}
+
+/* Copy the values of src below threshold to dst, keeping their order.
+ * Returns how many were kept.
+ */
+size_t compact_run(struct scanner *s, cl_mem src, cl_mem dst, size_t n, cl_uint threshold)
+{
+	size_t global_size = (n + s->local_size - 1) / s->local_size * s->local_size;
+	cl_uint count = (cl_uint) n;
+	cl_uint kept;
+	cl_int err;
+
+	if (n == 0)
+		return 0;
+
+	err = clSetKernelArg(s->compact_flags, 0, sizeof(cl_mem), &src);
+	err |= clSetKernelArg(s->compact_flags, 1, sizeof(cl_mem), &s->flags);
+	err |= clSetKernelArg(s->compact_flags, 2, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(s->compact_flags, 3, sizeof(cl_uint), &threshold);
+	CL_CHECK_ERR(err);
+
+	enqueue(s, s->compact_flags, global_size, s->local_size, "compact_flags");
+
+	scan_run(s, s->flags, s->positions, n, SCAN_INCLUSIVE);
+
+	err = clSetKernelArg(s->compact_scatter, 0, sizeof(cl_mem), &src);
+	err |= clSetKernelArg(s->compact_scatter, 1, sizeof(cl_mem), &s->positions);
+	err |= clSetKernelArg(s->compact_scatter, 2, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(s->compact_scatter, 3, sizeof(cl_uint), &threshold);
+	err |= clSetKernelArg(s->compact_scatter, 4, sizeof(cl_mem), &dst);
+	CL_CHECK_ERR(err);
+
+	enqueue(s, s->compact_scatter, global_size, s->local_size, "compact_scatter");
+
+	err = clEnqueueReadBuffer(s->queue, s->positions, CL_TRUE, (n - 1) * sizeof(cl_uint), sizeof(cl_uint), &kept, 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	return kept;
+}
+
+/* Count (src[i] >> shift) & (num_bins - 1) into bins, num_bins being a
+ * power of two. If offsets is not NULL it receives the exclusive scan of
+ * the counts, i.e. where each bucket starts, so num_bins must then be
+ * within the scan capacity.
+ */
+void histogram_run(struct scanner *s, cl_mem src, size_t n, cl_uint shift, cl_uint num_bins, cl_mem bins, cl_mem offsets)
+{
+	size_t global_size = s->histogram_groups * s->histogram_local_size;
+	cl_uint count = (cl_uint) n;
+	cl_uint mask = num_bins - 1;
+	cl_uint zero = 0;
+	cl_int err;
+
+	err = clEnqueueFillBuffer(s->queue, bins, &zero, sizeof(zero), 0, num_bins * sizeof(cl_uint), 0, NULL, NULL);
+	CL_CHECK_ERR(err);
+
+	err = clSetKernelArg(s->histogram, 0, sizeof(cl_mem), &src);
+	err |= clSetKernelArg(s->histogram, 1, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(s->histogram, 2, sizeof(cl_uint), &shift);
+	err |= clSetKernelArg(s->histogram, 3, sizeof(cl_uint), &mask);
+	err |= clSetKernelArg(s->histogram, 4, sizeof(cl_mem), &bins);
+	err |= clSetKernelArg(s->histogram, 5, num_bins * sizeof(cl_uint), NULL);
+	CL_CHECK_ERR(err);
+
+	enqueue(s, s->histogram, global_size, s->histogram_local_size, "histogram");
+
+	if (offsets != NULL)
+		scan_run(s, bins, offsets, num_bins, SCAN_EXCLUSIVE);
+}
+
+void scanner_release(struct scanner *s)
+{
+	cl_int err;
+	int i;
+
+	for (i = 0; i < s->levels; i++)
+	{
+		err = clReleaseMemObject(s->sums[i]); CL_CHECK_ERR(err);
+	}
+
+	err = clReleaseMemObject(s->flags); CL_CHECK_ERR(err);
+	err = clReleaseMemObject(s->positions); CL_CHECK_ERR(err);
+	err = clReleaseKernel(s->scan_blocks); CL_CHECK_ERR(err);
+	err = clReleaseKernel(s->add_carry); CL_CHECK_ERR(err);
+	err = clReleaseKernel(s->compact_flags); CL_CHECK_ERR(err);
+	err = clReleaseKernel(s->compact_scatter); CL_CHECK_ERR(err);
+	err = clReleaseKernel(s->histogram); CL_CHECK_ERR(err);
+}
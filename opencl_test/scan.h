@@ -0,0 +1,45 @@
+#ifndef TEST_SCAN_H
+#define TEST_SCAN_H
+
+/* Each scan_blocks group scans 2 * SCAN_LOCAL_SIZE elements. Arbitrary
+ * lengths scan the block totals recursively, one level per factor of
+ * 2 * SCAN_LOCAL_SIZE.
+ */
+#define SCAN_LOCAL_SIZE 128
+#define SCAN_MAX_LEVELS 8
+
+/* Must match SCAN_PAD in test.cl. */
+#define SCAN_PAD(i) ((i) + ((i) >> 5))
+
+#define SCAN_EXCLUSIVE 0
+#define SCAN_INCLUSIVE 1
+
+struct scanner
+{
+	cl_command_queue queue;
+	cl_kernel scan_blocks;
+	cl_kernel add_carry;
+	cl_kernel compact_flags;
+	cl_kernel compact_scatter;
+	cl_kernel histogram;
+	size_t local_size;
+	size_t capacity;
+	size_t histogram_local_size;
+	size_t histogram_groups;
+	int levels;
+	cl_mem sums[SCAN_MAX_LEVELS];
+	cl_mem flags;
+	cl_mem positions;
+};
+
+/* Buffers are sized for up to capacity elements. The kernels come from
+ * test.cl. All calls only enqueue work, except compact_run which has to
+ * read back the count.
+ */
+void scanner_init(struct scanner *s, cl_context context, cl_device_id device, cl_command_queue queue, cl_program program, size_t capacity);
+void scan_run(struct scanner *s, cl_mem src, cl_mem dst, size_t n, int inclusive);
+size_t compact_run(struct scanner *s, cl_mem src, cl_mem dst, size_t n, cl_uint threshold);
+void histogram_run(struct scanner *s, cl_mem src, size_t n, cl_uint shift, cl_uint num_bins, cl_mem bins, cl_mem offsets);
+void scanner_release(struct scanner *s);
+
+#endif
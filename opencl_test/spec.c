@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "spec.h"
+
+void spec_init(struct spec_cache *s, cl_context context, cl_device_id device, const char *filename)
+{
+	memset(s, 0, sizeof(*s));
+	s->context = context;
+	s->device = device;
+	s->filename = filename;
+}
+
+static int spec_find_variant(struct spec_cache *s, const char *options)
+{
+	struct spec_variant *v;
+	int i;
+
+	for (i = 0; i < s->num_variants; i++)
+		if (strcmp(s->variants[i].options, options) == 0)
+			return i;
+
+	if (s->num_variants == SPEC_MAX_VARIANTS || strlen(options) >= SPEC_OPTIONS_LEN)
+	{
+		fprintf(stderr, "Cannot cache variant \"%s\" of %s\n", options, s->filename);
+		exit(1);
+	}
+
+	v = &s->variants[s->num_variants];
+	strcpy(v->options, options);
+	v->program = get_program_from_file_with_options(s->context, s->device, s->filename, options);
+	s->builds++;
+
+	return s->num_variants++;
+}
+
+/* The program built with options, "" being the generic one. */
+cl_program spec_program(struct spec_cache *s, const char *options)
+{
+	return s->variants[spec_find_variant(s, options)].program;
+}
+
+cl_kernel spec_kernel(struct spec_cache *s, const char *name, const char *options)
+{
+	struct spec_kernel_entry *k;
+	cl_int err;
+	int v, i;
+
+	v = spec_find_variant(s, options);
+
+	for (i = 0; i < s->num_kernels; i++)
+		if (s->kernels[i].variant == v && strcmp(s->kernels[i].name, name) == 0)
+		{
+			s->hits++;
+			return s->kernels[i].kernel;
+		}
+
+	if (s->num_kernels == SPEC_MAX_KERNELS || strlen(name) >= SPEC_NAME_LEN)
+	{
+		fprintf(stderr, "Cannot cache kernel %s\n", name);
+		exit(1);
+	}
+
+	k = &s->kernels[s->num_kernels];
+	k->kernel = clCreateKernel(s->variants[v].program, name, &err);
+	CL_CHECK_ERR(err);
+	k->variant = v;
+	strcpy(k->name, name);
+
+	s->num_kernels++;
+	return k->kernel;
+}
+
+void spec_release(struct spec_cache *s)
+{
+	cl_int err;
+	int i;
+
+	for (i = 0; i < s->num_kernels; i++)
+	{
+		err = clReleaseKernel(s->kernels[i].kernel);
+		CL_CHECK_ERR(err);
+	}
+
+	for (i = 0; i < s->num_variants; i++)
+	{
+		err = clReleaseProgram(s->variants[i].program);
+		CL_CHECK_ERR(err);
+	}
+
+	s->num_kernels = 0;
+	s->num_variants = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef TEST_SPEC_H
+#define TEST_SPEC_H
+
+/* Kernel specialization. The same source is built once per set of -D
+ * options, so sizes that would otherwise be kernel arguments become
+ * compile-time constants. Programs are cached per options string, in
+ * memory here and on disk by get_program_from_file_with_options(), and
+ * kernels per (options, name), so asking again for a variant costs a
+ * string compare.
+ *
+ * As with the runtime, a cached kernel is shared by every caller.
+ */
+#define SPEC_MAX_VARIANTS 32
+#define SPEC_MAX_KERNELS 64
+#define SPEC_OPTIONS_LEN 256
+#define SPEC_NAME_LEN 64
+
+struct spec_variant
+{
+	char options[SPEC_OPTIONS_LEN];
+	cl_program program;
+};
+
+struct spec_kernel_entry
+{
+	int variant;
+	char name[SPEC_NAME_LEN];
+	cl_kernel kernel;
+};
+
+struct spec_cache
+{
+	cl_context context;
+	cl_device_id device;
+	const char *filename;
+	struct spec_variant variants[SPEC_MAX_VARIANTS];
+	int num_variants;
+	struct spec_kernel_entry kernels[SPEC_MAX_KERNELS];
+	int num_kernels;
+	int hits;
+	int builds;
+};
+
+void spec_init(struct spec_cache *s, cl_context context, cl_device_id device, const char *filename);
+cl_program spec_program(struct spec_cache *s, const char *options);
+cl_kernel spec_kernel(struct spec_cache *s, const char *name, const char *options);
+void spec_release(struct spec_cache *s);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#include "common.h"
+#include "prof.h"
+#include "stream.h"
+
+void stream_init(struct stream *s, cl_context context, cl_device_id device, size_t chunk_size, size_t out_size, int num_buffers)
+{
+	cl_int err;
+	int i;
+
+	if (num_buffers < 1 || num_buffers > STREAM_MAX_BUFFERS)
+		num_buffers = STREAM_MAX_BUFFERS;
+
+	s->chunk_size = chunk_size;
+	s->out_size = out_size;
+	s->num_buffers = num_buffers;
+
+	s->upload = clCreateCommandQueue(context, device, prof_queue_properties(), &err);
+	CL_CHECK_ERR(err);
+	s->compute = clCreateCommandQueue(context, device, prof_queue_properties(), &err);
+	CL_CHECK_ERR(err);
+	s->download = clCreateCommandQueue(context, device, prof_queue_properties(), &err);
+	CL_CHECK_ERR(err);
+
+	for (i = 0; i < num_buffers; i++)
+	{
+		s->in_bufs[i] = clCreateBuffer(context, CL_MEM_READ_ONLY, chunk_size, NULL, &err);
+		CL_CHECK_ERR(err);
+		s->out_bufs[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, out_size, NULL, &err);
+		CL_CHECK_ERR(err);
+
+		/* Pinned host staging, mapped for the lifetime of the stream. */
+		s->host_in_bufs[i] = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, chunk_size, NULL, &err);
+		CL_CHECK_ERR(err);
+		s->host_out_bufs[i] = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, out_size, NULL, &err);
+		CL_CHECK_ERR(err);
+
+		s->host_in[i] = clEnqueueMapBuffer(s->upload, s->host_in_bufs[i], CL_TRUE, CL_MAP_READ|CL_MAP_WRITE, 0, chunk_size, 0, NULL, NULL, &err);
+		CL_CHECK_ERR(err);
+		s->host_out[i] = clEnqueueMapBuffer(s->download, s->host_out_bufs[i], CL_TRUE, CL_MAP_READ|CL_MAP_WRITE, 0, out_size, 0, NULL, NULL, &err);
+		CL_CHECK_ERR(err);
+	}
+}
+
+/* Stream the whole input through the kernel. A buffer slot is only reused
+ * once the previous chunk in it has been read back and consumed, which
+ * also guarantees the kernel has finished with its input. Returns the
+ * number of input bytes processed.
+ */
+size_t stream_run(struct stream *s, stream_read_fn read, void *src, stream_kernel_fn kernel, stream_output_fn output, void *arg)
+{
+	cl_event up_ev[STREAM_MAX_BUFFERS];
+	cl_event kernel_ev[STREAM_MAX_BUFFERS];
+	cl_event down_ev[STREAM_MAX_BUFFERS];
+	size_t in_bytes[STREAM_MAX_BUFFERS];
+	size_t out_bytes[STREAM_MAX_BUFFERS];
+	int busy[STREAM_MAX_BUFFERS];
+	size_t total = 0;
+	size_t bytes;
+	size_t chunk;
+	int slot, i;
+	cl_int err;
+
+	for (i = 0; i < s->num_buffers; i++)
+		busy[i] = 0;
+
+	for (chunk = 0; ; chunk++)
+	{
+		slot = (int) (chunk % s->num_buffers);
+
+		/* Retire the chunk that last used this slot. */
+		if (busy[slot])
+		{
+			err = clWaitForEvents(1, &down_ev[slot]);
+			CL_CHECK_ERR(err);
+
+			output(s->host_in[slot], in_bytes[slot], s->host_out[slot], out_bytes[slot], arg);
+
+			prof_event(up_ev[slot], "stream upload", PROF_WRITE);
+			prof_event(kernel_ev[slot], "stream kernel", PROF_KERNEL);
+			prof_event(down_ev[slot], "stream download", PROF_READ);
+			err = clReleaseEvent(up_ev[slot]);
+			err |= clReleaseEvent(kernel_ev[slot]);
+			err |= clReleaseEvent(down_ev[slot]);
+			CL_CHECK_ERR(err);
+			busy[slot] = 0;
+		}
+
+		bytes = read(src, s->host_in[slot], s->chunk_size);
+		if (bytes == 0)
+			break;
+
+		in_bytes[slot] = bytes;
+		total += bytes;
+
+		err = clEnqueueWriteBuffer(s->upload, s->in_bufs[slot], CL_FALSE, 0, bytes, s->host_in[slot], 0, NULL, &up_ev[slot]);
+		CL_CHECK_ERR(err);
+		out_bytes[slot] = kernel(s->compute, s->in_bufs[slot], s->out_bufs[slot], bytes, arg, 1, &up_ev[slot], &kernel_ev[slot]);
+		err = clEnqueueReadBuffer(s->download, s->out_bufs[slot], CL_FALSE, 0, out_bytes[slot], s->host_out[slot], 1, &kernel_ev[slot], &down_ev[slot]);
+		CL_CHECK_ERR(err);
+
+		err = clFlush(s->upload);
+		err |= clFlush(s->compute);
+		err |= clFlush(s->download);
+		CL_CHECK_ERR(err);
+
+		busy[slot] = 1;
+	}
+
+	/* Drain the remaining chunks in order. */
+	for (i = 1; i <= s->num_buffers; i++)
+	{
+		slot = (int) ((chunk + i) % s->num_buffers);
+		if (!busy[slot])
+			continue;
+
+		err = clWaitForEvents(1, &down_ev[slot]);
+		CL_CHECK_ERR(err);
+
+		output(s->host_in[slot], in_bytes[slot], s->host_out[slot], out_bytes[slot], arg);
+
+		prof_event(up_ev[slot], "stream upload", PROF_WRITE);
+		prof_event(kernel_ev[slot], "stream kernel", PROF_KERNEL);
+		prof_event(down_ev[slot], "stream download", PROF_READ);
+		err = clReleaseEvent(up_ev[slot]);
+		err |= clReleaseEvent(kernel_ev[slot]);
+		err |= clReleaseEvent(down_ev[slot]);
+		CL_CHECK_ERR(err);
+	}
+
+	return total;
+}
+
+void stream_release(struct stream *s)
+{
+	cl_int err;
+	int i;
+
+	for (i = 0; i < s->num_buffers; i++)
+	{
+		err = clEnqueueUnmapMemObject(s->upload, s->host_in_bufs[i], s->host_in[i], 0, NULL, NULL); CL_CHECK_ERR(err);
+		err = clEnqueueUnmapMemObject(s->download, s->host_out_bufs[i], s->host_out[i], 0, NULL, NULL); CL_CHECK_ERR(err);
+	}
+
+	err = clFinish(s->upload); CL_CHECK_ERR(err);
+	err = clFinish(s->download); CL_CHECK_ERR(err);
+
+	for (i = 0; i < s->num_buffers; i++)
+	{
+		err = clReleaseMemObject(s->in_bufs[i]); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(s->out_bufs[i]); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(s->host_in_bufs[i]); CL_CHECK_ERR(err);
+		err = clReleaseMemObject(s->host_out_bufs[i]); CL_CHECK_ERR(err);
+	}
+
+	err = clReleaseCommandQueue(s->upload); CL_CHECK_ERR(err);
+	err = clReleaseCommandQueue(s->compute); CL_CHECK_ERR(err);
+	err = clReleaseCommandQueue(s->download); CL_CHECK_ERR(err);
+}
+
+size_t stream_read_memory(void *src, void *buf, size_t max)
+{
+	struct stream_memory *m = (struct stream_memory *) src;
+	size_t n = m->size - m->pos;
+
+	if (n > max)
+		n = max;
+
+	memcpy(buf, m->data + m->pos, n);
+	m->pos += n;
+
+	return n;
+}
@@ -0,0 +1,56 @@
+#ifndef TEST_STREAM_H
+#define TEST_STREAM_H
+
+#define STREAM_MAX_BUFFERS 3
+
+/* Fill buf with up to max bytes of input, returning how many were written
+ * (0 at the end of the input). The callback may pad a short final chunk.
+ */
+typedef size_t (*stream_read_fn)(void *src, void *buf, size_t max);
+
+/* Enqueue the work for one chunk of in_bytes bytes on queue after the wait
+ * list, returning its completion event in *done and the number of output
+ * bytes to read back.
+ */
+typedef size_t (*stream_kernel_fn)(cl_command_queue queue, cl_mem in, cl_mem out, size_t in_bytes, void *arg,
+	cl_uint num_wait, const cl_event *wait, cl_event *done);
+
+/* Consume one finished chunk. in is still valid until this returns. */
+typedef void (*stream_output_fn)(const void *in, size_t in_bytes, const void *out, size_t out_bytes, void *arg);
+
+/* A ring of device buffers cycled across separate upload, compute and
+ * download queues so that uploading chunk k+1, running chunk k and reading
+ * back chunk k-1 can overlap. The host side of each buffer is pinned
+ * (ALLOC_HOST_PTR, mapped once) so transfers can use DMA.
+ */
+struct stream
+{
+	cl_command_queue upload;
+	cl_command_queue compute;
+	cl_command_queue download;
+	size_t chunk_size;
+	size_t out_size;
+	int num_buffers;
+	cl_mem in_bufs[STREAM_MAX_BUFFERS];
+	cl_mem out_bufs[STREAM_MAX_BUFFERS];
+	cl_mem host_in_bufs[STREAM_MAX_BUFFERS];
+	cl_mem host_out_bufs[STREAM_MAX_BUFFERS];
+	void *host_in[STREAM_MAX_BUFFERS];
+	void *host_out[STREAM_MAX_BUFFERS];
+};
+
+/* In-memory input for stream_read_memory(). */
+struct stream_memory
+{
+	const char *data;
+	size_t size;
+	size_t pos;
+};
+
+void stream_init(struct stream *s, cl_context context, cl_device_id device, size_t chunk_size, size_t out_size, int num_buffers);
+size_t stream_run(struct stream *s, stream_read_fn read, void *src, stream_kernel_fn kernel, stream_output_fn output, void *arg);
+void stream_release(struct stream *s);
+
+size_t stream_read_memory(void *src, void *buf, size_t max);
+
+#endif
@@ -27,15 +27,38 @@ __kernel void sum_numbers(
 
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	if (get_local_id(0) == 0)
+	/* Tree reduction with sequential addressing. The local size must be
+	 * a power of two; see reduce.cl for the general version.
+	 */
+	for (i = get_local_size(0) / 2; i > 0; i >>= 1)
 	{
-		sum = 0;
-		for (i = 0; i < get_local_size(0); i++)
-			sum += local_sums[i];
-		group_sums[get_group_id(0)] = sum;
+		if (local_id < i)
+			local_sums[local_id] += local_sums[local_id + i];
+		barrier(CLK_LOCAL_MEM_FENCE);
 	}
+
+	if (local_id == 0)
+		group_sums[get_group_id(0)] = local_sums[0];
 }
  
+/* Built with -DMATRIX_N the row length is a compile-time constant and n is
+ * ignored, so the loop can be unrolled. -DMATRIX_VEC=2, 4, 8 or 16 reads
+ * the row that many floats at a time and needs MATRIX_N to be a multiple
+ * of it.
+ */
+#ifdef MATRIX_N
+#define MM_N MATRIX_N
+#else
+#define MM_N n
+#endif
+
+#ifndef MATRIX_VEC
+#define MATRIX_VEC 1
+#endif
+
+#define MM_CAT(a, b) a ## b
+#define MM_XCAT(a, b) MM_CAT(a, b)
+
 __kernel void matrix_multiply(
 	uint n,
 	__global float *aa,
@@ -45,9 +68,101 @@ __kernel void matrix_multiply(
 	int i = get_global_id(0);
 	int j;
 	float tmp = 0.0f;
-	for (j = 0; j < n; j++)
-		tmp += aa[i*n+j] * b[j];
-	c[i] = aa[i*n+i];
+#if MATRIX_VEC > 1
+	MM_XCAT(float, MATRIX_VEC) acc = 0.0f;
+	float lanes[MATRIX_VEC];
+
+	for (j = 0; j < MM_N / MATRIX_VEC; j++)
+		acc += MM_XCAT(vload, MATRIX_VEC)(j, aa + (size_t) i*MM_N) * MM_XCAT(vload, MATRIX_VEC)(j, b);
+
+	MM_XCAT(vstore, MATRIX_VEC)(acc, 0, lanes);
+	for (j = 0; j < MATRIX_VEC; j++)
+		tmp += lanes[j];
+#else
+	for (j = 0; j < MM_N; j++)
+		tmp += aa[i*MM_N+j] * b[j];
+#endif
+	c[i] = tmp;
+}
+
+/* Dense linear algebra. All matrices are row-major. */
+
+/* y = A x for an m x n matrix A. One work-group per row, with the
+ * work-items striding across the row so neighbouring work-items read
+ * neighbouring elements. The local size must be a power of two.
+ */
+__kernel void sgemv(
+	uint m,
+	uint n,
+	__global const float *a,
+	__global const float *x,
+	__global float *y,
+	__local float *partial)
+{
+	uint row = get_group_id(0);
+	uint lid = get_local_id(0);
+	uint lsize = get_local_size(0);
+	__global const float *arow = a + (size_t) row * n;
+	float sum = 0.0f;
+	uint j, s;
+
+	for (j = lid; j < n; j += lsize)
+		sum += arow[j] * x[j];
+
+	partial[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (s = lsize / 2; s > 0; s >>= 1)
+	{
+		if (lid < s)
+			partial[lid] += partial[lid + s];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0 && row < m)
+		y[row] = partial[0];
+}
+
+#ifndef SGEMM_TS
+#define SGEMM_TS 16
+#endif
+
+/* C = A B for an m x k matrix A and a k x n matrix B. Each work-group
+ * computes one SGEMM_TS x SGEMM_TS block of C, staging tiles of A and B in
+ * local memory. Each work-item computes four adjacent columns of one row
+ * using float4 loads and stores, so the local size is
+ * (SGEMM_TS / 4, SGEMM_TS). m, n and k must be multiples of SGEMM_TS; the
+ * host pads the matrices with zeros.
+ */
+__kernel void sgemm_tiled(
+	uint m,
+	uint n,
+	uint k,
+	__global const float *a,
+	__global const float *b,
+	__global float *c)
+{
+	__local float asub[SGEMM_TS][SGEMM_TS];
+	__local float bsub[SGEMM_TS][SGEMM_TS];
+	uint lx = get_local_id(0);
+	uint ly = get_local_id(1);
+	uint row = get_group_id(1) * SGEMM_TS + ly;
+	uint col = get_group_id(0) * SGEMM_TS + lx * 4;
+	float4 acc = (float4) (0.0f);
+	uint t, i;
+
+	for (t = 0; t < k; t += SGEMM_TS)
+	{
+		vstore4(vload4(0, a + (size_t) row * k + t + lx * 4), 0, &asub[ly][lx * 4]);
+		vstore4(vload4(0, b + (size_t) (t + ly) * n + col), 0, &bsub[ly][lx * 4]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (i = 0; i < SGEMM_TS; i++)
+			acc += asub[ly][i] * vload4(0, &bsub[i][lx * 4]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	vstore4(acc, 0, c + (size_t) row * n + col);
 }
 
 /* lookup3 */
@@ -75,82 +190,453 @@ __kernel void matrix_multiply(
   c ^= b; c -= l3_rotate(b,24); \
 }
 
-uint lookup3(char *key, int len, int seed)
+#define l3_word(k) \
+	((uint) (k)[0] | ((uint) (k)[1] << 8) | ((uint) (k)[2] << 16) | ((uint) (k)[3] << 24))
+
+/* hashlittle2, reading a byte at a time so keys can start anywhere and
+ * nothing past the end of the key is touched. *pc and *pb are the seeds
+ * on the way in and the two hashes on the way out; *pc alone is
+ * hashlittle. Must match lookup3_2 in hash.c.
+ */
+void lookup3_2(__global const uchar *k, uint len, uint *pc, uint *pb)
 {
 	uint a, b, c;
-	char *k8;
-	uint *k;
 	
-	a = b = c = 0xdeadbeef + (((uint) len) << 2) + seed;
-	k = (uint *) key;
+	a = b = c = 0xdeadbeef + len + *pc;
+	c += *pb;
 
 	while (len > 12)
 	{
-		a += k[0];
-		b += k[1];
-		c += k[2];
+		a += l3_word(k);
+		b += l3_word(k + 4);
+		c += l3_word(k + 8);
 		l3_mix(a,b,c);
 		len -= 12;
-		k += 3;
+		k += 12;
 	}
 
-	k8 = (char *) k;
-
-    switch(len)
-    {
-		case 12:
-			c+=k[4]+(((uint)k[5])<<16);
-			b+=k[2]+(((uint)k[3])<<16);
-			a+=k[0]+(((uint)k[1])<<16);
-		break;
-		case 11:
-			c+=((uint)k8[10])<<16; // fall through
-		case 10:
-			c+=k[4];
-			b+=k[2]+(((uint)k[3])<<16);
-			a+=k[0]+(((uint)k[1])<<16);
-		break;
-		case 9:
-			c+=k8[8]; // fall through
-		case 8:
-			b+=k[2]+(((uint)k[3])<<16);
-			a+=k[0]+(((uint)k[1])<<16);
-		break;
-		case 7:
-			b+=((uint)k8[6])<<16; // fall through
-		case 6:
-			b+=k[2];
-			a+=k[0]+(((uint)k[1])<<16);
-		break;
-		case 5:
-			b+=k8[4]; // fall through
-		case 4:
-			a+=k[0]+(((uint)k[1])<<16);
-		break;
-		case 3:
-			a+=((uint)k8[2])<<16; // fall through
-		case 2:
-			a+=k[0];
+	switch(len)
+	{
+		case 12: c+=((uint)k[11])<<24; // fall through
+		case 11: c+=((uint)k[10])<<16; // fall through
+		case 10: c+=((uint)k[9])<<8;   // fall through
+		case 9:  c+=k[8];              // fall through
+		case 8:  b+=((uint)k[7])<<24;  // fall through
+		case 7:  b+=((uint)k[6])<<16;  // fall through
+		case 6:  b+=((uint)k[5])<<8;   // fall through
+		case 5:  b+=k[4];              // fall through
+		case 4:  a+=((uint)k[3])<<24;  // fall through
+		case 3:  a+=((uint)k[2])<<16;  // fall through
+		case 2:  a+=((uint)k[1])<<8;   // fall through
+		case 1:  a+=k[0];
 		break;
-		case 1:
-			a+=k8[0];
-			break;
 		case 0:
-			return c; // zero length requires no mixing
-    }
+			*pc = c; // zero length requires no mixing
+			*pb = b;
+			return;
+	}
 
 	l3_final(a, b, c);
+	*pc = c;
+	*pb = b;
+}
+
+uint lookup3(__global const uchar *key, uint len, uint seed)
+{
+	uint c = seed;
+	uint b = 0;
+
+	lookup3_2(key, len, &c, &b);
 	return c;
 }
 
+/* Fixed length keys, len bytes apart. Built with -DKEY_LEN the length is
+ * a compile-time constant and len is ignored, so the block loop can be
+ * unrolled and the tail switch resolved.
+ */
+#ifdef KEY_LEN
+#define HASH_KEY_LEN KEY_LEN
+#else
+#define HASH_KEY_LEN len
+#endif
+
 __kernel void lookup3_hash_keys(
-	__global char *keys,
-	int len,
-	int seed,
+	__global const uchar *keys,
+	uint len,
+	uint seed,
+	__global uint *hashes)
+{
+	uint gid = get_global_id(0);
+	hashes[gid] = lookup3(&keys[(size_t) gid*HASH_KEY_LEN], HASH_KEY_LEN, seed);
+}
+
+/* Variable length keys packed back to back: key i runs from
+ * keys[offsets[i]] to keys[offsets[i+1]]. The global size may be rounded
+ * up past num_keys.
+ */
+__kernel void lookup3_hash_keys_csr(
+	__global const uchar *keys,
+	__global const uint *offsets,
+	uint num_keys,
+	uint seed,
+	__global uint *hashes)
+{
+	uint gid = get_global_id(0);
+	uint start;
+
+	if (gid >= num_keys)
+		return;
+
+	start = offsets[gid];
+	hashes[gid] = lookup3(&keys[start], offsets[gid + 1] - start, seed);
+}
+
+/* As above with both hashlittle2 words, c in the low half. */
+__kernel void lookup3_hash64_keys_csr(
+	__global const uchar *keys,
+	__global const uint *offsets,
+	uint num_keys,
+	uint seed,
+	__global ulong *hashes)
+{
+	uint gid = get_global_id(0);
+	uint start;
+	uint c = seed;
+	uint b = 0;
+
+	if (gid >= num_keys)
+		return;
+
+	start = offsets[gid];
+	lookup3_2(&keys[start], offsets[gid + 1] - start, &c, &b);
+	hashes[gid] = (ulong) c | ((ulong) b << 32);
+}
+
+/* Interleaved (structure of arrays) fixed length keys: word w of key k,
+ * little-endian and zero padded past the end of the key, is at
+ * words[w * num_keys + k]. Neighbouring work-items then read neighbouring
+ * words, which coalesces where keys len bytes apart cannot.
+ *
+ * keys_to_soa converts packed keys, one work-item per (key, word) with
+ * the keys along dimension 0 so the writes are contiguous. Must match
+ * hash_keys_to_soa in hash.c.
+ */
+__kernel void keys_to_soa(
+	__global const uchar *keys,
+	uint num_keys,
+	uint len,
+	__global uint *words)
+{
+	uint k = get_global_id(0);
+	uint w = get_global_id(1);
+	__global const uchar *p = &keys[(size_t) k * len + w * 4];
+	uint left, word;
+
+	if (k >= num_keys)
+		return;
+
+	left = len - w * 4;
+	if (left >= 4)
+		word = l3_word(p);
+	else
+	{
+		word = 0;
+		switch (left)
+		{
+			case 3: word |= (uint) p[2] << 16; // fall through
+			case 2: word |= (uint) p[1] << 8;  // fall through
+			case 1: word |= p[0];
+		}
+	}
+
+	words[(size_t) w * num_keys + k] = word;
+}
+
+/* lookup3 over interleaved keys. The padding is zero, so the tail adds
+ * whole words where hashlittle adds the bytes that are left, and the
+ * switch reduces to which of a, b and c get one. Takes -DKEY_LEN as
+ * lookup3_hash_keys does.
+ */
+__kernel void lookup3_hash_keys_soa(
+	__global const uint *words,
+	uint num_keys,
+	uint len,
+	uint seed,
 	__global uint *hashes)
+{
+	uint k = get_global_id(0);
+	__global const uint *p = &words[k];
+	uint left = HASH_KEY_LEN;
+	uint a, b, c;
+
+	if (k >= num_keys)
+		return;
+
+	a = b = c = 0xdeadbeef + HASH_KEY_LEN + seed;
+
+	while (left > 12)
+	{
+		a += p[0];
+		b += p[num_keys];
+		c += p[2 * num_keys];
+		l3_mix(a,b,c);
+		left -= 12;
+		p += 3 * num_keys;
+	}
+
+	if (left == 0)
+	{
+		hashes[k] = c;
+		return;
+	}
+
+	a += p[0];
+	if (left > 4)
+		b += p[num_keys];
+	if (left > 8)
+		c += p[2 * num_keys];
+
+	l3_final(a, b, c);
+	hashes[k] = c;
+}
+
+/* 64-bit hashes of fixed length keys, len bytes apart as for
+ * lookup3_hash_keys and taking -DKEY_LEN the same way.
+ */
+__kernel void lookup3_hash64_keys(
+	__global const uchar *keys,
+	uint len,
+	uint seed,
+	__global ulong *hashes)
+{
+	uint gid = get_global_id(0);
+	uint c = seed;
+	uint b = 0;
+
+	lookup3_2(&keys[(size_t) gid*HASH_KEY_LEN], HASH_KEY_LEN, &c, &b);
+	hashes[gid] = (ulong) c | ((ulong) b << 32);
+}
+
+/* Unaligned little-endian reads; n bytes, zero padded. */
+ulong hash_read64(__global const uchar *p)
+{
+	return (ulong) l3_word(p) | ((ulong) l3_word(p + 4) << 32);
+}
+
+ulong hash_read_tail(__global const uchar *p, uint n)
+{
+	ulong v = 0;
+	uint i;
+
+	for (i = 0; i < n; i++)
+		v |= (ulong) p[i] << (8 * i);
+	return v;
+}
+
+/* XXH64. Must match xxhash64 in hash.c. */
+#define XXH_P1 11400714785074694791UL
+#define XXH_P2 14029467366897019727UL
+#define XXH_P3 1609587929392839161UL
+#define XXH_P4 9650029242287828579UL
+#define XXH_P5 2870177450012600261UL
+
+#define xxh_round(acc, input) (rotate((acc) + (input) * XXH_P2, 31UL) * XXH_P1)
+#define xxh_merge(h, v) ((((h) ^ xxh_round(0UL, v))) * XXH_P1 + XXH_P4)
+
+ulong xxhash64(__global const uchar *p, uint len, uint seed)
+{
+	uint left = len;
+	ulong v1, v2, v3, v4, h;
+
+	if (left >= 32)
+	{
+		v1 = seed + XXH_P1 + XXH_P2;
+		v2 = seed + XXH_P2;
+		v3 = seed;
+		v4 = seed - XXH_P1;
+
+		do
+		{
+			v1 = xxh_round(v1, hash_read64(p));
+			v2 = xxh_round(v2, hash_read64(p + 8));
+			v3 = xxh_round(v3, hash_read64(p + 16));
+			v4 = xxh_round(v4, hash_read64(p + 24));
+			p += 32;
+			left -= 32;
+		} while (left >= 32);
+
+		h = rotate(v1, 1UL) + rotate(v2, 7UL) + rotate(v3, 12UL) + rotate(v4, 18UL);
+		h = xxh_merge(h, v1);
+		h = xxh_merge(h, v2);
+		h = xxh_merge(h, v3);
+		h = xxh_merge(h, v4);
+	}
+	else
+		h = seed + XXH_P5;
+
+	h += len;
+
+	for (; left >= 8; left -= 8, p += 8)
+	{
+		h ^= xxh_round(0UL, hash_read64(p));
+		h = rotate(h, 27UL) * XXH_P1 + XXH_P4;
+	}
+
+	if (left >= 4)
+	{
+		h ^= (ulong) l3_word(p) * XXH_P1;
+		h = rotate(h, 23UL) * XXH_P2 + XXH_P3;
+		left -= 4;
+		p += 4;
+	}
+
+	for (; left > 0; left--, p++)
+	{
+		h ^= *p * XXH_P5;
+		h = rotate(h, 11UL) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+__kernel void xxhash64_keys(
+	__global const uchar *keys,
+	uint len,
+	uint seed,
+	__global ulong *hashes)
+{
+	uint gid = get_global_id(0);
+	hashes[gid] = xxhash64(&keys[(size_t) gid*HASH_KEY_LEN], HASH_KEY_LEN, seed);
+}
+
+/* First half of MurmurHash3_x64_128. The tail is read as two zero padded
+ * words, so its fifteen case switch becomes two conditional mixes. Must
+ * match murmur3_64 in hash.c.
+ */
+#define MM3_C1 0x87c37b91114253d5UL
+#define MM3_C2 0x4cf5ad432745937fUL
+
+ulong mm3_fmix(ulong k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdUL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53UL;
+	k ^= k >> 33;
+	return k;
+}
+
+ulong murmur3_64(__global const uchar *p, uint len, uint seed)
+{
+	ulong h1 = seed, h2 = seed;
+	ulong k1, k2;
+	uint i, tail = len & 15;
+
+	for (i = 0; i < len / 16; i++, p += 16)
+	{
+		k1 = hash_read64(p);
+		k2 = hash_read64(p + 8);
+
+		k1 *= MM3_C1; k1 = rotate(k1, 31UL); k1 *= MM3_C2; h1 ^= k1;
+		h1 = rotate(h1, 27UL); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= MM3_C2; k2 = rotate(k2, 33UL); k2 *= MM3_C1; h2 ^= k2;
+		h2 = rotate(h2, 31UL); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	k1 = hash_read_tail(p, min(tail, 8u));
+	k2 = tail > 8 ? hash_read_tail(p + 8, tail - 8) : 0;
+
+	if (tail > 8)
+	{
+		k2 *= MM3_C2; k2 = rotate(k2, 33UL); k2 *= MM3_C1; h2 ^= k2;
+	}
+	if (tail > 0)
+	{
+		k1 *= MM3_C1; k1 = rotate(k1, 31UL); k1 *= MM3_C2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = mm3_fmix(h1);
+	h2 = mm3_fmix(h2);
+	return h1 + h2;
+}
+
+__kernel void murmur3_x64_keys(
+	__global const uchar *keys,
+	uint len,
+	uint seed,
+	__global ulong *hashes)
 {
 	uint gid = get_global_id(0);
-	hashes[gid] = lookup3((uint *) &keys[gid*len], len, seed);
+	hashes[gid] = murmur3_64(&keys[(size_t) gid*HASH_KEY_LEN], HASH_KEY_LEN, seed);
+}
+
+/* hashlittle2 of N interleaved keys per work-item, one per vector lane:
+ * word w of keys k to k + N - 1 is a single vloadN. All keys have the
+ * same length, so the loop and the tail are the same for every lane.
+ * num_keys must be a multiple of N. c is the low half of each hash, as
+ * for lookup3_hash64_keys.
+ */
+#define LOOKUP3_HASH64_SOA(N) \
+__kernel void lookup3_hash64_keys_soa##N( \
+	__global const uint *words, \
+	uint num_keys, \
+	uint len, \
+	uint seed, \
+	__global ulong *hashes) \
+{ \
+	uint k = get_global_id(0) * N; \
+	__global const uint *p = &words[k]; \
+	uint left = HASH_KEY_LEN; \
+	uint##N a, b, c; \
+\
+	if (k >= num_keys) \
+		return; \
+\
+	a = b = c = (uint##N) (0xdeadbeef + HASH_KEY_LEN + seed); \
+\
+	while (left > 12) \
+	{ \
+		a += vload##N(0, p); \
+		b += vload##N(0, p + num_keys); \
+		c += vload##N(0, p + 2 * num_keys); \
+		l3_mix(a,b,c); \
+		left -= 12; \
+		p += 3 * num_keys; \
+	} \
+\
+	if (left > 0) \
+	{ \
+		a += vload##N(0, p); \
+		if (left > 4) \
+			b += vload##N(0, p + num_keys); \
+		if (left > 8) \
+			c += vload##N(0, p + 2 * num_keys); \
+		l3_final(a, b, c); \
+	} \
+\
+	vstore##N(convert_ulong##N(c) | (convert_ulong##N(b) << 32), 0, &hashes[k]); \
+}
+
+LOOKUP3_HASH64_SOA(4)
+LOOKUP3_HASH64_SOA(8)
+
+/* Plain copy. Also used to first-touch a buffer from a given (sub-)device
+ * so that its pages are allocated on that device's NUMA node.
+ */
+__kernel void copy_uint4(__global const uint4 *src, __global uint4 *dst)
+{
+	size_t i = get_global_id(0);
+	dst[i] = src[i];
 }
 
 /* Parallel min example from AMD APP Programming Guide. */
@@ -199,7 +685,390 @@ __kernel void minp(
 	}
 }
 
+/* Fold the per-group minimums into gmin[0]. Work-item 0 must not take
+ * part: it would read gmin[0] while the others atomically update it.
+ */
 __kernel void reduce(__global uint4 *src, __global uint *gmin)
 {
-	(void) atom_min(gmin, gmin[get_global_id(0)]);
+	uint gid = get_global_id(0);
+
+	if (gid > 0)
+		(void) atom_min(gmin, gmin[gid]);
+}
+
+/* Scan, compaction and histograms. */
+
+/* Pad local indices by one word every 32 so the strided accesses of
+ * the sweeps do not all land in the same bank.
+ */
+#define SCAN_LOG_BANKS 5
+#define SCAN_PAD(i) ((i) + ((i) >> SCAN_LOG_BANKS))
+
+/* Work-efficient (Blelloch) scan of one block of 2 * local size elements:
+ * an up-sweep builds partial sums in a tree, the root is cleared and a
+ * down-sweep pushes the prefixes back down. Writes the exclusive (or
+ * inclusive) scan of the block and the block total to block_sums, which
+ * scan.c scans in turn and adds back with scan_add_carry. The local size
+ * must be a power of two and tmp must hold SCAN_PAD(2 * local size) uints.
+ */
+__kernel void scan_blocks(
+	__global const uint *src,
+	__global uint *dst,
+	__global uint *block_sums,
+	uint n,
+	uint inclusive,
+	__local uint *tmp)
+{
+	uint lid = get_local_id(0);
+	uint lsize = get_local_size(0);
+	uint m = 2 * lsize;
+	uint base = get_group_id(0) * m;
+	uint ai = lid;
+	uint bi = lid + lsize;
+	uint a = base + ai < n ? src[base + ai] : 0;
+	uint b = base + bi < n ? src[base + bi] : 0;
+	uint offset = 1;
+	uint d, i, j, t;
+
+	tmp[SCAN_PAD(ai)] = a;
+	tmp[SCAN_PAD(bi)] = b;
+
+	for (d = lsize; d > 0; d >>= 1)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+		{
+			i = offset * (2 * lid + 1) - 1;
+			j = offset * (2 * lid + 2) - 1;
+			tmp[SCAN_PAD(j)] += tmp[SCAN_PAD(i)];
+		}
+		offset <<= 1;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (lid == 0)
+	{
+		block_sums[get_group_id(0)] = tmp[SCAN_PAD(m - 1)];
+		tmp[SCAN_PAD(m - 1)] = 0;
+	}
+
+	for (d = 1; d < m; d <<= 1)
+	{
+		offset >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+		{
+			i = offset * (2 * lid + 1) - 1;
+			j = offset * (2 * lid + 2) - 1;
+			t = tmp[SCAN_PAD(i)];
+			tmp[SCAN_PAD(i)] = tmp[SCAN_PAD(j)];
+			tmp[SCAN_PAD(j)] += t;
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (base + ai < n)
+		dst[base + ai] = tmp[SCAN_PAD(ai)] + (inclusive ? a : 0);
+	if (base + bi < n)
+		dst[base + bi] = tmp[SCAN_PAD(bi)] + (inclusive ? b : 0);
+}
+
+/* Add each block's carry, the exclusive scan of the block totals. Same
+ * launch shape as scan_blocks.
+ */
+__kernel void scan_add_carry(
+	__global uint *dst,
+	__global const uint *carry,
+	uint n)
+{
+	uint lid = get_local_id(0);
+	uint lsize = get_local_size(0);
+	uint base = get_group_id(0) * 2 * lsize;
+	uint c = carry[get_group_id(0)];
+
+	if (base + lid < n)
+		dst[base + lid] += c;
+	if (base + lid + lsize < n)
+		dst[base + lid + lsize] += c;
+}
+
+/* Compaction keeps the values below threshold, in order. flags is scanned
+ * inclusively, so positions[i] - 1 is where a kept src[i] goes and
+ * positions[n - 1] is the number kept.
+ */
+__kernel void compact_flags(
+	__global const uint *src,
+	__global uint *flags,
+	uint n,
+	uint threshold)
+{
+	uint gid = get_global_id(0);
+
+	if (gid < n)
+		flags[gid] = src[gid] < threshold;
+}
+
+__kernel void compact_scatter(
+	__global const uint *src,
+	__global const uint *positions,
+	uint n,
+	uint threshold,
+	__global uint *dst)
+{
+	uint gid = get_global_id(0);
+
+	if (gid < n && src[gid] < threshold)
+		dst[positions[gid] - 1] = src[gid];
+}
+
+/* Counts of (src[i] >> shift) & mask. Each group counts into local memory
+ * first so only one global atomic per bin and group is needed. bins must
+ * be zeroed and lbins must hold mask + 1 uints.
+ */
+__kernel void histogram(
+	__global const uint *src,
+	uint n,
+	uint shift,
+	uint mask,
+	__global uint *bins,
+	__local uint *lbins)
+{
+	uint lid = get_local_id(0);
+	uint lsize = get_local_size(0);
+	uint i;
+
+	for (i = lid; i <= mask; i += lsize)
+		lbins[i] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = get_global_id(0); i < n; i += get_global_size(0))
+		atomic_inc(&lbins[(src[i] >> shift) & mask]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = lid; i <= mask; i += lsize)
+		if (lbins[i] != 0)
+			atomic_add(&bins[i], lbins[i]);
+}
+
+/* Open addressing hash table of variable length keys. A slot holds the
+ * index of a key, or HASH_TABLE_EMPTY. Keys are CSR packed as for
+ * lookup3_hash_keys_csr, whose output is the hashes array. The table
+ * size is a power of two and mask is one less.
+ */
+#define HASH_TABLE_EMPTY 0xffffffff
+
+bool keys_equal(__global const uchar *keys_a, __global const uint *offsets_a, uint a,
+	__global const uchar *keys_b, __global const uint *offsets_b, uint b)
+{
+	uint start_a = offsets_a[a];
+	uint start_b = offsets_b[b];
+	uint len = offsets_a[a + 1] - start_a;
+	uint i;
+
+	if (offsets_b[b + 1] - start_b != len)
+		return false;
+
+	for (i = 0; i < len; i++)
+		if (keys_a[start_a + i] != keys_b[start_b + i])
+			return false;
+
+	return true;
+}
+
+/* Insert every key with linear probing, claiming empty slots with
+ * atomic_cmpxchg. A key that finds an equal key already in the table is
+ * not inserted, so first[i] is the index of the key that holds the slot
+ * for key i's value: i itself for the first copy seen, which makes this
+ * a dedup as well. The table must have more slots than keys.
+ */
+__kernel void hash_table_build(
+	__global const uchar *keys,
+	__global const uint *offsets,
+	__global const uint *hashes,
+	uint num_keys,
+	__global uint *slots,
+	uint mask,
+	__global uint *first)
+{
+	uint gid = get_global_id(0);
+	uint h, slot, prev;
+
+	if (gid >= num_keys)
+		return;
+
+	h = hashes[gid];
+	slot = h & mask;
+
+	for (;;)
+	{
+		prev = atomic_cmpxchg(&slots[slot], HASH_TABLE_EMPTY, gid);
+		if (prev == HASH_TABLE_EMPTY)
+		{
+			first[gid] = gid;
+			return;
+		}
+
+		if (hashes[prev] == h && keys_equal(keys, offsets, prev, keys, offsets, gid))
+		{
+			first[gid] = prev;
+			return;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+/* Look every probe key up in a table built from build_keys. matches[i] is
+ * the index of the equal build key, or HASH_TABLE_EMPTY.
+ */
+__kernel void hash_table_probe(
+	__global const uchar *build_keys,
+	__global const uint *build_offsets,
+	__global const uint *build_hashes,
+	__global const uint *slots,
+	uint mask,
+	__global const uchar *keys,
+	__global const uint *offsets,
+	uint num_keys,
+	uint seed,
+	__global uint *matches)
+{
+	uint gid = get_global_id(0);
+	uint h, slot, cur;
+
+	if (gid >= num_keys)
+		return;
+
+	h = lookup3(&keys[offsets[gid]], offsets[gid + 1] - offsets[gid], seed);
+	slot = h & mask;
+
+	for (;;)
+	{
+		cur = slots[slot];
+		if (cur == HASH_TABLE_EMPTY)
+			break;
+
+		if (build_hashes[cur] == h && keys_equal(build_keys, build_offsets, cur, keys, offsets, gid))
+			break;
+
+		slot = (slot + 1) & mask;
+	}
+
+	matches[gid] = cur;
+}
+
+/* Request batching, see batch.h. Many small requests run in one launch,
+ * each a segment described by a batch_segment; a segment is always worked
+ * on by a whole work-group. lmin must hold one uint per work-item and the
+ * local size must be a power of two.
+ */
+#define BATCH_HASH 0
+#define BATCH_MIN 1
+
+typedef struct
+{
+	uint kind;
+	uint first;
+	uint count;
+	uint out;
+	uint seed;
+	uint pad[3];
+} batch_segment;
+
+/* BATCH_HASH: keys first to first + count of the CSR blob, one hash each.
+ * BATCH_MIN: the min of values first to first + count, in one word.
+ */
+void batch_run_segment(
+	__global const batch_segment *seg,
+	__global const uchar *keys,
+	__global const uint *offsets,
+	__global const uint *values,
+	__global uint *out,
+	__local uint *lmin)
+{
+	uint lid = get_local_id(0);
+	uint lsize = get_local_size(0);
+	uint kind = seg->kind;
+	uint first = seg->first;
+	uint count = seg->count;
+	uint dst = seg->out;
+	uint pmin = (uint) -1;
+	uint i, start;
+
+	if (kind == BATCH_HASH)
+	{
+		for (i = lid; i < count; i += lsize)
+		{
+			start = offsets[first + i];
+			out[dst + i] = lookup3(&keys[start], offsets[first + i + 1] - start, seg->seed);
+		}
+		return;
+	}
+
+	for (i = lid; i < count; i += lsize)
+		pmin = min(pmin, values[first + i]);
+
+	lmin[lid] = pmin;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = lsize / 2; i > 0; i >>= 1)
+	{
+		if (lid < i)
+			lmin[lid] = min(lmin[lid], lmin[lid + i]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		out[dst] = lmin[0];
+}
+
+/* One work-group per segment. */
+__kernel void batch_segments(
+	__global const batch_segment *segs,
+	uint num_segs,
+	__global const uchar *keys,
+	__global const uint *offsets,
+	__global const uint *values,
+	__global uint *out,
+	__local uint *lmin)
+{
+	if (get_group_id(0) >= num_segs)
+		return;
+
+	batch_run_segment(&segs[get_group_id(0)], keys, offsets, values, out, lmin);
+}
+
+/* Persistent work-groups: each takes the next segment from *head until
+ * there are none left. The host clears *head before every launch.
+ */
+__kernel void batch_persistent(
+	__global const batch_segment *segs,
+	uint num_segs,
+	__global const uchar *keys,
+	__global const uint *offsets,
+	__global const uint *values,
+	__global uint *out,
+	__local uint *lmin,
+	__global uint *head)
+{
+	__local uint next;
+	uint seg;
+
+	for (;;)
+	{
+		if (get_local_id(0) == 0)
+			next = atomic_inc(head);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		seg = next;
+
+		if (seg >= num_segs)
+			return;
+
+		batch_run_segment(&segs[seg], keys, offsets, values, out, lmin);
+
+		/* Nobody may still be reading next or lmin when they change. */
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
 }
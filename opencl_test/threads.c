@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "threads.h"
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID p)
+#else
+static void *thread_main(void *p)
+#endif
+{
+	struct thread *t = (struct thread *) p;
+
+	t->fn(t->arg);
+
+	return 0;
+}
+
+void thread_start(struct thread *t, thread_fn fn, void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+
+#ifdef _WIN32
+	t->handle = CreateThread(NULL, 0, thread_main, t, 0, NULL);
+	if (t->handle == NULL)
+#else
+	if (pthread_create(&t->handle, NULL, thread_main, t) != 0)
+#endif
+	{
+		fprintf(stderr, "Failed to create thread in file %s at line %d\n", __FILE__, __LINE__);
+		exit(1);
+	}
+}
+
+void thread_join(struct thread *t)
+{
+#ifdef _WIN32
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+#else
+	pthread_join(t->handle, NULL);
+#endif
+}
+
+int get_num_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return (int) info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int) n : 1;
+#endif
+}
+
+#ifdef _WIN32
+#define latch_lock(l) AcquireSRWLockExclusive((PSRWLOCK) &(l)->lock)
+#define latch_unlock(l) ReleaseSRWLockExclusive((PSRWLOCK) &(l)->lock)
+#else
+#define latch_lock(l) pthread_mutex_lock(&(l)->lock)
+#define latch_unlock(l) pthread_mutex_unlock(&(l)->lock)
+#endif
+
+void latch_init(struct latch *l, int count)
+{
+#ifdef _WIN32
+	InitializeSRWLock((PSRWLOCK) &l->lock);
+	InitializeConditionVariable((PCONDITION_VARIABLE) &l->cond);
+#else
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_cond_init(&l->cond, NULL);
+#endif
+	l->count = count;
+}
+
+void latch_add(struct latch *l, int n)
+{
+	latch_lock(l);
+	l->count += n;
+	latch_unlock(l);
+}
+
+void latch_count_down(struct latch *l)
+{
+	latch_lock(l);
+	if (--l->count <= 0)
+	{
+#ifdef _WIN32
+		WakeAllConditionVariable((PCONDITION_VARIABLE) &l->cond);
+#else
+		pthread_cond_broadcast(&l->cond);
+#endif
+	}
+	latch_unlock(l);
+}
+
+void latch_wait(struct latch *l)
+{
+	latch_lock(l);
+	while (l->count > 0)
+	{
+#ifdef _WIN32
+		SleepConditionVariableSRW((PCONDITION_VARIABLE) &l->cond, (PSRWLOCK) &l->lock, INFINITE, 0);
+#else
+		pthread_cond_wait(&l->cond, &l->lock);
+#endif
+	}
+	latch_unlock(l);
+}
+
+void latch_destroy(struct latch *l)
+{
+#ifndef _WIN32
+	pthread_mutex_destroy(&l->lock);
+	pthread_cond_destroy(&l->cond);
+#endif
+}
+
+struct parallel_range
+{
+	parallel_fn fn;
+	void *arg;
+	size_t first;
+	size_t count;
+	int thread;
+};
+
+static void parallel_main(void *p)
+{
+	struct parallel_range *r = (struct parallel_range *) p;
+
+	r->fn(r->first, r->count, r->thread, r->arg);
+}
+
+/* Split [0, count) into at most num_threads contiguous ranges, as even as
+ * possible. Returns the number of ranges.
+ */
+static int split_range(size_t count, int num_threads, size_t *firsts, size_t *counts)
+{
+	size_t first, n;
+	int i;
+
+	if (num_threads > PARALLEL_MAX_THREADS)
+		num_threads = PARALLEL_MAX_THREADS;
+	if ((size_t) num_threads > count)
+		num_threads = (int) count;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	first = 0;
+	for (i = 0; i < num_threads; i++)
+	{
+		n = count / num_threads + ((size_t) i < count % num_threads ? 1 : 0);
+		firsts[i] = first;
+		counts[i] = n;
+		first += n;
+	}
+
+	return num_threads;
+}
+
+void parallel_for(size_t count, int num_threads, parallel_fn fn, void *arg)
+{
+	struct thread threads[PARALLEL_MAX_THREADS];
+	struct parallel_range ranges[PARALLEL_MAX_THREADS];
+	size_t firsts[PARALLEL_MAX_THREADS], counts[PARALLEL_MAX_THREADS];
+	int i;
+
+	num_threads = split_range(count, num_threads, firsts, counts);
+	if (num_threads <= 1)
+	{
+		fn(0, count, 0, arg);
+		return;
+	}
+
+	for (i = 0; i < num_threads; i++)
+	{
+		ranges[i].fn = fn;
+		ranges[i].arg = arg;
+		ranges[i].first = firsts[i];
+		ranges[i].count = counts[i];
+		ranges[i].thread = i;
+	}
+
+	for (i = 1; i < num_threads; i++)
+		thread_start(&threads[i], parallel_main, &ranges[i]);
+
+	parallel_main(&ranges[0]);
+
+	for (i = 1; i < num_threads; i++)
+		thread_join(&threads[i]);
+}
+
+/* A worker re-arms its start latch before counting down done, so it is
+ * armed again by the time pool_for() can hand out the next range.
+ */
+static void pool_main(void *p)
+{
+	struct pool_worker *w = (struct pool_worker *) p;
+	struct thread_pool *pool = w->pool;
+
+	for (;;)
+	{
+		latch_wait(&w->start);
+		latch_add(&w->start, 1);
+
+		if (pool->stop)
+			return;
+
+		pool->fn(pool->firsts[w->index], pool->counts[w->index], w->index, pool->arg);
+		latch_count_down(&pool->done);
+	}
+}
+
+/* Worker 0 is the calling thread, so only num_threads - 1 are started. */
+void pool_init(struct thread_pool *pool, int num_threads)
+{
+	struct pool_worker *w;
+	int i;
+
+	if (num_threads > PARALLEL_MAX_THREADS)
+		num_threads = PARALLEL_MAX_THREADS;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	pool->num_threads = num_threads;
+	pool->stop = 0;
+	latch_init(&pool->done, 0);
+
+	for (i = 1; i < num_threads; i++)
+	{
+		w = &pool->workers[i];
+		w->pool = pool;
+		w->index = i;
+		latch_init(&w->start, 1);
+		thread_start(&w->thread, pool_main, w);
+	}
+}
+
+void pool_for(struct thread_pool *pool, size_t count, int num_threads, parallel_fn fn, void *arg)
+{
+	int i;
+
+	if (num_threads > pool->num_threads)
+		num_threads = pool->num_threads;
+
+	num_threads = split_range(count, num_threads, pool->firsts, pool->counts);
+	if (num_threads <= 1)
+	{
+		fn(0, count, 0, arg);
+		return;
+	}
+
+	pool->fn = fn;
+	pool->arg = arg;
+	latch_add(&pool->done, num_threads - 1);
+
+	for (i = 1; i < num_threads; i++)
+		latch_count_down(&pool->workers[i].start);
+
+	fn(pool->firsts[0], pool->counts[0], 0, arg);
+	latch_wait(&pool->done);
+}
+
+void pool_release(struct thread_pool *pool)
+{
+	int i;
+
+	pool->stop = 1;
+	for (i = 1; i < pool->num_threads; i++)
+		latch_count_down(&pool->workers[i].start);
+
+	for (i = 1; i < pool->num_threads; i++)
+	{
+		thread_join(&pool->workers[i].thread);
+		latch_destroy(&pool->workers[i].start);
+	}
+
+	latch_destroy(&pool->done);
+}
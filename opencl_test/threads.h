@@ -0,0 +1,90 @@
+#ifndef TEST_THREADS_H
+#define TEST_THREADS_H
+
+/* Minimal portable threads: Win32 threads on Windows, pthreads elsewhere.
+ * The handle is a HANDLE on Windows, kept opaque so Windows.h and its
+ * min/max macros stay out of the callers.
+ */
+#ifdef _WIN32
+typedef void *thread_handle;
+#else
+#include <pthread.h>
+typedef pthread_t thread_handle;
+#endif
+
+typedef void (*thread_fn)(void *arg);
+
+struct thread
+{
+	thread_handle handle;
+	thread_fn fn;
+	void *arg;
+};
+
+void thread_start(struct thread *t, thread_fn fn, void *arg);
+void thread_join(struct thread *t);
+int get_num_cpus(void);
+
+/* A counter that latch_wait() blocks on until it reaches zero. Work is
+ * added with latch_add() and marked done with latch_count_down(), from
+ * any thread. On Windows lock and cond are an SRWLOCK and a
+ * CONDITION_VARIABLE, both a single pointer.
+ */
+struct latch
+{
+#ifdef _WIN32
+	void *lock;
+	void *cond;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+	int count;
+};
+
+void latch_init(struct latch *l, int count);
+void latch_add(struct latch *l, int n);
+void latch_count_down(struct latch *l);
+void latch_wait(struct latch *l);
+void latch_destroy(struct latch *l);
+
+/* Split [0, count) into one contiguous range per thread and run fn on each,
+ * the first on the calling thread. Returns once all have finished.
+ */
+#define PARALLEL_MAX_THREADS 256
+
+typedef void (*parallel_fn)(size_t first, size_t count, int thread, void *arg);
+
+void parallel_for(size_t count, int num_threads, parallel_fn fn, void *arg);
+
+/* parallel_for() on threads started once and kept. Each worker sleeps on
+ * its own start latch and counts down done when its range is finished;
+ * pool_for() runs the first range on the calling thread like
+ * parallel_for() and uses at most num_threads of the pool, which must not
+ * be used from two threads at once.
+ */
+struct pool_worker
+{
+	struct thread thread;
+	struct latch start;
+	struct thread_pool *pool;
+	int index;
+};
+
+struct thread_pool
+{
+	struct pool_worker workers[PARALLEL_MAX_THREADS];
+	int num_threads;
+	struct latch done;
+	parallel_fn fn;
+	void *arg;
+	size_t firsts[PARALLEL_MAX_THREADS];
+	size_t counts[PARALLEL_MAX_THREADS];
+	int stop;
+};
+
+void pool_init(struct thread_pool *pool, int num_threads);
+void pool_for(struct thread_pool *pool, size_t count, int num_threads, parallel_fn fn, void *arg);
+void pool_release(struct thread_pool *pool);
+
+#endif